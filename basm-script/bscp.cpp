@@ -1,8 +1,13 @@
 #include "bscp.hpp"
 
 #include <argp.h>
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <new>
 
 #include "lex.h"
 
@@ -13,12 +18,16 @@ static char args_doc[] = "[FILE]";
 
 static struct argp_option options[] = {
     {"debug", 'd', 0, 0, "Enable debug output"},
+    {"echo", 'e', 0, 0, "Print the value of each statement"},
+    {"memory-limit", 'm', "BYTES", 0, "Allocate from an arena of at most BYTES; statements fail with Out of memory beyond it"},
     {0}
 };
 
 struct arguments {
     char *file;
     int debug;
+    int echo;
+    size_t memory_limit;    // 0表示使用默认分配器
 };
 
 static error_t parse_opt(int key, char *arg, struct argp_state *state) {
@@ -28,6 +37,18 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
     case 'd':
         arguments->debug = 1;
         break;
+    case 'e':
+        arguments->echo = 1;
+        break;
+    case 'm': {
+        char *end;
+        errno = 0;
+        unsigned long long limit = strtoull(arg, &end, 10);
+        if (errno || end == arg || *end || limit == 0 || limit > SIZE_MAX)
+            argp_error(state, "invalid memory limit: %s", arg);
+        arguments->memory_limit = (size_t)limit;
+        break;
+    }
     case ARGP_KEY_ARG:
         if (state->arg_num >= 1)
             argp_usage(state);
@@ -45,31 +66,35 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state) {
 
 static struct argp argp = {options, parse_opt, args_doc, doc};
 
-int execute_file(const char *filename) {
-    FILE* file = fopen(filename, "r");
-    if (!file) {
+int execute_file(bscp_context& ctx, const char *filename) {
+    struct lex_source_file src;
+    if (!lex_source_open(&src, filename)) {
         perror("Error opening file");
         return 1;
     }
 
-    
-    yyin = file;
-    int result = yy::parser()();
-    fclose(file);
-    
+    // 源文件映射整个保留到执行结束，词法单元直接引用其中的文本
+    int result = 1;
+    if (lex_init_with_buffer_r(ctx.lexer, src.data, src.size)) {
+        result = bscp_run(&ctx);
+    }
+    lex_cleanup_r(ctx.lexer);
+    lex_source_close(&src);
+
     return result;
 }
 
-int repl_mode() {
+int repl_mode(bscp_context& ctx) {
     printf("bscp REPL (press Ctrl+D to exit)\n");
     
+    // 各行共用同一个解释器状态，之前定义的变量在后面的行中仍然可见
+    ctx.echo = true;
     char line[1024];
     while (printf("> ") && fgets(line, sizeof(line), stdin)) {
         if (strlen(line) == 1 && line[0] == '\n') continue;
         
-        yyin = fmemopen(line, strlen(line), "r");
-        int result = yy::parser()();
-        fclose(yyin);
+        // 重复输入的行直接执行缓存的字节码
+        int result = bscp_eval(&ctx, line, strlen(line));
         
         if (result != 0) {
             fprintf(stderr, "Error parsing input\n");
@@ -85,12 +110,39 @@ int main(int argc, char *argv[]) {
     struct arguments arguments;
     arguments.file = NULL;
     arguments.debug = 0;
+    arguments.echo = 0;
+    arguments.memory_limit = 0;
 
     argp_parse(&argp, argc, argv, 0, 0, &arguments);
 
-    if (arguments.file) {
-        return execute_file(arguments.file);
-    } else {
-        return repl_mode();
+    // --memory-limit时解释器的全部内存从有上限的内存区分配，内存区比解释器状态活得长
+    struct lex_arena_allocator arena;
+    struct lex_allocator* allocator = nullptr;
+    if (arguments.memory_limit) {
+        lex_arena_allocator_init(&arena, nullptr, 0, arguments.memory_limit);
+        allocator = &arena.base;
+    }
+
+    int result = 1;
+    try {
+        bscp_context ctx(allocator);
+        if (!ctx.lexer || !ctx.atoms) {
+            fprintf(stderr, "Error: out of memory\n");
+        } else {
+            ctx.echo = arguments.echo;
+            if (arguments.file) {
+                result = execute_file(ctx, arguments.file);
+            } else {
+                result = repl_mode(ctx);
+            }
+        }
+    } catch (const std::bad_alloc&) {
+        // 上限小到连全局对象都放不下
+        fprintf(stderr, "Error: out of memory\n");
     }
+
+    if (allocator) {
+        lex_arena_allocator_release(&arena);
+    }
+    return result;
 }
@@ -0,0 +1,159 @@
+#include "bscp_runtime.h"
+
+/*
+ * bscp值的回收
+ *
+ * 大多数值只在一条语句中使用：运算的中间结果、字符串常量的副本、临时的对象。
+ * 语句执行期间创建的值都是新值，位于heap.cells链表的头部；
+ * 把新值写入更早的值（全局对象或已经晋升的值）时，写屏障把它和它引用的新值一起晋升。
+ * 语句结束时只需遍历这一段链表，没有晋升的新值不可能再被访问，直接释放，代价与新值的数量成正比。
+ *
+ * 晋升的值可能在之后被覆盖而变得不可达，也可能互相引用成环；
+ * 晋升的字节数超过上次回收后存活字节数的两倍时，以全局对象为根做一次标记-清除。
+ * 两个阶段都用显式的工作列表代替递归，任意深的嵌套都不会耗尽栈空间
+ */
+
+/* 释放一个值 */
+static void bscp_gc_free(bscp_context* ctx, bscp_heap_cell* cell){
+    if(cell->gc_tag == bscp_tag_obj){
+        bscp_delete(ctx, static_cast<bscp_obj*>(cell), LEX_ALLOC_SITE);
+    }else{
+        bscp_delete(ctx, static_cast<bscp_array*>(cell), LEX_ALLOC_SITE);
+    }
+}
+
+static size_t bscp_gc_bytes(const bscp_heap_cell* cell){
+    return cell->gc_tag == bscp_tag_obj
+        ? static_cast<const bscp_obj*>(cell)->heap_bytes()
+        : static_cast<const bscp_array*>(cell)->heap_bytes();
+}
+
+/* 对值直接引用的每个堆上的值调用visit */
+template<typename Visit>
+static inline void bscp_gc_children(bscp_heap_cell* cell, Visit visit){
+    if(cell->gc_tag == bscp_tag_obj){
+        bscp_obj* obj = static_cast<bscp_obj*>(cell);
+        for(uint32_t slot = 0; slot < obj->size(); slot++){
+            if(bscp_heap_cell* child = bscp_val_cell(obj->at(slot))){
+                visit(child);
+            }
+        }
+        return;
+    }
+    bscp_array* array = static_cast<bscp_array*>(cell);
+    if(!array->is_bytes()){
+        for(const bscp_val& value : array->values){
+            if(bscp_heap_cell* child = bscp_val_cell(value)){
+                visit(child);
+            }
+        }
+    }
+}
+
+void bscp_gc_promote(bscp_context* ctx, bscp_heap_cell* cell){
+    bscp_heap& heap = ctx->heap;
+    try{
+        cell->gc_young = false;
+        heap.promoted_bytes += bscp_gc_bytes(cell);
+        heap.worklist.push_back(cell);
+        while(!heap.worklist.empty()){
+            bscp_heap_cell* next = heap.worklist.back();
+            heap.worklist.pop_back();
+            bscp_gc_children(next, [&](bscp_heap_cell* child){
+                if(child->gc_young){
+                    child->gc_young = false;
+                    heap.promoted_bytes += bscp_gc_bytes(child);
+                    heap.worklist.push_back(child);
+                }
+            });
+        }
+    }catch(const std::bad_alloc&){
+        // 工作列表无法增长时保守地晋升当前语句的全部新值，被引用的新值绝不能在语句结束时释放
+        // 语句结束时随即做一次标记-清除，回收其中真正不可达的值
+        heap.worklist.clear();
+        for(bscp_heap_cell* young = heap.cells; young != nullptr; young = young->gc_next){
+            young->gc_young = false;
+        }
+        heap.promoted_bytes = heap.threshold;
+    }
+}
+
+void bscp_gc_end_statement(bscp_context* ctx, bscp_heap_cell* region){
+    bscp_heap& heap = ctx->heap;
+    bscp_heap_cell** link = &heap.cells;
+    while(*link != region){
+        bscp_heap_cell* cell = *link;
+        if(cell->gc_young){
+            *link = cell->gc_next;
+            bscp_gc_free(ctx, cell);
+            heap.count--;
+            heap.freed++;
+        }else{
+            link = &cell->gc_next;
+        }
+    }
+    if(heap.promoted_bytes >= heap.threshold){
+        bscp_gc_collect(ctx);
+    }
+}
+
+void bscp_gc_collect(bscp_context* ctx){
+    bscp_heap& heap = ctx->heap;
+    bool complete = true;
+    try{
+        // 全局对象不在链表中，它的字段是唯一的根
+        bscp_gc_children(ctx->global, [&](bscp_heap_cell* child){
+            if(!child->gc_marked){
+                child->gc_marked = true;
+                heap.worklist.push_back(child);
+            }
+        });
+        while(!heap.worklist.empty()){
+            bscp_heap_cell* next = heap.worklist.back();
+            heap.worklist.pop_back();
+            bscp_gc_children(next, [&](bscp_heap_cell* child){
+                if(!child->gc_marked){
+                    child->gc_marked = true;
+                    heap.worklist.push_back(child);
+                }
+            });
+        }
+    }catch(const std::bad_alloc&){
+        // 标记不完整时不能清除，只撤销标记，等下一次再试
+        heap.worklist.clear();
+        complete = false;
+    }
+
+    size_t live = 0;
+    bscp_heap_cell** link = &heap.cells;
+    while(*link != nullptr){
+        bscp_heap_cell* cell = *link;
+        if(complete && !cell->gc_marked){
+            *link = cell->gc_next;
+            bscp_gc_free(ctx, cell);
+            heap.count--;
+            heap.freed++;
+            continue;
+        }
+        cell->gc_marked = false;
+        live += bscp_gc_bytes(cell);
+        link = &cell->gc_next;
+    }
+    heap.worklist.shrink_to_fit();
+    heap.collections++;
+    heap.live_bytes = live;
+    heap.promoted_bytes = 0;
+    heap.threshold = live * 2 > BSCP_GC_MIN_THRESHOLD ? live * 2 : BSCP_GC_MIN_THRESHOLD;
+}
+
+void bscp_gc_release(bscp_context* ctx){
+    bscp_heap& heap = ctx->heap;
+    while(heap.cells != nullptr){
+        bscp_heap_cell* cell = heap.cells;
+        heap.cells = cell->gc_next;
+        bscp_gc_free(ctx, cell);
+    }
+    heap.count = 0;
+    heap.promoted_bytes = 0;
+    heap.live_bytes = 0;
+}
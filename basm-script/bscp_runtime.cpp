@@ -0,0 +1,658 @@
+#include "bscp_runtime.h"
+#include "bscp_vm.h"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+/* 运算符的文本，用于错误信息 */
+static const char* bscp_op_name(bscp_op op){
+    switch(op){
+        case bscp_op::add:  return "+";
+        case bscp_op::sub:  return "-";
+        case bscp_op::mul:  return "*";
+        case bscp_op::div:  return "/";
+        case bscp_op::mod:  return "%";
+        case bscp_op::shl:  return "<<";
+        case bscp_op::shr:  return ">>";
+        case bscp_op::band: return "&";
+        case bscp_op::bor:  return "|";
+        case bscp_op::bxor: return "^";
+        case bscp_op::lt:   return "<";
+        case bscp_op::le:   return "<=";
+        case bscp_op::gt:   return ">";
+        case bscp_op::ge:   return ">=";
+        case bscp_op::eq:   return "==";
+        case bscp_op::ne:   return "!=";
+    }
+    return "?";
+}
+
+/* 生成"Operands of 'op' must be numbers"错误信息 */
+static const char* bscp_operand_error(bscp_op op){
+    static thread_local char message[64];
+    snprintf(message, sizeof(message), "Operands of '%s' must be numbers", bscp_op_name(op));
+    return message;
+}
+
+/* 两个整数的运算，溢出时返回false，由调用者改用double计算 */
+static inline bool bscp_binary_int(bscp_op op, int64_t a, int64_t b, bscp_val* out, const char** error){
+    int64_t r;
+    switch(op){
+        case bscp_op::add:
+            if(__builtin_add_overflow(a, b, &r)) return false;
+            break;
+        case bscp_op::sub:
+            if(__builtin_sub_overflow(a, b, &r)) return false;
+            break;
+        case bscp_op::mul:
+            if(__builtin_mul_overflow(a, b, &r)) return false;
+            break;
+        case bscp_op::div:
+            if(b == 0){
+                *error = "Division by zero";
+                return true;
+            }
+            // INT64_MIN / -1溢出，不能整除时结果是浮点数
+            if((b == -1 && a == INT64_MIN) || a % b != 0) return false;
+            r = a / b;
+            break;
+        case bscp_op::mod:
+            if(b == 0){
+                *error = "Modulo by zero";
+                return true;
+            }
+            r = b == -1 ? 0 : a % b;
+            break;
+        case bscp_op::shl:
+        case bscp_op::shr:
+            if(b < 0 || b > 63){
+                *error = "Shift count out of range";
+                return true;
+            }
+            r = op == bscp_op::shl ? (int64_t)((uint64_t)a << b) : a >> b;
+            break;
+        case bscp_op::band: r = a & b; break;
+        case bscp_op::bor:  r = a | b; break;
+        case bscp_op::bxor: r = a ^ b; break;
+        case bscp_op::lt:   r = a < b; break;
+        case bscp_op::le:   r = a <= b; break;
+        case bscp_op::gt:   r = a > b; break;
+        case bscp_op::ge:   r = a >= b; break;
+        case bscp_op::eq:   r = a == b; break;
+        case bscp_op::ne:   r = a != b; break;
+        default:
+            return false;
+    }
+    *out = bscp_val::integer(r);
+    return true;
+}
+
+/* 浮点数运算，位运算先转换为整数 */
+static const char* bscp_binary_double(bscp_op op, bscp_val x, bscp_val y, bscp_val* out){
+    double a = x.to_double();
+    double b = y.to_double();
+    switch(op){
+        case bscp_op::add: *out = bscp_val::number(a + b); return NULL;
+        case bscp_op::sub: *out = bscp_val::number(a - b); return NULL;
+        case bscp_op::mul: *out = bscp_val::number(a * b); return NULL;
+        case bscp_op::div:
+            if(b == 0) return "Division by zero";
+            *out = bscp_val::number(a / b);
+            return NULL;
+        case bscp_op::mod:
+            if(b == 0) return "Modulo by zero";
+            *out = bscp_val::number(fmod(a, b));
+            return NULL;
+        case bscp_op::lt: *out = bscp_val::integer(a < b); return NULL;
+        case bscp_op::le: *out = bscp_val::integer(a <= b); return NULL;
+        case bscp_op::gt: *out = bscp_val::integer(a > b); return NULL;
+        case bscp_op::ge: *out = bscp_val::integer(a >= b); return NULL;
+        case bscp_op::eq: *out = bscp_val::integer(a == b); return NULL;
+        case bscp_op::ne: *out = bscp_val::integer(a != b); return NULL;
+        default: {
+            int64_t i, j;
+            if(!x.to_int(&i) || !y.to_int(&j)){
+                return "Operands of bitwise operators must fit in a 64-bit integer";
+            }
+            const char* error = NULL;
+            bscp_binary_int(op, i, j, out, &error);
+            return error;
+        }
+    }
+}
+
+/* 连接两个数组，两个都是字节串时结果仍是字节串 */
+static bscp_array* bscp_array_concat(bscp_context* ctx, const bscp_array* x, const bscp_array* y){
+    if(x->is_bytes() && y->is_bytes()){
+        bscp_array* r = bscp_heap_new<bscp_array>(ctx, LEX_ALLOC_SITE, x->bytes.data(), x->bytes.size());
+        r->bytes += y->bytes;
+        return r;
+    }
+    bscp_array* r = bscp_heap_new<bscp_array>(ctx, LEX_ALLOC_SITE, bscp_array_values);
+    r->values.reserve(x->size() + y->size());
+    for(size_t i = 0; i < x->size(); i++) r->values.push_back(x->get(i));
+    for(size_t i = 0; i < y->size(); i++) r->values.push_back(y->get(i));
+    return r;
+}
+
+const char* bscp_binary(bscp_context* ctx, bscp_op op, bscp_val a, bscp_val b, bscp_val* out){
+    // 快速路径：两个整数
+    if(a.tag == bscp_tag_int && b.tag == bscp_tag_int){
+        const char* error = NULL;
+        if(bscp_binary_int(op, a.as.i, b.as.i, out, &error)){
+            return error;
+        }
+        return bscp_binary_double(op, a, b, out);
+    }
+    if(a.is_num() && b.is_num()){
+        return bscp_binary_double(op, a, b, out);
+    }
+    if(a.is_array() && b.is_array()){
+        const bscp_array* x = a.as.array;
+        const bscp_array* y = b.as.array;
+        if(op == bscp_op::add){
+            *out = bscp_val::of(bscp_array_concat(ctx, x, y));
+            return NULL;
+        }
+        // 字节串按内容比较
+        if(x->is_bytes() && y->is_bytes() && op >= bscp_op::lt){
+            int c = x->bytes.compare(y->bytes);
+            bool r;
+            switch(op){
+                case bscp_op::lt: r = c < 0; break;
+                case bscp_op::le: r = c <= 0; break;
+                case bscp_op::gt: r = c > 0; break;
+                case bscp_op::ge: r = c >= 0; break;
+                case bscp_op::eq: r = c == 0; break;
+                default:          r = c != 0; break;
+            }
+            *out = bscp_val::integer(r);
+            return NULL;
+        }
+    }
+    // 非数值只能比较是否相同
+    if(op == bscp_op::eq || op == bscp_op::ne){
+        bool same = a.tag == b.tag && (a.tag == bscp_tag_null || a.as.obj == b.as.obj);
+        *out = bscp_val::integer(same == (op == bscp_op::eq));
+        return NULL;
+    }
+    return bscp_operand_error(op);
+}
+
+const char* bscp_unary(bscp_unop op, bscp_val a, bscp_val* out){
+    switch(op){
+        case bscp_unop::lnot:
+            *out = bscp_val::integer(!a.truthy());
+            return NULL;
+        case bscp_unop::plus:
+            if(!a.is_num()) return "Operand of '+' must be a number";
+            *out = a;
+            return NULL;
+        case bscp_unop::neg:
+            if(!a.is_num()) return "Operand of '-' must be a number";
+            if(a.is_int() && a.as.i != INT64_MIN){
+                *out = bscp_val::integer(-a.as.i);
+            }else{
+                *out = bscp_val::number(-a.to_double());
+            }
+            return NULL;
+        case bscp_unop::bnot:
+        {
+            int64_t i;
+            if(!a.is_num()) return "Operand of '~' must be a number";
+            if(!a.to_int(&i)) return "Operand of '~' must fit in a 64-bit integer";
+            *out = bscp_val::integer(~i);
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/* 把Unicode码点编码为UTF-8 */
+static void bscp_append_utf8(std::string& out, uint32_t c){
+    if(c < 0x80){
+        out += (char)c;
+    }else if(c < 0x800){
+        out += (char)(0xC0 | (c >> 6));
+        out += (char)(0x80 | (c & 0x3F));
+    }else if(c < 0x10000){
+        out += (char)(0xE0 | (c >> 12));
+        out += (char)(0x80 | ((c >> 6) & 0x3F));
+        out += (char)(0x80 | (c & 0x3F));
+    }else{
+        out += (char)(0xF0 | (c >> 18));
+        out += (char)(0x80 | ((c >> 12) & 0x3F));
+        out += (char)(0x80 | ((c >> 6) & 0x3F));
+        out += (char)(0x80 | (c & 0x3F));
+    }
+}
+
+/* 处理p处的一个转义序列（p指向'\'之后），返回转义序列之后的位置 */
+static const char* bscp_escape(const char* p, const char* end, std::string& out){
+    if(p >= end){
+        out += '\\';
+        return p;
+    }
+    char c = *p++;
+    switch(c){
+        case 'a': out += '\a'; return p;
+        case 'b': out += '\b'; return p;
+        case 'f': out += '\f'; return p;
+        case 'n': out += '\n'; return p;
+        case 'r': out += '\r'; return p;
+        case 't': out += '\t'; return p;
+        case 'v': out += '\v'; return p;
+        case 'x': {
+            uint32_t v = 0;
+            while(p < end && isxdigit((unsigned char)*p)){
+                v = v * 16 + (isdigit((unsigned char)*p) ? *p - '0' : (tolower((unsigned char)*p) - 'a' + 10));
+                p++;
+            }
+            out += (char)v;
+            return p;
+        }
+        case 'u':
+        case 'U': {
+            int digits = c == 'u' ? 4 : 8;
+            uint32_t v = 0;
+            for(int i = 0; i < digits && p < end && isxdigit((unsigned char)*p); i++, p++){
+                v = v * 16 + (isdigit((unsigned char)*p) ? *p - '0' : (tolower((unsigned char)*p) - 'a' + 10));
+            }
+            bscp_append_utf8(out, v);
+            return p;
+        }
+        default:
+            if(c >= '0' && c <= '7'){
+                uint32_t v = c - '0';
+                for(int i = 1; i < 3 && p < end && *p >= '0' && *p <= '7'; i++, p++){
+                    v = v * 8 + (*p - '0');
+                }
+                out += (char)v;
+                return p;
+            }
+            // \' \" \? \\ 以及其它字符原样保留
+            out += c;
+            return p;
+    }
+}
+
+std::string bscp_unescape(const char* text, size_t length){
+    std::string out;
+    if(length < 2){
+        return out;
+    }
+    // <a/b.h>形式的字符串没有转义序列
+    if(text[0] == '<'){
+        return std::string(text + 1, length - 2);
+    }
+    const char* p = text + 1;
+    const char* end = text + length - 1;
+    out.reserve(length - 2);
+    while(p < end){
+        if(*p == '\\'){
+            p = bscp_escape(p + 1, end, out);
+        }else{
+            out += *p++;
+        }
+    }
+    return out;
+}
+
+/* 按base解析无符号整数，超过64位时返回false */
+static bool bscp_parse_digits(const char* p, const char* end, int base, uint64_t* out){
+    uint64_t v = 0;
+    for(; p < end; p++){
+        int digit = isdigit((unsigned char)*p) ? *p - '0' : tolower((unsigned char)*p) - 'a' + 10;
+        if(__builtin_mul_overflow(v, (uint64_t)base, &v) || __builtin_add_overflow(v, (uint64_t)digit, &v)){
+            return false;
+        }
+    }
+    *out = v;
+    return true;
+}
+
+bscp_val bscp_parse_number(const char* text, size_t length){
+    const char* end = text + length;
+    if(length == 0){
+        return bscp_val::integer(0);
+    }
+    // 字符常量取第一个字节的值
+    if(text[0] == '\''){
+        std::string c = bscp_unescape(text, length);
+        return bscp_val::integer(c.empty() ? 0 : (unsigned char)c[0]);
+    }
+
+    uint64_t v;
+    if(length > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')){
+        // 十六进制、八进制和二进制按位模式解释，0xffffffffffffffff是-1
+        if(bscp_parse_digits(text + 2, end, 16, &v)) return bscp_val::integer((int64_t)v);
+    }else if(length > 2 && text[0] == '0' && (text[1] == 'b' || text[1] == 'B')){
+        if(bscp_parse_digits(text + 2, end, 2, &v)) return bscp_val::integer((int64_t)v);
+    }else if(memchr(text, '.', length) || memchr(text, 'e', length) || memchr(text, 'E', length)){
+        std::string s(text, length);
+        return bscp_val::number(strtod(s.c_str(), nullptr));
+    }else if(length > 1 && text[0] == '0'){
+        if(bscp_parse_digits(text + 1, end, 8, &v)) return bscp_val::integer((int64_t)v);
+    }else{
+        // 十进制超出int64时转为浮点数
+        if(bscp_parse_digits(text, end, 10, &v) && v <= (uint64_t)INT64_MAX){
+            return bscp_val::integer((int64_t)v);
+        }
+        std::string s(text, length);
+        return bscp_val::number(strtod(s.c_str(), nullptr));
+    }
+
+    // 超过64位的十六进制、八进制和二进制常量
+    int base = text[1] == 'x' || text[1] == 'X' ? 16 : (text[1] == 'b' || text[1] == 'B' ? 2 : 8);
+    const char* p = base == 8 ? text + 1 : text + 2;
+    double d = 0;
+    for(; p < end; p++){
+        d = d * base + (isdigit((unsigned char)*p) ? *p - '0' : tolower((unsigned char)*p) - 'a' + 10);
+    }
+    return bscp_val::number(d);
+}
+
+/* 输出浮点数，使用能精确还原的最短表示 */
+static void bscp_print_double(FILE* out, double d){
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.15g", d);
+    if(strtod(buf, nullptr) != d){
+        snprintf(buf, sizeof(buf), "%.17g", d);
+    }
+    // 保证输出能看出是浮点数
+    if(isfinite(d) && !strpbrk(buf, ".e")){
+        strcat(buf, ".0");
+    }
+    fputs(buf, out);
+}
+
+/* 输出字段名 */
+static void bscp_print_key(FILE* out, const bscp_context* ctx, bscp_key key){
+    if(bscp_key_is_index(key)){
+        fprintf(out, "%llu", (unsigned long long)(key & ~BSCP_KEY_INDEX));
+    }else{
+        const char* name = lex_atom_text(ctx->atoms, (lex_atom_t)key);
+        fputs(name ? name : "?", out);
+    }
+}
+
+/* 输出字节串，不可打印的字符使用转义序列 */
+static void bscp_print_bytes(FILE* out, const std::string& bytes){
+    fputc('"', out);
+    for(unsigned char c : bytes){
+        switch(c){
+            case '"':  fputs("\\\"", out); break;
+            case '\\': fputs("\\\\", out); break;
+            case '\n': fputs("\\n", out); break;
+            case '\t': fputs("\\t", out); break;
+            case '\r': fputs("\\r", out); break;
+            default:
+                if(c < 0x20 || c == 0x7f){
+                    fprintf(out, "\\%03o", c);
+                }else{
+                    fputc(c, out);
+                }
+        }
+    }
+    fputc('"', out);
+}
+
+/* 输出对象或数组中的元素，嵌套的对象和数组不再展开 */
+static void bscp_print_nested(FILE* out, const bscp_context* ctx, bscp_val value){
+    if(value.is_obj()){
+        fputs("{...}", out);
+    }else if(value.is_array() && !value.as.array->is_bytes()){
+        fputs("[...]", out);
+    }else{
+        bscp_print(out, ctx, value);
+    }
+}
+
+static void bscp_print_array(FILE* out, const bscp_context* ctx, const bscp_array* array){
+    if(array->is_bytes()){
+        bscp_print_bytes(out, array->bytes);
+        return;
+    }
+    fputc('[', out);
+    for(size_t i = 0; i < array->values.size(); i++){
+        if(i > 0){
+            fputs(", ", out);
+        }
+        bscp_print_nested(out, ctx, array->values[i]);
+    }
+    fputc(']', out);
+}
+
+void bscp_print(FILE* out, const bscp_context* ctx, bscp_val value){
+    switch(value.tag){
+        case bscp_tag_null:
+            fputs("null", out);
+            break;
+        case bscp_tag_int:
+            fprintf(out, "%lld", (long long)value.as.i);
+            break;
+        case bscp_tag_double:
+            bscp_print_double(out, value.as.d);
+            break;
+        case bscp_tag_array:
+            bscp_print_array(out, ctx, value.as.array);
+            break;
+        case bscp_tag_obj: {
+            // 只展开一层，对象之间可能有环；字段按加入的顺序输出
+            const bscp_obj* obj = value.as.obj;
+            fputc('{', out);
+            for(uint32_t slot = 0; slot < obj->size(); slot++){
+                if(slot > 0){
+                    fputs(", ", out);
+                }
+                bscp_print_key(out, ctx, obj->key_at(slot));
+                fputs(": ", out);
+                bscp_print_nested(out, ctx, obj->at(slot));
+            }
+            fputc('}', out);
+            break;
+        }
+    }
+}
+
+bscp_shape::bscp_shape()
+    : parent(nullptr), slot_count(0)
+{
+}
+
+bscp_shape::bscp_shape(bscp_shape* parent, bscp_key key)
+    : parent(parent), slot_count(parent->slot_count + 1), keys(parent->keys)
+{
+    keys.push_back(key);
+}
+
+uint32_t bscp_shape::find(bscp_key key) const {
+    // 形状的字段数有上限，线性查找足够快；最近加入的字段更常被访问，从后往前找
+    for(uint32_t slot = slot_count; slot > 0; slot--){
+        if(keys[slot - 1] == key){
+            return slot - 1;
+        }
+    }
+    return BSCP_SLOT_NONE;
+}
+
+bscp_shape* bscp_shape::add(bscp_key key){
+    auto& next = transitions[key];
+    if(!next){
+        next.reset(new bscp_shape(this, key));
+    }
+    return next.get();
+}
+
+bscp_inline_cache::bscp_inline_cache()
+    : next(0), hits(0), misses(0)
+{
+    for(auto& entry : entries){
+        entry.shape = nullptr;
+        entry.key = 0;
+        entry.slot = BSCP_SLOT_NONE;
+    }
+}
+
+bscp_obj::bscp_obj(bscp_shape* root, struct lex_allocator* allocator)
+    : bscp_heap_cell(bscp_tag_obj), shape(root), dict(nullptr), allocator(allocator), slots(inline_slots), count(0), capacity(BSCP_INLINE_SLOTS)
+{
+}
+
+bscp_obj::~bscp_obj(){
+    if(slots != inline_slots){
+        lex_dealloc(allocator, slots, capacity * sizeof(bscp_val), LEX_ALLOC_SITE);
+    }
+    delete dict;
+}
+
+size_t bscp_obj::heap_bytes() const {
+    size_t bytes = sizeof(*this);
+    if(slots != inline_slots){
+        bytes += capacity * sizeof(bscp_val);
+    }
+    if(dict){
+        bytes += sizeof(*dict) + dict->keys.capacity() * sizeof(bscp_key) + dict->index.size() * 2 * sizeof(bscp_key);
+    }
+    return bytes;
+}
+
+bscp_key bscp_obj::key_at(uint32_t slot) const {
+    return shape ? shape->key_at(slot) : dict->keys[slot];
+}
+
+uint32_t bscp_obj::find(bscp_key key, bscp_inline_cache* cache) const {
+    if(shape == nullptr){
+        auto it = dict->index.find(key);
+        return it == dict->index.end() ? BSCP_SLOT_NONE : it->second;
+    }
+    if(cache){
+        for(const auto& entry : cache->entries){
+            if(entry.shape == shape && entry.key == key){
+                cache->hits++;
+                return entry.slot;
+            }
+        }
+        cache->misses++;
+    }
+    uint32_t slot = shape->find(key);
+    if(cache && slot != BSCP_SLOT_NONE){
+        auto& entry = cache->entries[cache->next];
+        cache->next = (cache->next + 1) % BSCP_INLINE_CACHE_SIZE;
+        entry.shape = shape;
+        entry.key = key;
+        entry.slot = slot;
+    }
+    return slot;
+}
+
+void bscp_obj::reserve(uint32_t size){
+    if(size <= capacity){
+        return;
+    }
+    uint32_t new_capacity = capacity * 2 > size ? capacity * 2 : size;
+    bscp_val* new_slots = (bscp_val*)lex_alloc(allocator, new_capacity * sizeof(bscp_val), LEX_ALLOC_SITE);
+    if(new_slots == nullptr){
+        throw std::bad_alloc();
+    }
+    memcpy(new_slots, slots, count * sizeof(bscp_val));
+    if(slots != inline_slots){
+        lex_dealloc(allocator, slots, capacity * sizeof(bscp_val), LEX_ALLOC_SITE);
+    }
+    slots = new_slots;
+    capacity = new_capacity;
+}
+
+uint32_t bscp_obj::define(bscp_key key, bscp_inline_cache* cache){
+    uint32_t slot = find(key, cache);
+    if(slot != BSCP_SLOT_NONE){
+        return slot;
+    }
+    reserve(count + 1);
+    slot = count;
+    if(shape && shape->slot_count < BSCP_SHAPE_MAX_SLOTS){
+        shape = shape->add(key);
+    }else{
+        // 字段太多，转为字典模式，槽位下标保持不变
+        if(shape){
+            dict = new dictionary();
+            for(uint32_t i = 0; i < count; i++){
+                bscp_key k = shape->key_at(i);
+                dict->index.emplace(k, i);
+                dict->keys.push_back(k);
+            }
+            shape = nullptr;
+        }
+        dict->index.emplace(key, slot);
+        dict->keys.push_back(key);
+    }
+    slots[slot] = bscp_val::null();
+    count++;
+    return slot;
+}
+
+void bscp_array::generalize(){
+    if(kind == bscp_array_values){
+        return;
+    }
+    values.reserve(bytes.size());
+    for(unsigned char c : bytes){
+        values.push_back(bscp_val::integer(c));
+    }
+    std::string().swap(bytes);
+    kind = bscp_array_values;
+}
+
+const char* bscp_array::set(uint64_t index, bscp_val value){
+    size_t length = size();
+    if(index > length && index - length > BSCP_ARRAY_MAX_GAP){
+        return "Array index out of range";
+    }
+    // 字节串只能保存字节，越过末尾需要用空值填充时也要先转换
+    if(kind == bscp_array_bytes
+        && (!value.is_int() || value.as.i < 0 || value.as.i > 255 || index > length)){
+        generalize();
+    }
+    if(kind == bscp_array_bytes){
+        if(index == length){
+            bytes.push_back((char)value.as.i);
+        }else{
+            bytes[index] = (char)value.as.i;
+        }
+        return NULL;
+    }
+    if(index >= length){
+        values.resize(index + 1, bscp_val::null());
+    }
+    values[index] = value;
+    return NULL;
+}
+
+bscp_context::bscp_context(struct lex_allocator* allocator)
+    : global(nullptr), lexer(lex_create()), atoms(lex_atom_table_create_with_allocator(allocator)), shapes(new bscp_shape()),
+      program(nullptr), programs(new bscp_program_cache()),
+      out(stdout), diagnostics(stderr), echo(false), line_start(true), errors(0), allocator(allocator)
+{
+    global = bscp_new<bscp_obj>(this, LEX_ALLOC_SITE, shapes, allocator);
+    length_atom = atoms ? lex_atom_intern(atoms, "length", 6) : LEX_ATOM_NONE;
+    if(lexer && atoms){
+        lex_set_token_mode_r(lexer, lex_mode_view);
+        lex_set_allocator_r(lexer, allocator);
+        lex_set_atom_table_r(lexer, atoms);
+    }
+}
+
+bscp_context::~bscp_context(){
+    if(lexer){
+        lex_destroy(lexer);
+    }
+    lex_atom_table_destroy(atoms);
+    // 缓存的程序引用全局对象的槽位，先于全局对象释放
+    delete programs;
+    bscp_gc_release(this);
+    bscp_delete(this, global, LEX_ALLOC_SITE);
+    delete shapes;
+}
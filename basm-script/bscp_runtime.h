@@ -0,0 +1,479 @@
+#ifndef __BSCP_RUNTIME_H__
+#define __BSCP_RUNTIME_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+#include <unordered_map>
+#include <vector>
+
+#include "lex.h"
+
+class bscp_obj;
+class bscp_array;
+
+/* 值的类型标签，类型判断只比较标签 */
+enum bscp_tag : uint8_t {
+    bscp_tag_null,      // 空值
+    bscp_tag_int,       // 64位整数，立即数
+    bscp_tag_double,    // 双精度浮点数，立即数
+    bscp_tag_obj,       // 对象，指向堆上的bscp_obj
+    bscp_tag_array,     // 字节串或数组，指向堆上的bscp_array
+};
+
+/*
+ * bscp的值
+ * 整数和浮点数直接保存在值中，运算不需要分配内存；
+ * 只有对象存放在堆上。值是平凡可复制的，可以放进bison的%union
+ */
+struct bscp_val {
+    bscp_tag tag;
+    union {
+        int64_t i;
+        double d;
+        bscp_obj* obj;
+        bscp_array* array;
+    } as;
+
+    static bscp_val null() {
+        bscp_val v;
+        v.tag = bscp_tag_null;
+        v.as.i = 0;
+        return v;
+    }
+    static bscp_val integer(int64_t i) {
+        bscp_val v;
+        v.tag = bscp_tag_int;
+        v.as.i = i;
+        return v;
+    }
+    static bscp_val number(double d) {
+        bscp_val v;
+        v.tag = bscp_tag_double;
+        v.as.d = d;
+        return v;
+    }
+    static bscp_val object(bscp_obj* obj) {
+        bscp_val v;
+        v.tag = bscp_tag_obj;
+        v.as.obj = obj;
+        return v;
+    }
+    static bscp_val of(bscp_array* array) {
+        bscp_val v;
+        v.tag = bscp_tag_array;
+        v.as.array = array;
+        return v;
+    }
+
+    bool is_null() const { return tag == bscp_tag_null; }
+    bool is_int() const { return tag == bscp_tag_int; }
+    bool is_double() const { return tag == bscp_tag_double; }
+    bool is_num() const { return tag == bscp_tag_int || tag == bscp_tag_double; }
+    bool is_obj() const { return tag == bscp_tag_obj; }
+    bool is_array() const { return tag == bscp_tag_array; }
+
+    /* 数值转换，调用前应确认is_num() */
+    double to_double() const { return tag == bscp_tag_int ? (double)as.i : as.d; }
+    /*
+     * 转换为整数，浮点数截去小数部分
+     * NaN、无穷和超出int64范围的浮点数无法转换，返回false；直接强制转换是未定义行为
+     */
+    bool to_int(int64_t* out) const {
+        if (tag == bscp_tag_int) {
+            *out = as.i;
+            return true;
+        }
+        // 2^63可以精确表示为double，比较对NaN总是不成立
+        if (!(as.d >= -9223372036854775808.0 && as.d < 9223372036854775808.0)) {
+            return false;
+        }
+        *out = (int64_t)as.d;
+        return true;
+    }
+
+    /* 条件判断：数值非零为真，空值为假，对象和数组为真 */
+    bool truthy() const {
+        switch (tag) {
+            case bscp_tag_int:      return as.i != 0;
+            case bscp_tag_double:   return as.d != 0;
+            case bscp_tag_null:     return false;
+            default:                return true;
+        }
+    }
+};
+
+/*
+ * 字段名
+ * 标识符字段名是原子ID，整数下标的最高位置1，两者不会冲突；
+ * 字段名是整数，比较和哈希都不需要访问字符串
+ */
+typedef uint64_t bscp_key;
+#define BSCP_KEY_INDEX (1ULL << 63)
+#define BSCP_SLOT_NONE UINT32_MAX
+
+static inline bscp_key bscp_key_atom(lex_atom_t atom) { return atom; }
+static inline bscp_key bscp_key_index(uint64_t index) { return index | BSCP_KEY_INDEX; }
+static inline bool bscp_key_is_index(bscp_key key) { return (key & BSCP_KEY_INDEX) != 0; }
+
+#define BSCP_INLINE_SLOTS 4         /* 对象内嵌的槽位数，字段更多时槽位数组移到堆上 */
+#define BSCP_SHAPE_MAX_SLOTS 64     /* 形状的最大字段数，超过后对象转为字典模式 */
+#define BSCP_INLINE_CACHE_SIZE 4    /* 内联缓存的项数 */
+
+/*
+ * 形状（隐藏类）
+ * 描述对象有哪些字段以及每个字段所在的槽位，字段相同且加入顺序相同的对象共用一个形状；
+ * 形状组成一棵树，加入一个字段就沿着树边转移到子形状
+ */
+class bscp_shape
+{
+public:
+    bscp_shape* const parent;       /* 父形状，根形状为NULL */
+    const uint32_t slot_count;      /* 字段数 */
+
+    bscp_shape();
+    bscp_shape(const bscp_shape&) = delete;
+    bscp_shape& operator=(const bscp_shape&) = delete;
+
+    /* 查找字段所在的槽位，不存在时返回BSCP_SLOT_NONE */
+    uint32_t find(bscp_key key) const;
+    /* 获取加入一个字段后的形状，同样的转移总是得到同一个形状 */
+    bscp_shape* add(bscp_key key);
+    /* 获取槽位的字段名 */
+    bscp_key key_at(uint32_t slot) const { return keys[slot]; }
+
+private:
+    bscp_shape(bscp_shape* parent, bscp_key key);
+
+    std::vector<bscp_key> keys;     /* 槽位到字段名，包含父形状的字段 */
+    std::unordered_map<bscp_key, std::unique_ptr<bscp_shape>> transitions;
+};
+
+/*
+ * 内联缓存
+ * 每条访问字段的指令各有一个，记录最近见过的形状和字段对应的槽位，
+ * 命中时不需要在形状中查找
+ */
+struct bscp_inline_cache {
+    struct {
+        const bscp_shape* shape;
+        bscp_key key;
+        uint32_t slot;
+    } entries[BSCP_INLINE_CACHE_SIZE];
+    uint32_t next;                  /* 下一个被替换的项 */
+    unsigned long hits;
+    unsigned long misses;
+
+    bscp_inline_cache();
+};
+
+/*
+ * 堆上的值（对象和数组）共同的回收信息
+ * 解释器创建的值都串在bscp_context::heap.cells链表中；
+ * 语句执行期间创建的值是新值，语句结束时没有被更早的值引用的新值直接释放，
+ * 其余的值由以全局对象为根的标记-清除回收
+ */
+class bscp_heap_cell
+{
+public:
+    bscp_heap_cell* gc_next;        /* 链表中的下一个值，更早创建 */
+    const bscp_tag gc_tag;          /* bscp_tag_obj或bscp_tag_array，释放时据此选择析构函数 */
+    bool gc_young;                  /* 当前语句创建，还没有被更早的值引用 */
+    bool gc_marked;                 /* 标记阶段已经访问过 */
+
+    explicit bscp_heap_cell(bscp_tag tag): gc_next(nullptr), gc_tag(tag), gc_young(false), gc_marked(false) {}
+};
+
+/*
+ * 对象
+ * 字段值连续存放在槽位数组中，字段名到槽位的映射由共享的形状描述；
+ * 字段不会被删除，槽位下标在对象的生命周期内不变
+ */
+class bscp_obj : public bscp_heap_cell
+{
+public:
+    /* 超出内嵌槽位后的槽位数组从allocator分配，NULL表示默认分配器 */
+    explicit bscp_obj(bscp_shape* root, struct lex_allocator* allocator = nullptr);
+    ~bscp_obj();
+    bscp_obj(const bscp_obj&) = delete;
+    bscp_obj& operator=(const bscp_obj&) = delete;
+
+    /* 字段数 */
+    uint32_t size() const { return count; }
+    /* 槽位中的值 */
+    bscp_val& at(uint32_t slot) { return slots[slot]; }
+    const bscp_val& at(uint32_t slot) const { return slots[slot]; }
+    /* 槽位的字段名 */
+    bscp_key key_at(uint32_t slot) const;
+    /* 大致占用的字节数，用于决定何时回收 */
+    size_t heap_bytes() const;
+
+    /*
+     * 查找字段所在的槽位
+     * @param key 字段名
+     * @param cache 访问位置的内联缓存，可以为NULL
+     * @return 槽位，不存在时返回BSCP_SLOT_NONE
+     */
+    uint32_t find(bscp_key key, bscp_inline_cache* cache = nullptr) const;
+
+    /*
+     * 查找字段所在的槽位，不存在时加入值为空的字段
+     * @return 槽位，内存不足时抛出std::bad_alloc
+     */
+    uint32_t define(bscp_key key, bscp_inline_cache* cache = nullptr);
+
+    /* 获取字段的值，不存在时返回空值 */
+    bscp_val get(bscp_key key, bscp_inline_cache* cache = nullptr) const {
+        uint32_t slot = find(key, cache);
+        return slot == BSCP_SLOT_NONE ? bscp_val::null() : slots[slot];
+    }
+
+    /* 设置字段的值 */
+    void set(bscp_key key, bscp_val value, bscp_inline_cache* cache = nullptr) {
+        // define可能重新分配槽位数组，必须先于读取slots
+        uint32_t slot = define(key, cache);
+        slots[slot] = value;
+    }
+
+private:
+    /* 字典模式：字段太多时对象不再共用形状，使用自己的哈希表 */
+    struct dictionary {
+        std::unordered_map<bscp_key, uint32_t> index;
+        std::vector<bscp_key> keys;
+    };
+
+    void reserve(uint32_t capacity);
+
+    bscp_shape* shape;              /* 形状，字典模式下为NULL */
+    dictionary* dict;               /* 字典模式的字段表 */
+    struct lex_allocator* allocator;    /* 槽位数组的分配器 */
+    bscp_val* slots;                /* 槽位数组，字段少时指向inline_slots */
+    uint32_t count;                 /* 字段数 */
+    uint32_t capacity;              /* 槽位数组的容量 */
+    bscp_val inline_slots[BSCP_INLINE_SLOTS];
+};
+
+/* 数组元素的存储方式 */
+enum bscp_array_kind : uint8_t {
+    bscp_array_bytes,   // 紧凑字节串，每个元素是0~255的整数，字符串常量使用这种方式
+    bscp_array_values,  // 任意值的稠密数组
+};
+
+#define BSCP_ARRAY_MAX_GAP 4096     /* 越过末尾写入时最多用空值填充的元素数 */
+
+/*
+ * 字节串和数组
+ * 元素连续存放，按下标读写都是O(1)；
+ * 字节串写入不是字节的值时原地转为任意值的数组，其它引用看到的是同一个数组
+ */
+class bscp_array : public bscp_heap_cell
+{
+public:
+    bscp_array_kind kind;
+    std::string bytes;              /* kind为bscp_array_bytes时的元素 */
+    std::vector<bscp_val> values;   /* kind为bscp_array_values时的元素 */
+
+    explicit bscp_array(bscp_array_kind kind): bscp_heap_cell(bscp_tag_array), kind(kind) {}
+    bscp_array(const char* data, size_t length): bscp_heap_cell(bscp_tag_array), kind(bscp_array_bytes), bytes(data, length) {}
+    bscp_array(const bscp_array&) = delete;
+    bscp_array& operator=(const bscp_array&) = delete;
+
+    bool is_bytes() const { return kind == bscp_array_bytes; }
+    size_t size() const { return kind == bscp_array_bytes ? bytes.size() : values.size(); }
+
+    /* 读取元素，越界时返回空值 */
+    bscp_val get(uint64_t index) const {
+        if (index >= size()) {
+            return bscp_val::null();
+        }
+        return kind == bscp_array_bytes
+            ? bscp_val::integer((unsigned char)bytes[index])
+            : values[index];
+    }
+
+    /*
+     * 写入元素，下标等于长度时追加，稍微越过末尾时中间用空值填充
+     * @return NULL表示成功，否则为错误信息
+     */
+    const char* set(uint64_t index, bscp_val value);
+
+    /* 追加元素 */
+    void push(bscp_val value) { set(size(), value); }
+
+    /* 把字节串转为任意值的数组 */
+    void generalize();
+
+    /* 大致占用的字节数，用于决定何时回收 */
+    size_t heap_bytes() const {
+        return sizeof(*this) + bytes.capacity() + values.capacity() * sizeof(bscp_val);
+    }
+};
+
+/* 二元运算符 */
+enum class bscp_op : uint8_t {
+    add, sub, mul, div, mod,
+    shl, shr, band, bor, bxor,
+    lt, le, gt, ge, eq, ne,
+};
+
+/* 一元运算符 */
+enum class bscp_unop : uint8_t {
+    plus, neg, lnot, bnot,
+};
+
+class bscp_context;
+
+/*
+ * 二元运算
+ * 两个整数走int64快速路径，溢出或有浮点数参与时按double计算；
+ * 除法能整除时结果为整数，否则为浮点数
+ * @param ctx 解释器，数组连接的结果从它的分配器分配
+ * @param op 运算符
+ * @param a 左操作数
+ * @param b 右操作数
+ * @param out 运算结果
+ * @return NULL表示成功，否则为错误信息
+ */
+const char* bscp_binary(bscp_context* ctx, bscp_op op, bscp_val a, bscp_val b, bscp_val* out);
+
+/*
+ * 一元运算
+ * @return NULL表示成功，否则为错误信息
+ */
+const char* bscp_unary(bscp_unop op, bscp_val a, bscp_val* out);
+
+/* 解析数字常量：十进制、十六进制、八进制、二进制整数，浮点数和字符常量 */
+bscp_val bscp_parse_number(const char* text, size_t length);
+
+/* 去掉字符串常量的引号（或尖括号）并处理转义序列 */
+std::string bscp_unescape(const char* text, size_t length);
+
+/* 输出值，用于REPL回显 */
+void bscp_print(FILE* out, const bscp_context* ctx, bscp_val value);
+
+#define BSCP_GC_MIN_THRESHOLD (1024 * 1024)    /* 晋升这么多字节之前不做标记-清除 */
+
+/* 解释器创建的值，以及回收的状态和统计 */
+struct bscp_heap {
+    bscp_heap_cell* cells;          /* 所有堆上的值，最新创建的在头部 */
+    size_t count;                   /* 链表中的值数 */
+    size_t promoted_bytes;          /* 上次标记-清除以来晋升的字节数 */
+    size_t live_bytes;              /* 上次标记-清除后存活的字节数 */
+    size_t threshold;               /* promoted_bytes达到它时做标记-清除，为存活字节数的两倍 */
+    unsigned long collections;      /* 标记-清除的次数 */
+    unsigned long freed;            /* 累计释放的值数，包括语句结束时释放的新值 */
+    std::vector<bscp_heap_cell*> worklist;  /* 晋升和标记时待访问的值，代替递归 */
+
+    bscp_heap(): cells(nullptr), count(0), promoted_bytes(0), live_bytes(0), threshold(BSCP_GC_MIN_THRESHOLD),
+                 collections(0), freed(0) {}
+};
+
+/* 解释器状态，在多次语法分析之间保留 */
+class bscp_context
+{
+public:
+    bscp_obj* global;               /* 全局对象，标识符在其中查找 */
+    struct lex_context* lexer;      /* 词法分析器，使用视图模式 */
+    struct lex_atom_table* atoms;   /* 标识符的原子表，原子ID用作字段名 */
+    bscp_shape* shapes;             /* 形状树的根，新对象都从这里开始 */
+    class bscp_program* program;    /* 正在编译的程序 */
+    class bscp_program_cache* programs; /* 编译过的程序，见bscp_eval */
+    std::vector<bscp_val> stack;    /* 虚拟机的操作数栈 */
+    FILE* out;                      /* 回显输出，默认为stdout */
+    FILE* diagnostics;              /* 错误输出，默认为stderr */
+    lex_atom_t length_atom;         /* 数组的length成员 */
+    bool echo;                      /* 是否输出每条语句的值 */
+    bool line_start;                /* 上一个词法单元是否结束了一条语句 */
+    unsigned long errors;           /* 已报告的错误数 */
+    struct lex_allocator* allocator;    /* 对象、数组、原子表和词法单元的分配器，NULL表示默认分配器 */
+    bscp_heap heap;                 /* 对象和数组 */
+
+    /* allocator要比解释器活得更久 */
+    explicit bscp_context(struct lex_allocator* allocator = nullptr);
+    ~bscp_context();
+    bscp_context(const bscp_context&) = delete;
+    bscp_context& operator=(const bscp_context&) = delete;
+};
+
+/*
+ * 从解释器的分配器创建对象
+ * @param site 分配位置，通常为LEX_ALLOC_SITE
+ * @return 新对象，内存不足时抛出std::bad_alloc
+ */
+template<typename T, typename... Args>
+T* bscp_new(bscp_context* ctx, const char* site, Args&&... args){
+    void* memory = lex_alloc(ctx->allocator, sizeof(T), site);
+    if(memory == nullptr){
+        throw std::bad_alloc();
+    }
+    try{
+        return new (memory) T(std::forward<Args>(args)...);
+    }catch(...){
+        lex_dealloc(ctx->allocator, memory, sizeof(T), site);
+        throw;
+    }
+}
+
+/* 析构并释放bscp_new创建的对象 */
+template<typename T>
+void bscp_delete(bscp_context* ctx, T* object, const char* site){
+    if(object != nullptr){
+        object->~T();
+        lex_dealloc(ctx->allocator, object, sizeof(T), site);
+    }
+}
+
+/* 值引用的堆上的值，立即数返回NULL */
+static inline bscp_heap_cell* bscp_val_cell(bscp_val value){
+    switch(value.tag){
+        case bscp_tag_obj:      return value.as.obj;
+        case bscp_tag_array:    return value.as.array;
+        default:                return nullptr;
+    }
+}
+
+/*
+ * 创建对象或数组并交给回收器管理，新值在当前语句结束时如果没有晋升就被释放
+ * @return 新值，内存不足时抛出std::bad_alloc
+ */
+template<typename T, typename... Args>
+T* bscp_heap_new(bscp_context* ctx, const char* site, Args&&... args){
+    T* cell = bscp_new<T>(ctx, site, std::forward<Args>(args)...);
+    cell->gc_young = true;
+    cell->gc_next = ctx->heap.cells;
+    ctx->heap.cells = cell;
+    ctx->heap.count++;
+    return cell;
+}
+
+/* 把新值和它能访问到的所有新值晋升，它们被更早的值引用，语句结束后仍然存活 */
+void bscp_gc_promote(bscp_context* ctx, bscp_heap_cell* cell);
+
+/*
+ * 写屏障，把value写入container之后调用
+ * 只有更早的值引用了新值时才需要晋升，新值之间的引用在语句结束时一起处理
+ */
+static inline void bscp_gc_write(bscp_context* ctx, const bscp_heap_cell* container, bscp_val value){
+    bscp_heap_cell* cell = bscp_val_cell(value);
+    if(cell != nullptr && cell->gc_young && !container->gc_young){
+        bscp_gc_promote(ctx, cell);
+    }
+}
+
+/*
+ * 结束一条语句：释放region之后创建、没有晋升的新值，晋升的字节数足够多时再做一次标记-清除
+ * 此时操作数栈已经不再使用，根只有全局对象
+ * @param region 语句开始时的heap.cells
+ */
+void bscp_gc_end_statement(bscp_context* ctx, bscp_heap_cell* region);
+
+/* 以全局对象为根做一次标记-清除，只能在语句之间调用 */
+void bscp_gc_collect(bscp_context* ctx);
+
+/* 释放所有对象和数组，不论是否可达，用于销毁解释器 */
+void bscp_gc_release(bscp_context* ctx);
+
+#endif /* __BSCP_RUNTIME_H__ */
@@ -0,0 +1,284 @@
+#include "bscp_vm.h"
+
+#include <string.h>
+
+/* 指令执行前后栈深度的变化 */
+static int bscp_stack_effect(const bscp_insn& insn){
+    switch(insn.op){
+        case bscp_opcode::push_const:
+        case bscp_opcode::push_str:
+        case bscp_opcode::new_obj:
+        case bscp_opcode::load_global:
+        case bscp_opcode::get_member_keep:
+        case bscp_opcode::get_index_keep:
+            return 1;
+        case bscp_opcode::new_array:
+            return 1 - (int)insn.a;
+        case bscp_opcode::store_global:
+        case bscp_opcode::get_member:
+        case bscp_opcode::unary:
+            return 0;
+        case bscp_opcode::set_member:
+        case bscp_opcode::get_index:
+        case bscp_opcode::binary:
+        case bscp_opcode::logic_and:
+        case bscp_opcode::logic_or:
+        case bscp_opcode::pop:
+        case bscp_opcode::nip:
+            return -1;
+        case bscp_opcode::set_index:
+        case bscp_opcode::select:
+            return -2;
+    }
+    return 0;
+}
+
+bscp_expr bscp_program::emit_const(bscp_val value){
+    bscp_expr expr;
+    expr.start = here();
+    expr.count = 0;
+    expr.constant = true;
+    constants.push_back(value);
+    emit(bscp_opcode::push_const, (uint32_t)constants.size() - 1);
+    return expr;
+}
+
+void bscp_program::end_statement(){
+    int depth = 0;
+    for(uint32_t i = stmt_start; i < here(); i++){
+        depth += bscp_stack_effect(code[i]);
+        if(depth > (int)max_stack){
+            max_stack = (uint32_t)depth;
+        }
+    }
+    statements.push_back({stmt_start, here()});
+    stmt_start = here();
+}
+
+bscp_program* bscp_program_cache::find(const char* source, size_t length){
+    // 查找时构造一次键；命中时省去的词法和语法分析远比这次复制昂贵
+    auto it = programs.find(std::string(source, length));
+    if(it == programs.end()){
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    return it->second.get();
+}
+
+bscp_program* bscp_program_cache::insert(std::unique_ptr<bscp_program> program){
+    if(programs.size() >= BSCP_PROGRAM_CACHE_MAX){
+        programs.clear();
+    }
+    std::string key = program->source;
+    auto& slot = programs[std::move(key)];
+    slot = std::move(program);
+    return slot.get();
+}
+
+/* 读取字段，数组只有length成员 */
+static inline const char* bscp_get_member(bscp_context* ctx, bscp_val target, lex_atom_t atom,
+                                          bscp_inline_cache* cache, bscp_val* out){
+    if(target.is_obj()){
+        *out = target.as.obj->get(bscp_key_atom(atom), cache);
+        return NULL;
+    }
+    if(target.is_array()){
+        if(atom != ctx->length_atom){
+            static thread_local char message[128];
+            snprintf(message, sizeof(message), "Arrays have no field '%s'", lex_atom_text(ctx->atoms, atom));
+            return message;
+        }
+        *out = bscp_val::integer((int64_t)target.as.array->size());
+        return NULL;
+    }
+    return "Left operand of '.' must be an object";
+}
+
+/* 检查下标：必须是非负整数，值为整数的浮点数也可以；NaN、无穷和小数都不截断而是报错 */
+static inline const char* bscp_check_index(bscp_val target, bscp_val index, uint64_t* out){
+    if(!target.is_obj() && !target.is_array()){
+        return "Left operand of '[]' must be an object or array";
+    }
+    int64_t i;
+    if(!index.is_num() || !index.to_int(&i) || i < 0 || (index.is_double() && (double)i != index.as.d)){
+        return "Index must be a non-negative integer";
+    }
+    *out = (uint64_t)i;
+    return NULL;
+}
+
+static inline bscp_val bscp_get_index(bscp_val target, uint64_t index){
+    if(target.is_array()){
+        return target.as.array->get(index);
+    }
+    // 对象的下标各不相同，不使用内联缓存
+    return target.as.obj->get(bscp_key_index(index));
+}
+
+/*
+ * 执行一条语句
+ * @param result 语句的值
+ * @return NULL表示成功，否则为错误信息
+ */
+static const char* bscp_execute_statement(bscp_context* ctx, const bscp_program* program,
+                                          const bscp_stmt& stmt, bscp_val* result){
+    bscp_val* stack = ctx->stack.data();
+    bscp_val* sp = stack;       // 指向栈顶之上的第一个空位
+    bscp_obj* global = ctx->global;
+    const bscp_insn* code = program->code.data();
+    bscp_inline_cache* caches = const_cast<bscp_inline_cache*>(program->caches.data());
+    const char* error;
+
+    for(uint32_t pc = stmt.start; pc < stmt.end; pc++){
+        const bscp_insn& insn = code[pc];
+        switch(insn.op){
+            case bscp_opcode::push_const:
+                *sp++ = program->constants[insn.a];
+                break;
+            case bscp_opcode::push_str: {
+                const std::string& str = program->strings[insn.a];
+                *sp++ = bscp_val::of(bscp_heap_new<bscp_array>(ctx, LEX_ALLOC_SITE, str.data(), str.size()));
+                break;
+            }
+            case bscp_opcode::new_obj:
+                *sp++ = bscp_val::object(bscp_heap_new<bscp_obj>(ctx, LEX_ALLOC_SITE, ctx->shapes, ctx->allocator));
+                break;
+            case bscp_opcode::new_array: {
+                bscp_array* array = bscp_heap_new<bscp_array>(ctx, LEX_ALLOC_SITE, bscp_array_values);
+                sp -= insn.a;
+                array->values.assign(sp, sp + insn.a);
+                *sp++ = bscp_val::of(array);
+                break;
+            }
+            case bscp_opcode::load_global:
+                *sp++ = global->at(insn.a);
+                break;
+            case bscp_opcode::store_global:
+                global->at(insn.a) = sp[-1];
+                bscp_gc_write(ctx, global, sp[-1]);
+                break;
+            case bscp_opcode::get_member:
+                if((error = bscp_get_member(ctx, sp[-1], insn.a, &caches[insn.b], &sp[-1]))) return error;
+                break;
+            case bscp_opcode::get_member_keep:
+                if((error = bscp_get_member(ctx, sp[-1], insn.a, &caches[insn.b], &sp[0]))) return error;
+                sp++;
+                break;
+            case bscp_opcode::set_member:
+                if(!sp[-2].is_obj()) return "Left operand of '.' must be an object";
+                sp[-2].as.obj->set(bscp_key_atom(insn.a), sp[-1], &caches[insn.b]);
+                bscp_gc_write(ctx, sp[-2].as.obj, sp[-1]);
+                sp[-2] = sp[-1];
+                sp--;
+                break;
+            case bscp_opcode::get_index: {
+                uint64_t index;
+                if((error = bscp_check_index(sp[-2], sp[-1], &index))) return error;
+                sp[-2] = bscp_get_index(sp[-2], index);
+                sp--;
+                break;
+            }
+            case bscp_opcode::get_index_keep: {
+                uint64_t index;
+                if((error = bscp_check_index(sp[-2], sp[-1], &index))) return error;
+                sp[0] = bscp_get_index(sp[-2], index);
+                sp++;
+                break;
+            }
+            case bscp_opcode::set_index: {
+                uint64_t index;
+                if((error = bscp_check_index(sp[-3], sp[-2], &index))) return error;
+                if(sp[-3].is_array()){
+                    if((error = sp[-3].as.array->set(index, sp[-1]))) return error;
+                }else{
+                    sp[-3].as.obj->set(bscp_key_index(index), sp[-1]);
+                }
+                bscp_gc_write(ctx, bscp_val_cell(sp[-3]), sp[-1]);
+                sp[-3] = sp[-1];
+                sp -= 2;
+                break;
+            }
+            case bscp_opcode::binary:
+                if((error = bscp_binary(ctx, (bscp_op)insn.a, sp[-2], sp[-1], &sp[-2]))) return error;
+                sp--;
+                break;
+            case bscp_opcode::unary:
+                if((error = bscp_unary((bscp_unop)insn.a, sp[-1], &sp[-1]))) return error;
+                break;
+            case bscp_opcode::logic_and:
+                sp[-2] = bscp_val::integer(sp[-2].truthy() && sp[-1].truthy());
+                sp--;
+                break;
+            case bscp_opcode::logic_or:
+                sp[-2] = bscp_val::integer(sp[-2].truthy() || sp[-1].truthy());
+                sp--;
+                break;
+            case bscp_opcode::select:
+                sp[-3] = sp[-3].truthy() ? sp[-2] : sp[-1];
+                sp -= 2;
+                break;
+            case bscp_opcode::pop:
+                sp--;
+                break;
+            case bscp_opcode::nip:
+                sp[-2] = sp[-1];
+                sp--;
+                break;
+        }
+    }
+    *result = sp > stack ? sp[-1] : bscp_val::null();
+    return NULL;
+}
+
+int bscp_execute(bscp_context* ctx, const bscp_program* program){
+    if(ctx->stack.size() < program->max_stack){
+        ctx->stack.resize(program->max_stack);
+    }
+    int result = program->errors != 0;
+    for(const bscp_stmt& stmt : program->statements){
+        // 这条语句创建的值都在region之前，语句结束时一起处理
+        bscp_heap_cell* region = ctx->heap.cells;
+        bscp_val value;
+        const char* error;
+        try{
+            error = bscp_execute_statement(ctx, program, stmt, &value);
+        }catch(const std::bad_alloc&){
+            // 分配器设置了上限时，超出上限只让这条语句失败
+            error = "Out of memory";
+        }
+        if(error){
+            fprintf(ctx->diagnostics, "Error: %s\n", error);
+            ctx->errors++;
+            result = 1;
+        }else if(ctx->echo){
+            bscp_print(ctx->out, ctx, value);
+            fputc('\n', ctx->out);
+        }
+        bscp_gc_end_statement(ctx, region);
+    }
+    return result;
+}
+
+int bscp_eval(bscp_context* ctx, const char* source, size_t length){
+    bscp_program* program = ctx->programs->find(source, length);
+    if(program == nullptr){
+        // 源代码本来就要复制一份作为缓存的键，直接在这份副本上做词法分析，省去词法分析器的复制
+        std::unique_ptr<bscp_program> compiled(new bscp_program());
+        compiled->source.reserve(length + LEX_BUFFER_PADDING);
+        compiled->source.assign(source, length);
+        compiled->source.append(LEX_BUFFER_PADDING, '\0');
+        if(!lex_init_with_buffer_r(ctx->lexer, &compiled->source[0], length)){
+            return 1;
+        }
+        bscp_compile(ctx, compiled.get());
+        lex_cleanup_r(ctx->lexer);
+        compiled->source.resize(length);
+        // 有语法错误的程序不缓存，下次重新编译时再次报告错误
+        if(compiled->errors != 0){
+            return bscp_execute(ctx, compiled.get());
+        }
+        program = ctx->programs->insert(std::move(compiled));
+    }
+    return bscp_execute(ctx, program);
+}
@@ -0,0 +1,151 @@
+#ifndef __BSCP_VM_H__
+#define __BSCP_VM_H__
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bscp_runtime.h"
+
+#define BSCP_PROGRAM_CACHE_MAX 1024     /* 缓存的程序数上限，超过后清空重来 */
+
+/*
+ * 字节码指令
+ * 栈式虚拟机，语法分析器按后序归约，操作数的代码总是先于运算符生成；
+ * 注释中的"栈"给出执行前后栈顶的变化
+ */
+enum class bscp_opcode : uint8_t {
+    push_const,     // -> constants[a]
+    push_str,       // -> 新的字节串，内容为strings[a]
+    new_obj,        // -> 新的空对象
+    new_array,      // v1..va -> 新的数组[v1..va]
+    load_global,    // -> 全局对象的第a个槽位
+    store_global,   // v -> v，写入全局对象的第a个槽位
+    get_member,     // obj -> obj的a字段，b为内联缓存
+    get_member_keep,// obj -> obj, obj的a字段，用于复合赋值
+    set_member,     // obj, v -> v，写入obj的a字段
+    get_index,      // x, i -> x[i]
+    get_index_keep, // x, i -> x, i, x[i]，用于复合赋值
+    set_index,      // x, i, v -> v，写入x[i]
+    binary,         // x, y -> x op y，a为bscp_op
+    unary,          // x -> op x，a为bscp_unop
+    logic_and,      // x, y -> x && y
+    logic_or,       // x, y -> x || y
+    select,         // c, x, y -> c ? x : y
+    pop,            // v ->
+    nip,            // x, y -> y
+};
+
+/* 指令，a和b的含义由操作码决定 */
+struct bscp_insn {
+    bscp_opcode op;
+    uint32_t a;
+    uint32_t b;
+};
+
+/*
+ * 表达式编译结果，作为语法分析器的语义值
+ * 表达式的代码是从start开始直到当前末尾的连续指令
+ */
+struct bscp_expr {
+    uint32_t start;     /* 第一条指令的下标 */
+    uint32_t count;     /* 数组常量的元素个数，其它表达式不使用 */
+    bool constant;      /* 代码只有一条push_const，值在编译时已知 */
+};
+
+/* 一条语句的指令范围，执行后栈上恰好留下语句的值 */
+struct bscp_stmt {
+    uint32_t start;
+    uint32_t end;
+};
+
+/*
+ * 编译后的程序
+ * 标识符在编译时解析为全局对象的槽位，只能在编译它的解释器状态中执行
+ */
+class bscp_program
+{
+public:
+    std::string source;                     /* 源代码，作为缓存的键 */
+    std::vector<bscp_insn> code;
+    std::vector<bscp_val> constants;        /* 只含数值等立即数 */
+    std::vector<std::string> strings;       /* 字符串常量，每次执行都创建新的字节串 */
+    std::vector<bscp_inline_cache> caches;  /* 每个字段访问指令一个内联缓存 */
+    std::vector<bscp_stmt> statements;
+    uint32_t stmt_start;                    /* 正在编译的语句的第一条指令 */
+    uint32_t max_stack;                     /* 执行时需要的栈深度 */
+    unsigned long errors;                   /* 编译错误数 */
+
+    bscp_program(): stmt_start(0), max_stack(0), errors(0) {}
+
+    /* 追加一条指令，返回其下标 */
+    uint32_t emit(bscp_opcode op, uint32_t a = 0, uint32_t b = 0) {
+        code.push_back({op, a, b});
+        return (uint32_t)code.size() - 1;
+    }
+
+    /* 当前末尾的下标，即下一条指令的下标 */
+    uint32_t here() const { return (uint32_t)code.size(); }
+
+    /* 生成push_const，返回对应的表达式 */
+    bscp_expr emit_const(bscp_val value);
+
+    /* 分配一个内联缓存 */
+    uint32_t new_cache() {
+        caches.emplace_back();
+        return (uint32_t)caches.size() - 1;
+    }
+
+    /* 常量表达式的值 */
+    bscp_val constant(const bscp_expr& expr) const { return constants[code[expr.start].a]; }
+
+    /* 结束一条语句，计算其栈深度 */
+    void end_statement();
+
+    /* 丢弃出错语句已经生成的指令 */
+    void discard_statement() { code.resize(stmt_start); }
+};
+
+/* 程序缓存，以源代码文本为键 */
+class bscp_program_cache
+{
+public:
+    unsigned long hits;
+    unsigned long misses;
+
+    bscp_program_cache(): hits(0), misses(0) {}
+
+    /* 查找源代码对应的程序，未命中时返回NULL */
+    bscp_program* find(const char* source, size_t length);
+    /* 加入程序，所有权交给缓存 */
+    bscp_program* insert(std::unique_ptr<bscp_program> program);
+
+private:
+    std::unordered_map<std::string, std::unique_ptr<bscp_program>> programs;
+};
+
+/*
+ * 编译词法分析器上下文中的输入
+ * @param ctx 解释器状态，ctx->lexer须已初始化
+ * @param program 编译目标，出错的语句不包含在内，program->errors给出错误数
+ */
+extern void bscp_compile(bscp_context* ctx, bscp_program* program);
+
+/*
+ * 执行程序，运行时出错的语句报告错误后继续执行下一条
+ * @return 0表示成功，1表示有语句出错
+ */
+extern int bscp_execute(bscp_context* ctx, const bscp_program* program);
+
+/*
+ * 执行一段源代码，同样的文本只编译一次，之后直接执行缓存的字节码
+ * @param ctx 解释器状态
+ * @param source 源代码
+ * @param length 源代码长度
+ * @return 0表示成功，1表示有语句出错
+ */
+extern int bscp_eval(bscp_context* ctx, const char* source, size_t length);
+
+#endif /* __BSCP_VM_H__ */
@@ -0,0 +1,381 @@
+#include "basm_gen.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define BASM_GEN_LINE_WIDTH 64      /* 每行的大致长度 */
+
+static const char* const basm_gen_item_names[BASM_GEN_ITEM_COUNT] = {
+    "ident", "number", "string", "comment", "punct", "block",
+};
+
+static const char* const basm_gen_puncts[] = {
+    "+", "-", "*", "/", "%", "++", "--", "=", "+=", "-=", "<<=", ">>=", "==", "!=", "<", ">=",
+    "&&", "||", "!", "&", "|", "^", "~", "<<", ">>", "->", ".", ",", ";", ":", "?", "(", ")",
+    "[", "]", "#",
+};
+
+static const char* const basm_gen_escapes[] = {
+    "\\n", "\\t", "\\\\", "\\\"", "\\x7f", "\\u00e9", "\\101", "\\0",
+};
+
+/* xorshift64*，序列只由种子决定 */
+class BasmRandom {
+    public:
+        explicit BasmRandom(uint64_t seed): state(seed ? seed : 0x9E3779B97F4A7C15ULL) {}
+
+        uint64_t next(){
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            return state * 0x2545F4914F6CDD1DULL;
+        }
+        /* [0, n)中的整数，n不大时取模的偏差可以忽略 */
+        uint32_t below(uint32_t n){ return (uint32_t)((next() >> 32) % n); }
+        bool chance(uint32_t percent){ return below(100) < percent; }
+    private:
+        uint64_t state;
+};
+
+class BasmGenerator {
+    public:
+        BasmGenerator(const struct basm_gen_options* options)
+            :options(options), random(options->seed), total(0)
+        {
+            for(unsigned w : options->weights){
+                total += w;
+            }
+        }
+
+        std::string run(){
+            out.reserve(options->size + 4096);
+            while(out.size() < options->size){
+                if(options->parseable){
+                    parseable_line();
+                }else{
+                    line(0, true);
+                }
+            }
+            return std::move(out);
+        }
+
+    private:
+        const struct basm_gen_options* options;
+        BasmRandom random;
+        unsigned total;
+        std::string out;
+
+        void indent(unsigned depth){
+            out.append(depth * 4, ' ');
+        }
+
+        /* 按权重选择元素 */
+        enum basm_gen_item pick(bool allow_block){
+            if(total == 0){
+                return basm_gen_ident;
+            }
+            for(;;){
+                uint32_t r = random.below(total);
+                for(int i = 0; i < BASM_GEN_ITEM_COUNT; i++){
+                    if(r < options->weights[i]){
+                        if(i == basm_gen_block && !allow_block){
+                            break;
+                        }
+                        return (enum basm_gen_item)i;
+                    }
+                    r -= options->weights[i];
+                }
+                if(options->weights[basm_gen_block] == total){
+                    return basm_gen_ident;
+                }
+            }
+        }
+
+        void ident(){
+            static const char first[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+            static const char rest[] = "abcdefghijklmnopqrstuvwxyz_0123456789";
+            uint32_t length = 1 + random.below(12);
+            out += first[random.below(sizeof(first) - 1)];
+            for(uint32_t i = 1; i < length; i++){
+                out += rest[random.below(sizeof(rest) - 1)];
+            }
+        }
+
+        void digits(const char* alphabet, uint32_t base, uint32_t count){
+            for(uint32_t i = 0; i < count; i++){
+                out += alphabet[random.below(base)];
+            }
+        }
+
+        /* 各种进制的数字，写法与lex.lex中的规则一一对应 */
+        void number(){
+            static const char hex[] = "0123456789abcdefABCDEF";
+            char buffer[32];
+            switch(random.below(7)){
+                case 0:
+                    snprintf(buffer, sizeof(buffer), "%u", (unsigned)random.below(100000));
+                    out += buffer;
+                    break;
+                case 1:
+                    snprintf(buffer, sizeof(buffer), "%u.", (unsigned)random.below(1000));
+                    out += buffer;
+                    digits(hex, 10, 1 + random.below(6));
+                    if(random.chance(30)){
+                        out += random.chance(50) ? "e-" : "E";
+                        digits(hex, 10, 1 + random.below(2));
+                    }
+                    break;
+                case 2:
+                    digits(hex, 10, 1 + random.below(3));
+                    out += random.chance(50) ? "e+" : "e";
+                    digits(hex, 10, 1 + random.below(2));
+                    break;
+                case 3:
+                    out += random.chance(50) ? "0x" : "0X";
+                    digits(hex, 22, 1 + random.below(16));
+                    break;
+                case 4:
+                    out += '0';
+                    out += (char)('1' + random.below(7));
+                    digits(hex, 8, random.below(8));
+                    break;
+                case 5:
+                    out += random.chance(50) ? "0b" : "0B";
+                    digits(hex, 2, 1 + random.below(32));
+                    break;
+                default:
+                    out += '\'';
+                    if(random.chance(30)){
+                        out += basm_gen_escapes[random.below(3)];
+                    }else{
+                        out += (char)('a' + random.below(26));
+                    }
+                    out += '\'';
+                    break;
+            }
+        }
+
+        void string(){
+            if(random.chance(10)){
+                // <路径>的规则不接受下划线
+                static const char path[] = "abcdefghijklmnopqrstuvwxyz0123456789/";
+                out += '<';
+                out += (char)('a' + random.below(26));
+                digits(path, sizeof(path) - 1, random.below(16));
+                out += ".h>";
+                return;
+            }
+            out += '"';
+            uint32_t length = random.below(24);
+            for(uint32_t i = 0; i < length; i++){
+                if(random.chance(10)){
+                    out += basm_gen_escapes[random.below(sizeof(basm_gen_escapes) / sizeof(basm_gen_escapes[0]))];
+                }else{
+                    out += (char)(' ' + random.below(95));
+                    if(out.back() == '"' || out.back() == '\\'){
+                        out.back() = '_';
+                    }
+                }
+            }
+            out += '"';
+        }
+
+        /*
+         * 注释的内容不含'*'，块注释中不会提前出现结束符
+         * @param multiline 是否可以生成单行注释和跨行的块注释
+         * @return true表示生成的是单行注释，本行不能再有其它内容
+         */
+        bool comment(bool multiline){
+            static const char text[] = "abcdefghij klmnopqrst uvwxyz 0123456789 +-/=(){};,.";
+            bool block = !multiline || random.chance(50);
+            out += block ? "/*" : "//";
+            uint32_t length = random.below(40);
+            for(uint32_t i = 0; i < length; i++){
+                out += text[random.below(sizeof(text) - 1)];
+                if(block && multiline && random.chance(2)){
+                    out += '\n';
+                }
+            }
+            if(block){
+                out += "*/";
+            }
+            return !block;
+        }
+
+        void punct(){
+            out += basm_gen_puncts[random.below(sizeof(basm_gen_puncts) / sizeof(basm_gen_puncts[0]))];
+        }
+
+        /* 一行元素，以换行结束；块从这一行开始，到另一行的'}'结束 */
+        void line(unsigned depth, bool allow_block){
+            size_t start = out.size();
+            indent(depth);
+            while(out.size() - start < BASM_GEN_LINE_WIDTH){
+                enum basm_gen_item item = pick(allow_block && depth < options->max_depth);
+                if(out.size() > start + depth * 4){
+                    out += ' ';
+                }
+                if(item == basm_gen_comment){
+                    // 单行注释吃掉行的其余部分
+                    if(comment(true)){
+                        break;
+                    }
+                    continue;
+                }
+                if(item == basm_gen_block){
+                    ident();
+                    out += ' ';
+                    block(depth, 1 + random.below(options->max_depth - depth));
+                    break;
+                }
+                switch(item){
+                    case basm_gen_ident:    ident(); break;
+                    case basm_gen_number:   number(); break;
+                    case basm_gen_string:   string(); break;
+                    default:                punct(); break;
+                }
+            }
+            out += '\n';
+        }
+
+        /* 嵌套levels层的块，每层一行内容，最内层之外每层再包含下一层 */
+        void block(unsigned depth, unsigned levels){
+            out += "{\n";
+            line(depth + 1, false);
+            if(levels > 1){
+                indent(depth + 1);
+                ident();
+                out += ' ';
+                block(depth + 1, levels - 1);
+                out += '\n';
+            }
+            if(random.chance(50)){
+                line(depth + 1, false);
+            }
+            indent(depth);
+            out += '}';
+        }
+
+        /* 语法分析器接受的函数定义，函数体内只有数字和字符串常量 */
+        void parseable_line(){
+            unsigned constants = options->weights[basm_gen_number] + options->weights[basm_gen_string];
+            ident();
+            out += " {";
+            uint32_t count = random.below(12);
+            for(uint32_t i = 0; i < count && constants > 0; i++){
+                out += ' ';
+                if(random.below(constants) < options->weights[basm_gen_number]){
+                    number();
+                }else{
+                    string();
+                }
+                if(options->weights[basm_gen_comment] && random.below(total) < options->weights[basm_gen_comment]){
+                    out += ' ';
+                    comment(false);
+                }
+            }
+            out += " }";
+            if(options->weights[basm_gen_comment] && random.below(total) < options->weights[basm_gen_comment]){
+                out += ' ';
+                comment(true);
+            }
+            out += '\n';
+        }
+};
+
+void basm_gen_defaults(struct basm_gen_options* options){
+    options->size = 1 << 20;
+    options->seed = 1;
+    options->weights[basm_gen_ident] = 5;
+    options->weights[basm_gen_number] = 4;
+    options->weights[basm_gen_string] = 2;
+    options->weights[basm_gen_comment] = 1;
+    options->weights[basm_gen_punct] = 4;
+    options->weights[basm_gen_block] = 1;
+    options->max_depth = 16;
+    options->parseable = false;
+}
+
+bool basm_gen_parse_mix(struct basm_gen_options* options, const char* mix){
+    while(*mix){
+        const char* end = strchr(mix, ',');
+        size_t length = end ? (size_t)(end - mix) : strlen(mix);
+        const char* equals = (const char*)memchr(mix, '=', length);
+        if(equals == nullptr){
+            return false;
+        }
+        int item = -1;
+        for(int i = 0; i < BASM_GEN_ITEM_COUNT; i++){
+            if(strlen(basm_gen_item_names[i]) == (size_t)(equals - mix)
+               && memcmp(basm_gen_item_names[i], mix, equals - mix) == 0){
+                item = i;
+            }
+        }
+        char* number_end;
+        unsigned long weight = strtoul(equals + 1, &number_end, 10);
+        if(item < 0 || number_end != mix + length || number_end == equals + 1){
+            return false;
+        }
+        options->weights[item] = (unsigned)weight;
+        mix += length;
+        if(*mix == ','){
+            mix++;
+        }
+    }
+    return true;
+}
+
+std::string basm_generate(const struct basm_gen_options* options){
+    BasmGenerator generator(options);
+    return generator.run();
+}
+
+#define BSCP_GEN_VARIABLES 16   /* 脚本使用的全局变量数 */
+#define BSCP_GEN_FIELDS 8       /* 对象的字段数和数组的长度 */
+
+std::string bscp_generate(size_t statements, uint64_t seed){
+    BasmRandom random(seed);
+    std::string out;
+    char line[128];
+
+    for(int i = 0; i < BSCP_GEN_VARIABLES; i++){
+        snprintf(line, sizeof(line), "v%d = %d\n", i, i + 1);
+        out += line;
+    }
+    out += "o = {}\n";
+    for(int i = 0; i < BSCP_GEN_FIELDS; i++){
+        snprintf(line, sizeof(line), "o.f%d = %d\n", i, i);
+        out += line;
+    }
+    out += "a = [0, 1, 2, 3, 4, 5, 6, 7]\n";
+
+    // 每条语句的结果都限制在较小的整数范围内，执行任意多遍也不会溢出或除以零
+    for(size_t n = 0; n < statements; n++){
+        unsigned x = random.below(BSCP_GEN_VARIABLES);
+        unsigned y = random.below(BSCP_GEN_VARIABLES);
+        unsigned f = random.below(BSCP_GEN_FIELDS);
+        unsigned c = 1 + random.below(1000);
+        switch(random.below(6)){
+            case 0:
+                snprintf(line, sizeof(line), "v%u = (v%u * %u + v%u) %% 1000003\n", x, y, c, x);
+                break;
+            case 1:
+                snprintf(line, sizeof(line), "o.f%u = (v%u + o.f%u) & 0xffff\n", f, x, random.below(BSCP_GEN_FIELDS));
+                break;
+            case 2:
+                snprintf(line, sizeof(line), "v%u = ((o.f%u << 3) ^ v%u) & 0xffff\n", x, f, y);
+                break;
+            case 3:
+                snprintf(line, sizeof(line), "v%u = v%u > %u ? v%u - %u : v%u + %u\n", x, y, c, y, c, y, c);
+                break;
+            case 4:
+                snprintf(line, sizeof(line), "a[%u] = v%u %% 256\n", f, x);
+                break;
+            default:
+                snprintf(line, sizeof(line), "v%u = a[%u] + a.length + (v%u != 0 && v%u < 0x10000)\n", x, f, y, x);
+                break;
+        }
+        out += line;
+    }
+    return out;
+}
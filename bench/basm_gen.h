@@ -0,0 +1,53 @@
+#ifndef __BASM_GEN_H__
+#define __BASM_GEN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/*
+ * 合成Basm源代码生成器
+ * 输出只由种子和选项决定，不依赖标准库的随机数实现，同样的参数在任何平台上生成同样的文本，
+ * 基准测试的结果因此可以在不同机器和不同版本之间比较
+ */
+
+/* 组成源代码的元素，权重决定各元素出现的比例 */
+enum basm_gen_item {
+    basm_gen_ident,     // 标识符
+    basm_gen_number,    // 数字：十进制、浮点、科学计数、十六进制、八进制、二进制和字符常量
+    basm_gen_string,    // 字符串常量和<路径>
+    basm_gen_comment,   // 单行注释和可能跨行的块注释
+    basm_gen_punct,     // 运算符和标点符号
+    basm_gen_block,     // 嵌套的{}块
+    BASM_GEN_ITEM_COUNT
+};
+
+struct basm_gen_options {
+    size_t size;                                /* 目标字节数，输出在超过后的第一个行尾结束 */
+    uint64_t seed;                              /* 随机数种子 */
+    unsigned weights[BASM_GEN_ITEM_COUNT];      /* 各元素的权重 */
+    unsigned max_depth;                         /* {}块的最大嵌套深度 */
+    bool parseable;                             /* 只生成语法分析器接受的"名字 { 常量... }"，不使用嵌套块和标点 */
+};
+
+/* 填入默认选项：1 MiB，默认权重，最大嵌套深度16 */
+void basm_gen_defaults(struct basm_gen_options* options);
+
+/*
+ * 解析元素权重，格式如"ident=4,number=3,block=1"，未出现的元素保持原值
+ * @return true表示成功，false表示格式错误或未知的元素名
+ */
+bool basm_gen_parse_mix(struct basm_gen_options* options, const char* mix);
+
+/* 生成Basm源代码 */
+std::string basm_generate(const struct basm_gen_options* options);
+
+/*
+ * 生成bscp脚本，每行一条语句，只使用数值运算、对象字段和数组下标，
+ * 开头几行创建脚本用到的变量、对象和数组
+ * @param statements 语句数（不含开头的初始化语句）
+ * @param seed 随机数种子
+ */
+std::string bscp_generate(size_t statements, uint64_t seed);
+
+#endif /* __BASM_GEN_H__ */
@@ -0,0 +1,353 @@
+/*
+ * 基准测试：词法分析器每秒的词法单元数、语法分析器每秒的节点数、bscp每秒执行的语句数
+ * 输入默认由basm_gen按固定种子生成，结果以JSON输出到标准输出，键的顺序和数字格式固定，
+ * 便于脚本比较不同版本或不同引擎的结果
+ */
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "lex.h"
+#include "parser.h"
+#include "bscp_vm.h"
+#include "basm_gen.h"
+
+// 命令行选项
+struct Options {
+    struct basm_gen_options gen;
+    size_t statements = 100000;     // bscp脚本的语句数
+    unsigned repeat = 5;            // 每项测试计时的次数，取最快的一次
+    std::string input;              // 改用这个文件作为词法和语法分析的输入
+    std::string filter;             // 只运行名称包含这个字符串的测试
+    bool text = false;              // 输出便于阅读的表格而不是JSON
+};
+
+// 一项测试的结果
+struct Result {
+    std::string name;
+    const char* unit;
+    size_t bytes = 0;               // 输入字节数
+    size_t units = 0;               // 每次运行处理的单位数
+    std::vector<double> seconds;    // 每次运行的耗时
+
+    double best() const { return *std::min_element(seconds.begin(), seconds.end()); }
+    double median() const {
+        std::vector<double> sorted = seconds;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[sorted.size() / 2];
+    }
+};
+
+/* 源代码及其后的填充字节，可以不经复制交给词法分析器 */
+struct Source {
+    std::string data;
+    size_t size = 0;
+
+    explicit Source(std::string text) : data(std::move(text)), size(data.size()) {
+        data.append(LEX_BUFFER_PADDING, '\0');
+    }
+    char* buffer() { return &data[0]; }
+};
+
+/**
+ * 运行一项测试：先不计时运行一次预热，再计时运行options.repeat次
+ * @param run 执行一次测试，返回处理的单位数，0表示出错
+ * @return true表示成功
+ */
+static bool measure(const Options& options, Result& result, const std::function<size_t()>& run) {
+    result.units = run();
+    if (result.units == 0) {
+        return false;
+    }
+    for (unsigned i = 0; i < options.repeat; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        size_t units = run();
+        auto end = std::chrono::steady_clock::now();
+        if (units != result.units) {
+            return false;
+        }
+        result.seconds.push_back(std::chrono::duration<double>(end - start).count());
+    }
+    return true;
+}
+
+static size_t lexTokens(struct lex_context* lexer, Source& source) {
+    if (!lex_init_with_buffer_r(lexer, source.buffer(), source.size)) {
+        return 0;
+    }
+    struct lex_token tokens[LEX_TOKEN_BATCH_SIZE];
+    size_t count = 0;
+    size_t n;
+    do {
+        n = lex_next_batch_r(lexer, tokens, LEX_TOKEN_BATCH_SIZE);
+        count += n;
+    } while (n == LEX_TOKEN_BATCH_SIZE);
+    lex_cleanup_r(lexer);
+    return count;
+}
+
+static size_t countNodes(const AstNode* root) {
+    size_t count = 0;
+    for (const AstNode* node : AstPreorder(root)) {
+        (void)node;
+        count++;
+    }
+    return count;
+}
+
+static size_t parseNodes(struct parse_context* parser, Source& source) {
+    if (parse_init_with_buffer_r(parser, source.buffer(), source.size) != 0) {
+        return 0;
+    }
+    size_t count = 0;
+    if (parse_r(parser) == 0 && parse_get_root_r(parser)) {
+        count = countNodes(parse_get_root_r(parser));
+    }
+    parse_cleanup_r(parser);
+    return count;
+}
+
+static const char* engineName(enum lex_engine engine) {
+    return engine == lex_engine_simd ? "simd" : "flex";
+}
+
+static bool selected(const Options& options, const std::string& name) {
+    return options.filter.empty() || name.find(options.filter) != std::string::npos;
+}
+
+/**
+ * 运行全部测试
+ * @return true表示全部成功
+ */
+static bool runBenchmarks(const Options& options, std::vector<Result>& results) {
+    bool ok = true;
+    const enum lex_engine engines[] = { lex_engine_flex, lex_engine_simd };
+
+    // 词法分析使用包含全部元素的输入；语法分析器只接受函数定义，单独生成一份
+    std::string text;
+    std::string parseable;
+    if (!options.input.empty()) {
+        struct lex_source_file file;
+        if (!lex_source_open(&file, options.input.c_str())) {
+            fprintf(stderr, "无法打开文件: %s\n", options.input.c_str());
+            return false;
+        }
+        text.assign(file.data, file.size);
+        parseable = text;
+        lex_source_close(&file);
+    } else {
+        struct basm_gen_options gen = options.gen;
+        text = basm_generate(&gen);
+        gen.parseable = true;
+        parseable = basm_generate(&gen);
+    }
+    Source lexSource(text);
+    Source parseSource(parseable);
+
+    for (enum lex_engine engine : engines) {
+        Result result;
+        result.name = std::string("lex.") + engineName(engine);
+        result.unit = "tokens";
+        result.bytes = lexSource.size;
+        if (!selected(options, result.name)) {
+            continue;
+        }
+        struct lex_context* lexer = lex_create();
+        if (!lexer) {
+            return false;
+        }
+        lex_set_token_mode_r(lexer, lex_mode_view);
+        lex_set_engine_r(lexer, engine);
+        if (measure(options, result, [&]() { return lexTokens(lexer, lexSource); })) {
+            results.push_back(result);
+        } else {
+            fprintf(stderr, "%s失败\n", result.name.c_str());
+            ok = false;
+        }
+        lex_destroy(lexer);
+    }
+
+    // 单个文件的并行词法分析，线程数与CPU核数相同
+    if (selected(options, "lex.parallel")) {
+        Result result;
+        result.name = "lex.parallel";
+        result.unit = "tokens";
+        result.bytes = lexSource.size;
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        bool measured = measure(options, result, [&]() -> size_t {
+            struct lex_parallel_result tokens;
+            if (!lex_parallel_scan(lexSource.buffer(), lexSource.size, threads, &tokens)) {
+                return 0;
+            }
+            size_t count = tokens.count;
+            lex_parallel_free(&tokens);
+            return count;
+        });
+        if (measured) {
+            results.push_back(result);
+        } else {
+            fprintf(stderr, "%s失败\n", result.name.c_str());
+            ok = false;
+        }
+    }
+
+    for (enum lex_engine engine : engines) {
+        Result result;
+        result.name = std::string("parse.") + engineName(engine);
+        result.unit = "nodes";
+        result.bytes = parseSource.size;
+        if (!selected(options, result.name)) {
+            continue;
+        }
+        struct parse_context* parser = parse_create();
+        if (!parser) {
+            return false;
+        }
+        parse_set_engine_r(parser, engine);
+        if (measure(options, result, [&]() { return parseNodes(parser, parseSource); })) {
+            results.push_back(result);
+        } else {
+            fprintf(stderr, "%s失败\n", result.name.c_str());
+            ok = false;
+        }
+        parse_destroy(parser);
+    }
+
+    // bscp：编译整个脚本，以及执行已缓存的字节码
+    Source script(bscp_generate(options.statements, options.gen.seed));
+    if (selected(options, "bscp.compile")) {
+        Result result;
+        result.name = "bscp.compile";
+        result.unit = "statements";
+        result.bytes = script.size;
+        bscp_context ctx;
+        bool measured = ctx.lexer && ctx.atoms && measure(options, result, [&]() -> size_t {
+            if (!lex_init_with_buffer_r(ctx.lexer, script.buffer(), script.size)) {
+                return 0;
+            }
+            bscp_program program;
+            bscp_compile(&ctx, &program);
+            lex_cleanup_r(ctx.lexer);
+            return program.errors ? 0 : program.statements.size();
+        });
+        if (measured) {
+            results.push_back(result);
+        } else {
+            fprintf(stderr, "%s失败\n", result.name.c_str());
+            ok = false;
+        }
+    }
+    if (selected(options, "bscp.eval")) {
+        Result result;
+        result.name = "bscp.eval";
+        result.unit = "statements";
+        result.bytes = script.size;
+        bscp_context ctx;
+        // 每行一条语句；预热的一次编译并缓存脚本，计时的各次只执行字节码
+        size_t statements = (size_t)std::count(script.data.begin(), script.data.begin() + script.size, '\n');
+        bool measured = ctx.lexer && ctx.atoms && measure(options, result, [&]() -> size_t {
+            return bscp_eval(&ctx, script.buffer(), script.size) == 0 ? statements : 0;
+        });
+        if (measured) {
+            results.push_back(result);
+        } else {
+            fprintf(stderr, "%s失败\n", result.name.c_str());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+static void printJson(const Options& options, const std::vector<Result>& results) {
+    printf("{\n");
+    printf("  \"suite\": \"basm-bench\",\n");
+    printf("  \"version\": 1,\n");
+    printf("  \"seed\": %llu,\n", (unsigned long long)options.gen.seed);
+    printf("  \"repeat\": %u,\n", options.repeat);
+    printf("  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        printf("    {\"name\": \"%s\", \"unit\": \"%s\", \"bytes\": %zu, \"units\": %zu, "
+               "\"best_seconds\": %.6f, \"median_seconds\": %.6f, "
+               "\"units_per_second\": %.0f, \"bytes_per_second\": %.0f}%s\n",
+               r.name.c_str(), r.unit, r.bytes, r.units, r.best(), r.median(),
+               r.units / r.best(), r.bytes / r.best(), i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+}
+
+static void printText(const std::vector<Result>& results) {
+    printf("%-14s %12s %-10s %10s %10s %14s %10s\n",
+           "测试", "单位数", "单位", "最快(s)", "中位(s)", "单位/秒", "MB/秒");
+    for (const Result& r : results) {
+        printf("%-14s %12zu %-10s %10.4f %10.4f %14.0f %10.1f\n",
+               r.name.c_str(), r.units, r.unit, r.best(), r.median(),
+               r.units / r.best(), r.bytes / r.best() / 1e6);
+    }
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+        "用法: %s [选项]\n"
+        "  --size=BYTES         生成的Basm源代码字节数，默认4194304\n"
+        "  --seed=N             随机数种子，默认1\n"
+        "  --mix=SPEC           元素权重，格式见basm-gen\n"
+        "  --depth=N            {}块的最大嵌套深度，默认16\n"
+        "  --statements=N       bscp脚本的语句数，默认100000\n"
+        "  --repeat=N           每项测试计时的次数，默认5\n"
+        "  --input=FILE         用这个文件代替生成的源代码做词法和语法分析\n"
+        "  --filter=NAME        只运行名称包含NAME的测试\n"
+        "  --text               输出表格而不是JSON\n",
+        program);
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    basm_gen_defaults(&options.gen);
+    options.gen.size = 4 << 20;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--size=", 0) == 0) {
+            options.gen.size = strtoull(arg.c_str() + 7, nullptr, 10);
+        } else if (arg.rfind("--seed=", 0) == 0) {
+            options.gen.seed = strtoull(arg.c_str() + 7, nullptr, 10);
+        } else if (arg.rfind("--mix=", 0) == 0) {
+            if (!basm_gen_parse_mix(&options.gen, arg.c_str() + 6)) {
+                fprintf(stderr, "无效的元素权重: %s\n", arg.c_str() + 6);
+                return 1;
+            }
+        } else if (arg.rfind("--depth=", 0) == 0) {
+            options.gen.max_depth = (unsigned)strtoul(arg.c_str() + 8, nullptr, 10);
+        } else if (arg.rfind("--statements=", 0) == 0) {
+            options.statements = strtoull(arg.c_str() + 13, nullptr, 10);
+        } else if (arg.rfind("--repeat=", 0) == 0) {
+            options.repeat = std::max(1ul, strtoul(arg.c_str() + 9, nullptr, 10));
+        } else if (arg.rfind("--input=", 0) == 0) {
+            options.input = arg.substr(8);
+        } else if (arg.rfind("--filter=", 0) == 0) {
+            options.filter = arg.substr(9);
+        } else if (arg == "--text") {
+            options.text = true;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+    bool ok = runBenchmarks(options, results);
+    if (options.text) {
+        printText(results);
+    } else {
+        printJson(options, results);
+    }
+    return ok ? 0 : 1;
+}
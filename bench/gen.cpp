@@ -0,0 +1,56 @@
+/*
+ * basm-gen：生成合成的Basm源代码或bscp脚本，输出到标准输出
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "basm_gen.h"
+
+static void usage(const char* program){
+    fprintf(stderr,
+        "用法: %s [选项]\n"
+        "  --size=BYTES     目标字节数，默认1048576\n"
+        "  --seed=N         随机数种子，默认1\n"
+        "  --mix=SPEC       元素权重，如ident=5,number=4,string=2,comment=1,punct=4,block=1\n"
+        "  --depth=N        {}块的最大嵌套深度，默认16\n"
+        "  --parseable      只生成语法分析器接受的函数定义\n"
+        "  --bscp=N         改为生成N条语句的bscp脚本\n",
+        program);
+}
+
+int main(int argc, char* argv[]){
+    struct basm_gen_options options;
+    basm_gen_defaults(&options);
+    size_t bscpStatements = 0;
+
+    for(int i = 1; i < argc; i++){
+        const char* arg = argv[i];
+        if(strncmp(arg, "--size=", 7) == 0){
+            options.size = strtoull(arg + 7, nullptr, 10);
+        }else if(strncmp(arg, "--seed=", 7) == 0){
+            options.seed = strtoull(arg + 7, nullptr, 10);
+        }else if(strncmp(arg, "--mix=", 6) == 0){
+            if(!basm_gen_parse_mix(&options, arg + 6)){
+                fprintf(stderr, "无效的元素权重: %s\n", arg + 6);
+                return 1;
+            }
+        }else if(strncmp(arg, "--depth=", 8) == 0){
+            options.max_depth = (unsigned)strtoul(arg + 8, nullptr, 10);
+        }else if(strcmp(arg, "--parseable") == 0){
+            options.parseable = true;
+        }else if(strncmp(arg, "--bscp=", 7) == 0){
+            bscpStatements = strtoull(arg + 7, nullptr, 10);
+        }else{
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::string source = bscpStatements ? bscp_generate(bscpStatements, options.seed) : basm_generate(&options);
+    if(fwrite(source.data(), 1, source.size(), stdout) != source.size()){
+        return 1;
+    }
+    return 0;
+}
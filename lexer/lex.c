@@ -1,100 +1,572 @@
 #include "lex.h"
 
+#include <errno.h>
+#include <unistd.h>
+
 /* Flex相关类型定义 */
-struct yy_buffer_state;
 typedef struct yy_buffer_state* YY_BUFFER_STATE;
+typedef void* yyscan_t;
 
-/* Flex生成的函数前向声明 */
-extern int yylex(void);
-extern YY_BUFFER_STATE yy_scan_bytes(const char* bytes, int len);
-extern void yy_switch_to_buffer(YY_BUFFER_STATE buffer);
-extern void yy_delete_buffer(YY_BUFFER_STATE buffer);
-extern char* yytext;
-extern int yyleng;
+/* Flex生成的可重入函数前向声明 */
+extern int yylex_init_extra(struct lex_context* user_defined, yyscan_t* scanner);
+extern int yylex_destroy(yyscan_t scanner);
+extern int yylex(yyscan_t scanner);
+extern YY_BUFFER_STATE yy_scan_bytes(const char* bytes, int len, yyscan_t scanner);
+extern YY_BUFFER_STATE yy_scan_buffer(char* base, size_t size, yyscan_t scanner);
+extern void yy_switch_to_buffer(YY_BUFFER_STATE buffer, yyscan_t scanner);
+extern void yy_delete_buffer(YY_BUFFER_STATE buffer, yyscan_t scanner);
+extern YY_BUFFER_STATE yy_create_buffer(FILE* file, int size, yyscan_t scanner);
+/* lex.lex中定义，把扫描器的开始状态设回INITIAL */
+extern void lex_flex_reset_state(yyscan_t scanner);
 
-/* 全局变量，用于存储当前识别的token */
-struct lex_token current_token = { lex_unknown, 0, NULL };
+/* 默认上下文，供非可重入的公共接口使用 */
+static struct lex_context* default_context = NULL;
 
-/* 用于字符串输入的缓冲区 */
-static YY_BUFFER_STATE string_buffer_state = NULL;
+static struct lex_context* lex_default(void) {
+    if (!default_context) {
+        default_context = lex_create();
+    }
+    return default_context;
+}
 
+/**
+ * 释放上下文的输入缓冲区，扫描器回到初始状态
+ */
+static void lex_release_buffer(struct lex_context* ctx) {
+    if (ctx->buffer) {
+        yy_delete_buffer(ctx->buffer, ctx->scanner);
+        ctx->buffer = NULL;
+    }
+    lex_flex_reset_state(ctx->scanner);
+    ctx->source = NULL;
+    ctx->source_size = 0;
+    ctx->file = NULL;
+    ctx->fd = -1;
+    ctx->position = 0;
+}
 
 /**
- * 使用字符串作为输入初始化词法分析器
- * 
+ * 用上下文选择的引擎识别下一个词法单元，结果存入ctx->current_token
+ * SIMD引擎需要完整的源缓冲区，流式输入时总是使用flex
+ */
+static inline int lex_scan(struct lex_context* ctx) {
+    int ret = (ctx->engine == lex_engine_simd && ctx->source)
+        ? lex_simd_next(ctx)
+        : yylex(ctx->scanner);
+
+    /* 两种引擎共用的驻留：标识符和字符串换成原子ID */
+    struct lex_token* token = &ctx->current_token;
+    token->atom = LEX_ATOM_NONE;
+    if (ret && ctx->atoms && (token->type == lex_word || token->type == lex_string)) {
+        const char* text = lex_token_text_r(ctx, token);
+        if (text) {
+            token->atom = lex_atom_intern(ctx->atoms, text, token->raw_size);
+        }
+    }
+    return ret;
+}
+
+/**
+ * 为流式输入创建固定大小的flex缓冲区
+ * 数据由YY_INPUT通过lex_read_input分块读入，缓冲区只在单个词法单元超过其大小时增长
+ */
+static int lex_init_stream(struct lex_context* ctx) {
+    ctx->buffer = yy_create_buffer(NULL, LEX_STREAM_CHUNK_SIZE, ctx->scanner);
+    if (!ctx->buffer) {
+        return 0;
+    }
+    yy_switch_to_buffer(ctx->buffer, ctx->scanner);
+    return 1;
+}
+
+/**
+ * 创建一个词法分析器上下文
+ *
+ * @return 新的上下文，失败时返回NULL
+ */
+struct lex_context* lex_create(void) {
+    struct lex_context* ctx = (struct lex_context*)calloc(1, sizeof(struct lex_context));
+    if (!ctx) {
+        return NULL;
+    }
+
+    ctx->mode = lex_mode_owning;
+    ctx->fd = -1;
+    ctx->current_token.type = lex_unknown;
+
+    /* 创建以ctx为extra数据的可重入扫描器 */
+    if (yylex_init_extra(ctx, &ctx->scanner) != 0) {
+        free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+/**
+ * 销毁词法分析器上下文并释放其所有资源
+ *
+ * @param ctx 由lex_create创建的上下文
+ */
+void lex_destroy(struct lex_context* ctx) {
+    if (!ctx) {
+        return;
+    }
+    lex_cleanup_r(ctx);
+    yylex_destroy(ctx->scanner);
+    free(ctx);
+}
+
+/**
+ * 使用字符串作为输入初始化词法分析器上下文
+ *
+ * @param ctx 词法分析器上下文
  * @param input 输入字符串
  * @param length 字符串长度，如果为0则使用strlen计算
  * @return 1表示成功，0表示失败
  */
-int lex_init_with_string(const char* input, size_t length) {
+int lex_init_with_string_r(struct lex_context* ctx, const char* input, size_t length) {
     /* 清理可能存在的旧缓冲区 */
-    if (string_buffer_state) {
-        yy_delete_buffer(string_buffer_state);
-        string_buffer_state = NULL;
-    }
-    
+    lex_release_buffer(ctx);
+
     /* 计算长度（如果未指定） */
     if (length == 0 && input) {
         length = strlen(input);
     }
-    
+
     /* 检查输入有效性 */
     if (!input || length == 0) {
         return 0;
     }
-    
+
     /* 创建新的输入缓冲区 */
-    string_buffer_state = yy_scan_bytes(input, (int)length);
-    if (!string_buffer_state) {
+    ctx->buffer = yy_scan_bytes(input, (int)length, ctx->scanner);
+    if (!ctx->buffer) {
         return 0;
     }
-    
+
     /* 设置为当前缓冲区 */
-    yy_switch_to_buffer(string_buffer_state);
-    
+    yy_switch_to_buffer(ctx->buffer, ctx->scanner);
+    ctx->source = input;
+    ctx->source_size = length;
+
     return 1;
 }
 
 /**
- * 获取下一个词法单元
- * 
+ * 直接使用调用者的缓冲区作为输入初始化词法分析器上下文，不复制输入
+ *
+ * @param ctx 词法分析器上下文
+ * @param buffer 输入缓冲区，末尾须有LEX_BUFFER_PADDING个'\0'
+ * @param length 输入长度，不含填充字节
+ * @return 1表示成功，0表示失败
+ */
+int lex_init_with_buffer_r(struct lex_context* ctx, char* buffer, size_t length) {
+    lex_release_buffer(ctx);
+
+    if (!buffer || length == 0) {
+        return 0;
+    }
+
+    /* yy_scan_buffer在原地扫描，长度包含结尾的填充字节 */
+    ctx->buffer = yy_scan_buffer(buffer, length + LEX_BUFFER_PADDING, ctx->scanner);
+    if (!ctx->buffer) {
+        return 0;
+    }
+
+    /* yy_scan_buffer已经切换到新缓冲区 */
+    ctx->source = buffer;
+    ctx->source_size = length;
+
+    return 1;
+}
+
+/**
+ * 使用文件流作为输入初始化词法分析器上下文
+ *
+ * @param ctx 词法分析器上下文
+ * @param file 已打开的文件，由调用者负责关闭
+ * @return 1表示成功，0表示失败
+ */
+int lex_init_with_file_r(struct lex_context* ctx, FILE* file) {
+    lex_release_buffer(ctx);
+    if (!file) {
+        return 0;
+    }
+
+    /* 流式输入没有可供视图模式引用的源缓冲区 */
+    ctx->file = file;
+    return lex_init_stream(ctx);
+}
+
+/**
+ * 使用文件描述符作为输入初始化词法分析器上下文
+ *
+ * @param ctx 词法分析器上下文
+ * @param fd 已打开的文件描述符，由调用者负责关闭
+ * @return 1表示成功，0表示失败
+ */
+int lex_init_with_fd_r(struct lex_context* ctx, int fd) {
+    lex_release_buffer(ctx);
+    if (fd < 0) {
+        return 0;
+    }
+
+    ctx->fd = fd;
+    return lex_init_stream(ctx);
+}
+
+/**
+ * 为flex的YY_INPUT读取下一块流式输入
+ * 跨越块边界的词法单元和注释由flex保留未匹配部分并在下一块读入后继续匹配
+ *
+ * @param ctx 词法分析器上下文
+ * @param buf flex的读取缓冲区
+ * @param max_size 最多读取的字节数
+ * @return 读取的字节数，0表示输入结束或出错
+ */
+size_t lex_read_input(struct lex_context* ctx, char* buf, size_t max_size) {
+    if (max_size > LEX_STREAM_CHUNK_SIZE) {
+        max_size = LEX_STREAM_CHUNK_SIZE;
+    }
+
+    if (ctx->file) {
+        return fread(buf, 1, max_size, ctx->file);
+    }
+
+    if (ctx->fd >= 0) {
+        for (;;) {
+            ssize_t n = read(ctx->fd, buf, max_size);
+            if (n >= 0) {
+                return (size_t)n;
+            }
+            if (errno != EINTR) {
+                return 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * 从上下文获取下一个词法单元
+ *
+ * @param ctx 词法分析器上下文
  * @param buf 用于存储词法单元的缓冲区
  * @return 1表示成功，0表示遇到错误或文件结束
  */
-int lex_next(struct lex_token* buf) {
-    int ret = yylex();
+int lex_next_r(struct lex_context* ctx, struct lex_token* buf) {
+    int ret = lex_scan(ctx);
     if (ret) {
         /* 复制当前token到输出buffer */
-        buf->type = current_token.type;
-        buf->raw_size = current_token.raw_size;
-        
-        if (current_token.raw) {
+        buf->type = ctx->current_token.type;
+        buf->raw_size = ctx->current_token.raw_size;
+        buf->offset = ctx->current_token.offset;
+        buf->atom = ctx->current_token.atom;
+
+        if (ctx->current_token.raw) {
             /* 直接传递raw指针的所有权给调用者，调用者负责释放内存 */
-            buf->raw = current_token.raw;
-            current_token.raw = NULL;
+            buf->raw = ctx->current_token.raw;
+            ctx->current_token.raw = NULL;
         } else {
             buf->raw = NULL;
         }
-        
+
         return 1;
     }
-    
+
     return 0;
 }
 
 /**
- * 词法分析器销毁函数 - 清理所有动态分配的内存
+ * 从上下文批量获取词法单元
+ *
+ * @param ctx 词法分析器上下文
+ * @param tokens 输出数组
+ * @param n 数组容量
+ * @return 获取到的词法单元数
  */
-void lex_cleanup(void) {
-    /* 清理缓冲区 */
-    if (string_buffer_state) {
-        yy_delete_buffer(string_buffer_state);
-        string_buffer_state = NULL;
+size_t lex_next_batch_r(struct lex_context* ctx, struct lex_token* tokens, size_t n) {
+    size_t count = 0;
+    while (count < n && lex_scan(ctx)) {
+        /* 整体复制当前token，raw的所有权随之转移 */
+        tokens[count] = ctx->current_token;
+        ctx->current_token.raw = NULL;
+        if (tokens[count++].type == lex_eof) {
+            break;
+        }
+    }
+    return count;
+}
+
+/**
+ * 从上下文批量获取词法单元，以结构数组形式输出
+ *
+ * @param ctx 词法分析器上下文
+ * @param batch 由lex_batch_init初始化的批次
+ * @return 获取到的词法单元数
+ */
+size_t lex_next_batch_soa_r(struct lex_context* ctx, struct lex_token_batch* batch) {
+    size_t count = 0;
+    while (count < batch->capacity && lex_scan(ctx)) {
+        struct lex_token* token = &ctx->current_token;
+        lex_token_free_r(ctx, token);
+        batch->types[count] = (unsigned char)token->type;
+        batch->offsets[count] = token->offset;
+        batch->sizes[count] = token->raw_size;
+        batch->atoms[count] = token->atom;
+        if (batch->types[count++] == lex_eof) {
+            break;
+        }
+    }
+    batch->count = count;
+    return count;
+}
+
+/**
+ * 设置上下文的词法标记模式
+ *
+ * @param ctx 词法分析器上下文
+ * @param mode lex_mode_owning(默认)或lex_mode_view
+ */
+void lex_set_token_mode_r(struct lex_context* ctx, enum lex_token_mode mode) {
+    ctx->mode = mode;
+}
+
+/**
+ * 设置上下文的词法分析引擎
+ *
+ * @param ctx 词法分析器上下文
+ * @param engine lex_engine_flex(默认)或lex_engine_simd
+ */
+void lex_set_engine_r(struct lex_context* ctx, enum lex_engine engine) {
+    ctx->engine = engine;
+}
+
+/**
+ * 设置上下文使用的原子表
+ *
+ * @param ctx 词法分析器上下文
+ * @param atoms 原子表，NULL表示不做驻留
+ */
+void lex_set_atom_table_r(struct lex_context* ctx, struct lex_atom_table* atoms) {
+    ctx->atoms = atoms;
+}
+
+/**
+ * 设置拥有模式下复制词法单元文本使用的分配器
+ *
+ * @param ctx 词法分析器上下文
+ * @param allocator 分配器，NULL表示默认分配器
+ */
+void lex_set_allocator_r(struct lex_context* ctx, struct lex_allocator* allocator) {
+    lex_token_free_r(ctx, &ctx->current_token);
+    ctx->allocator = allocator;
+}
+
+/**
+ * 释放拥有模式下词法单元复制出的文本
+ *
+ * @param ctx 产生这个词法单元的上下文
+ * @param token 词法单元
+ */
+void lex_token_free_r(struct lex_context* ctx, struct lex_token* token) {
+    if (token->raw) {
+        lex_dealloc(ctx->allocator, token->raw, token->raw_size + 1, LEX_ALLOC_SITE);
+        token->raw = NULL;
     }
-    
+}
+
+/**
+ * 获取上下文中词法单元的文本
+ *
+ * @param ctx 词法分析器上下文
+ * @param token 词法单元
+ * @return 文本起始地址，没有文本时返回NULL
+ */
+const char* lex_token_text_r(const struct lex_context* ctx, const struct lex_token* token) {
+    if (token->raw) {
+        return token->raw;
+    }
+    if (ctx->source && token->raw_size > 0) {
+        return ctx->source + token->offset;
+    }
+    return NULL;
+}
+
+/**
+ * 释放上下文的输入缓冲区和未被取走的词法单元
+ *
+ * @param ctx 词法分析器上下文
+ */
+void lex_cleanup_r(struct lex_context* ctx) {
+    /* 清理缓冲区 */
+    lex_release_buffer(ctx);
+
     /* 清理其他资源 */
-    if (current_token.raw) {
-        free(current_token.raw);
-        current_token.raw = NULL;
+    lex_token_free_r(ctx, &ctx->current_token);
+}
+
+/**
+ * 使用字符串作为输入初始化词法分析器
+ *
+ * @param input 输入字符串
+ * @param length 字符串长度，如果为0则使用strlen计算
+ * @return 1表示成功，0表示失败
+ */
+int lex_init_with_string(const char* input, size_t length) {
+    struct lex_context* ctx = lex_default();
+    return ctx ? lex_init_with_string_r(ctx, input, length) : 0;
+}
+
+/**
+ * 直接使用调用者的缓冲区作为输入初始化词法分析器
+ *
+ * @param buffer 输入缓冲区，末尾须有LEX_BUFFER_PADDING个'\0'
+ * @param length 输入长度，不含填充字节
+ * @return 1表示成功，0表示失败
+ */
+int lex_init_with_buffer(char* buffer, size_t length) {
+    struct lex_context* ctx = lex_default();
+    return ctx ? lex_init_with_buffer_r(ctx, buffer, length) : 0;
+}
+
+/**
+ * 使用文件流作为输入初始化词法分析器
+ *
+ * @param file 已打开的文件，由调用者负责关闭
+ * @return 1表示成功，0表示失败
+ */
+int lex_init_with_file(FILE* file) {
+    struct lex_context* ctx = lex_default();
+    return ctx ? lex_init_with_file_r(ctx, file) : 0;
+}
+
+/**
+ * 使用文件描述符作为输入初始化词法分析器
+ *
+ * @param fd 已打开的文件描述符，由调用者负责关闭
+ * @return 1表示成功，0表示失败
+ */
+int lex_init_with_fd(int fd) {
+    struct lex_context* ctx = lex_default();
+    return ctx ? lex_init_with_fd_r(ctx, fd) : 0;
+}
+
+/**
+ * 获取下一个词法单元
+ *
+ * @param buf 用于存储词法单元的缓冲区
+ * @return 1表示成功，0表示遇到错误或文件结束
+ */
+int lex_next(struct lex_token* buf) {
+    struct lex_context* ctx = lex_default();
+    return ctx ? lex_next_r(ctx, buf) : 0;
+}
+
+/**
+ * 批量获取词法单元
+ *
+ * @param tokens 输出数组
+ * @param n 数组容量
+ * @return 获取到的词法单元数
+ */
+size_t lex_next_batch(struct lex_token* tokens, size_t n) {
+    struct lex_context* ctx = lex_default();
+    return ctx ? lex_next_batch_r(ctx, tokens, n) : 0;
+}
+
+/**
+ * 以结构数组形式批量获取词法单元
+ *
+ * @param batch 由lex_batch_init初始化的批次
+ * @return 获取到的词法单元数
+ */
+size_t lex_next_batch_soa(struct lex_token_batch* batch) {
+    struct lex_context* ctx = lex_default();
+    return ctx ? lex_next_batch_soa_r(ctx, batch) : 0;
+}
+
+/**
+ * 设置词法标记模式
+ *
+ * @param mode lex_mode_owning(默认)或lex_mode_view
+ */
+void lex_set_token_mode(enum lex_token_mode mode) {
+    struct lex_context* ctx = lex_default();
+    if (ctx) {
+        lex_set_token_mode_r(ctx, mode);
     }
 }
+
+/**
+ * 设置词法分析引擎
+ *
+ * @param engine lex_engine_flex(默认)或lex_engine_simd
+ */
+void lex_set_engine(enum lex_engine engine) {
+    struct lex_context* ctx = lex_default();
+    if (ctx) {
+        lex_set_engine_r(ctx, engine);
+    }
+}
+
+/**
+ * 获取词法单元的文本
+ *
+ * @param token 词法单元
+ * @return 文本起始地址，没有文本时返回NULL
+ */
+const char* lex_token_text(const struct lex_token* token) {
+    if (token->raw) {
+        return token->raw;
+    }
+    return default_context ? lex_token_text_r(default_context, token) : NULL;
+}
+
+/**
+ * 词法分析器销毁函数 - 清理所有动态分配的内存
+ */
+void lex_cleanup(void) {
+    lex_destroy(default_context);
+    default_context = NULL;
+}
+
+/**
+ * 为结构数组形式的批次分配空间
+ *
+ * @param batch 批次
+ * @param capacity 容量
+ * @return 1表示成功，0表示失败
+ */
+int lex_batch_init(struct lex_token_batch* batch, size_t capacity) {
+    batch->types = (unsigned char*)malloc(capacity * sizeof(unsigned char));
+    batch->offsets = (size_t*)malloc(capacity * sizeof(size_t));
+    batch->sizes = (size_t*)malloc(capacity * sizeof(size_t));
+    batch->atoms = (lex_atom_t*)malloc(capacity * sizeof(lex_atom_t));
+    batch->capacity = capacity;
+    batch->count = 0;
+    if (!batch->types || !batch->offsets || !batch->sizes || !batch->atoms) {
+        lex_batch_free(batch);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * 释放批次的空间
+ *
+ * @param batch 批次
+ */
+void lex_batch_free(struct lex_token_batch* batch) {
+    free(batch->types);
+    free(batch->offsets);
+    free(batch->sizes);
+    free(batch->atoms);
+    batch->types = NULL;
+    batch->offsets = NULL;
+    batch->sizes = NULL;
+    batch->atoms = NULL;
+    batch->capacity = 0;
+    batch->count = 0;
+}
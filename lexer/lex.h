@@ -6,17 +6,32 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-extern FILE* yyin;
 extern int yyparse();
 
 /* 公共常量定义 */
 #define LEX_TOKEN_STREAM_BUFSIZE BUFSIZ
 #define INITIAL_BUFFER_SIZE 64
 #define BUFFER_GROWTH_FACTOR 2
+#define LEX_BUFFER_PADDING 2    /* yy_scan_buffer要求缓冲区末尾的'\0'字节数 */
+#define LEX_STREAM_CHUNK_SIZE (64 * 1024)   /* 流式输入每次读取的字节数，同时也是flex缓冲区大小 */
+#define LEX_TOKEN_BATCH_SIZE 256                /* 批量获取词法单元时建议的批次大小 */
+#define LEX_PARALLEL_MIN_CHUNK (1024 * 1024)    /* 并行词法分析时每块的最小字节数 */
+#define LEX_RING_DEFAULT_CAPACITY 4096          /* 流水线环形缓冲区默认容纳的词法单元数 */
+#define LEX_ARENA_BLOCK_SIZE (64 * 1024)        /* 内存区分配器默认每块的大小 */
+#define LEX_POOL_GRANULE 16                     /* 池分配器的规格间隔 */
+#define LEX_POOL_MAX_SIZE 256                   /* 池分配器缓存的最大规格，更大的直接交给malloc */
+#define LEX_POOL_MAX_CACHED 4096                /* 每个线程每种规格最多缓存的空闲块数 */
+#define LEX_ALLOC_MAX_SITES 64                  /* 计数分配器区分的分配位置数，超出的归入最后一项 */
+
+/* 分配位置，形如"lex.c:120"，计数分配器据此按位置统计 */
+#define LEX_ALLOC_STRINGIFY_(x) #x
+#define LEX_ALLOC_STRINGIFY(x) LEX_ALLOC_STRINGIFY_(x)
+#define LEX_ALLOC_SITE (__FILE__ ":" LEX_ALLOC_STRINGIFY(__LINE__))
 
 /* 词法标记类型枚举 */
 enum lex_token_type {
@@ -29,19 +44,373 @@ enum lex_token_type {
     lex_assembly,   // assmebly block
     lex_unknown,    // unknown token
 };
+#define LEX_TOKEN_TYPE_COUNT (lex_unknown + 1)
+
+/* 词法标记文本的保存方式 */
+enum lex_token_mode {
+    lex_mode_owning,    // raw为堆上复制的字符串，所有权交给调用者
+    lex_mode_view,      // raw为NULL，仅以offset/raw_size引用源缓冲区，不做任何分配
+};
+
+/* 词法分析引擎 */
+enum lex_engine {
+    lex_engine_flex,    // flex生成的扫描器，支持所有输入方式
+    lex_engine_simd,    // 手写的SIMD扫描器，只用于内存中的完整输入，流式输入时退回flex
+};
+
+/* 原子ID，同样的文本在同一个原子表中总是对应同样的ID */
+typedef uint32_t lex_atom_t;
+#define LEX_ATOM_NONE 0     /* 没有原子：未设置原子表，或不是标识符和字符串 */
 
 /* 词法标记结构 */
 struct lex_token {
     enum lex_token_type type;
     size_t raw_size;
     char* raw;
+    size_t offset;      // 词法单元在源缓冲区中的字节偏移
+    lex_atom_t atom;    // 标识符和字符串的原子ID，见lex_set_atom_table_r
+};
+
+/* 
+ * 结构数组(SoA)形式的词法单元批次
+ * 类型、偏移和长度分别连续存放，便于在紧凑的循环中扫描词法单元类型；
+ * 不保存文本，应配合视图模式使用
+ */
+struct lex_token_batch {
+    unsigned char* types;   // enum lex_token_type
+    size_t* offsets;        // 在源缓冲区中的字节偏移
+    size_t* sizes;          // 词法单元长度
+    lex_atom_t* atoms;      // 原子ID
+    size_t capacity;        // 各数组的容量
+    size_t count;           // 本批次中有效的词法单元数
+};
+
+/* 
+ * 源文件缓冲区
+ * 普通文件通过mmap映射，管道等无法映射的输入读入堆内存；
+ * 两种情况下data之后都有LEX_BUFFER_PADDING个'\0'，可以不经复制直接交给词法分析器
+ */
+struct lex_source_file {
+    char* data;         // 文件内容
+    size_t size;        // 文件长度，不含填充字节
+    size_t map_size;    // 映射或分配的总长度
+    int mapped;         // 1表示data来自mmap，0表示来自malloc
+};
+
+/* 
+ * 换行索引
+ * 词法单元只记录字节偏移，行号和列号在需要时才由偏移换算：
+ * 第一次查询时用SIMD扫描一遍源缓冲区记下所有换行符的位置，之后每次查询只做二分查找
+ */
+struct lex_line_index {
+    const char* source;     // 源缓冲区，不归索引所有
+    size_t size;            // 源缓冲区长度
+    size_t* newlines;       // 各换行符的字节偏移，升序
+    size_t count;           // 换行符数
+    size_t capacity;        // newlines的容量，重设输入时保留
+    int built;              // 1表示已经扫描过当前的源缓冲区
+};
+
+/* 源代码中的位置，行号和列号都从1开始，列号按UTF-8字符计算 */
+struct lex_position {
+    size_t line;
+    size_t column;
+};
+
+/* 
+ * 并行词法分析的结果
+ * 词法单元与快速引擎串行扫描的结果逐个相同，都是视图模式：raw为NULL，atom为LEX_ATOM_NONE
+ */
+struct lex_parallel_result {
+    struct lex_token* tokens;   // 全部词法单元，以lex_eof结尾
+    size_t count;               // 词法单元数
+    unsigned chunks;            // 实际切分的块数
+    unsigned repaired;          // 块首不是词法单元边界、拼接时重新扫描过的块数
+};
+
+/* 
+ * 词法单元环形缓冲区
+ * 单生产者单消费者：词法分析线程写入，语法分析线程读出，两端只通过头尾两个原子下标同步，不加锁。
+ * 一端等待另一端时先自旋，再让出CPU
+ */
+struct lex_token_ring;
+
+/* 
+ * 内存分配器
+ * 词法分析器、原子表、语法树内存池和bscp解释器都通过它分配内存，每个实例可以各自设置；
+ * 释放时给出分配时的大小，site是LEX_ALLOC_SITE给出的分配位置，只用于统计。
+ * 实现可以把本结构作为第一个成员，在回调中把self转换回自己的类型
+ */
+struct lex_allocator {
+    void* (*allocate)(struct lex_allocator* self, size_t size, const char* site);      // 失败返回NULL
+    void (*deallocate)(struct lex_allocator* self, void* ptr, size_t size, const char* site);
+};
+
+/* 
+ * 内存区分配器：从块中顺序分配，单独的释放只回收最近一次分配，
+ * lex_arena_allocator_release一次回收全部内存；limit限制从上级分配器申请的总字节数
+ */
+struct lex_arena_allocator {
+    struct lex_allocator base;
+    struct lex_allocator* parent;       // 内存块的来源，NULL表示默认分配器
+    struct lex_arena_block* blocks;     // 已申请的块，最新的块在链表头部
+    size_t block_size;                  // 每块的大小
+    size_t limit;                       // 申请总字节数的上限，0表示不限
+    size_t used;                        // 已分配出去的字节数
+    size_t reserved;                    // 从上级分配器申请的字节数
+    size_t failures;                    // 因超出上限或内存不足而失败的次数
+};
+
+/* 计数分配器中一个分配位置的统计 */
+struct lex_alloc_site {
+    const char* site;
+    size_t allocations;     // 分配次数
+    size_t deallocations;   // 释放其中内存块的次数
+    size_t bytes;           // 分配的总字节数
+    size_t current;         // 仍在使用的字节数
+};
+
+/* 计数分配器记录的一块仍在使用的内存 */
+struct lex_alloc_live {
+    void* ptr;
+    uint32_t site;          // 在sites中的下标
+};
+
+/* 
+ * 计数分配器：转发给上级分配器，统计次数、字节数和峰值，并按分配位置汇总；
+ * trace不为NULL时逐次输出"+ 地址 大小 位置"和"- 地址 大小 位置"。不是线程安全的
+ */
+struct lex_counting_allocator {
+    struct lex_allocator base;
+    struct lex_allocator* parent;       // 实际分配内存的分配器，NULL表示默认分配器
+    FILE* trace;                        // 逐次跟踪的输出位置，NULL表示不跟踪
+    size_t allocations;                 // 分配次数
+    size_t deallocations;               // 释放次数
+    size_t failures;                    // 失败次数
+    size_t bytes;                       // 分配的总字节数
+    size_t current;                     // 仍在使用的字节数
+    size_t peak;                        // current的峰值
+    struct lex_alloc_site sites[LEX_ALLOC_MAX_SITES];
+    size_t site_count;
+    struct lex_alloc_live* live;        // 仍在使用的内存块到分配位置的哈希表
+    size_t live_count;
+    size_t live_capacity;
+};
+
+/* Flex缓冲区类型前向声明 */
+struct yy_buffer_state;
+
+/* 
+ * 词法分析器上下文
+ * 每个上下文拥有独立的flex可重入扫描器、输入缓冲区和当前词法单元，
+ * 不同上下文可以在不同线程中同时使用
+ */
+struct lex_context {
+    void* scanner;                      // flex可重入扫描器(yyscan_t)
+    struct yy_buffer_state* buffer;     // 当前输入的flex缓冲区
+    const char* source;                 // 调用者提供的源缓冲区，视图模式下offset相对于它
+    size_t source_size;                 // 源缓冲区长度
+    FILE* file;                         // 流式输入的文件流，不使用时为NULL
+    int fd;                             // 流式输入的文件描述符，不使用时为-1
+    size_t position;                    // 已扫描的字节数，由YY_USER_ACTION维护
+    enum lex_token_mode mode;           // 词法标记模式
+    enum lex_engine engine;             // 词法分析引擎
+    struct lex_atom_table* atoms;       // 原子表，为NULL时不做驻留
+    struct lex_allocator* allocator;    // 拥有模式下词法单元文本的分配器，NULL表示默认分配器
+    struct lex_token current_token;     // 当前识别的词法单元
 };
 
-/* 全局变量声明 */
-extern struct lex_token current_token;
 
+/* 可重入接口函数 */
+/**
+ * 创建一个词法分析器上下文
+ *
+ * @return 新的上下文，失败时返回NULL
+ */
+extern struct lex_context* lex_create(void);
+
+/**
+ * 销毁词法分析器上下文并释放其所有资源
+ *
+ * @param ctx 由lex_create创建的上下文
+ */
+extern void lex_destroy(struct lex_context* ctx);
 
-/* 公共接口函数 */
+/**
+ * 使用字符串作为输入初始化词法分析器上下文
+ *
+ * @param ctx 词法分析器上下文
+ * @param input 输入字符串
+ * @param length 字符串长度，如果为0则使用strlen计算
+ * @return 1表示成功，0表示失败
+ */
+extern int lex_init_with_string_r(struct lex_context* ctx, const char* input, size_t length);
+
+/**
+ * 直接使用调用者的缓冲区作为输入初始化词法分析器上下文，不复制输入
+ * buffer[length]起必须有LEX_BUFFER_PADDING个'\0'，且在词法分析期间保持有效和可写，
+ * flex会临时改写当前词法单元之后的一个字节
+ *
+ * @param ctx 词法分析器上下文
+ * @param buffer 输入缓冲区
+ * @param length 输入长度，不含填充字节
+ * @return 1表示成功，0表示失败
+ */
+extern int lex_init_with_buffer_r(struct lex_context* ctx, char* buffer, size_t length);
+
+/**
+ * 使用文件流作为输入初始化词法分析器上下文
+ * 输入按LEX_STREAM_CHUNK_SIZE分块读取，内存占用与输入大小无关；
+ * 没有完整的源缓冲区，视图模式下的词法单元只有offset和raw_size
+ *
+ * @param ctx 词法分析器上下文
+ * @param file 已打开的文件，由调用者负责关闭
+ * @return 1表示成功，0表示失败
+ */
+extern int lex_init_with_file_r(struct lex_context* ctx, FILE* file);
+
+/**
+ * 使用文件描述符作为输入初始化词法分析器上下文，适用于管道等流式输入，参见lex_init_with_file_r
+ *
+ * @param ctx 词法分析器上下文
+ * @param fd 已打开的文件描述符，由调用者负责关闭
+ * @return 1表示成功，0表示失败
+ */
+extern int lex_init_with_fd_r(struct lex_context* ctx, int fd);
+
+/**
+ * 为flex的YY_INPUT读取下一块流式输入，仅供扫描器内部使用
+ *
+ * @param ctx 词法分析器上下文
+ * @param buf flex的读取缓冲区
+ * @param max_size 最多读取的字节数
+ * @return 读取的字节数，0表示输入结束或出错
+ */
+extern size_t lex_read_input(struct lex_context* ctx, char* buf, size_t max_size);
+
+/**
+ * 从上下文获取下一个词法单元
+ *
+ * @param ctx 词法分析器上下文
+ * @param buf 用于存储词法单元的缓冲区
+ * @return 1表示成功，0表示遇到错误或文件结束
+ */
+extern int lex_next_r(struct lex_context* ctx, struct lex_token* buf);
+
+/**
+ * 从上下文批量获取词法单元
+ * 遇到lex_eof时将其放入数组后立即返回；返回值小于n表示输入已经结束或出错
+ * 拥有模式下各词法单元raw的所有权交给调用者
+ *
+ * @param ctx 词法分析器上下文
+ * @param tokens 输出数组
+ * @param n 数组容量
+ * @return 获取到的词法单元数
+ */
+extern size_t lex_next_batch_r(struct lex_context* ctx, struct lex_token* tokens, size_t n);
+
+/**
+ * 从上下文批量获取词法单元，以结构数组形式输出，最多batch->capacity个
+ * 结束条件同lex_next_batch_r；拥有模式下复制出的文本会被立即释放
+ *
+ * @param ctx 词法分析器上下文
+ * @param batch 由lex_batch_init初始化的批次，count被更新为获取到的词法单元数
+ * @return 获取到的词法单元数
+ */
+extern size_t lex_next_batch_soa_r(struct lex_context* ctx, struct lex_token_batch* batch);
+
+/**
+ * 设置上下文的词法标记模式
+ *
+ * @param ctx 词法分析器上下文
+ * @param mode lex_mode_owning(默认)或lex_mode_view
+ */
+extern void lex_set_token_mode_r(struct lex_context* ctx, enum lex_token_mode mode);
+
+/**
+ * 设置上下文的词法分析引擎，应在初始化输入之前调用
+ * 两种引擎产生完全相同的词法单元序列
+ *
+ * @param ctx 词法分析器上下文
+ * @param engine lex_engine_flex(默认)或lex_engine_simd
+ */
+extern void lex_set_engine_r(struct lex_context* ctx, enum lex_engine engine);
+
+/**
+ * 设置上下文使用的原子表，之后识别的标识符和字符串都会驻留到表中，
+ * 词法单元的atom字段给出原子ID；原子表可以在多次输入之间共用，由调用者负责销毁
+ * 流式输入的视图模式没有文本可供驻留，atom总是LEX_ATOM_NONE
+ *
+ * @param ctx 词法分析器上下文
+ * @param atoms 原子表，NULL表示不做驻留
+ */
+extern void lex_set_atom_table_r(struct lex_context* ctx, struct lex_atom_table* atoms);
+
+/**
+ * 设置拥有模式下复制词法单元文本使用的分配器，未被取走的当前词法单元先用原来的分配器释放
+ * 使用非默认分配器时，取走的词法单元应该用lex_token_free_r释放，而不是free
+ *
+ * @param ctx 词法分析器上下文
+ * @param allocator 分配器，NULL表示默认分配器
+ */
+extern void lex_set_allocator_r(struct lex_context* ctx, struct lex_allocator* allocator);
+
+/**
+ * 释放拥有模式下词法单元复制出的文本，raw置为NULL；视图模式的词法单元不受影响
+ *
+ * @param ctx 产生这个词法单元的上下文
+ * @param token 词法单元
+ */
+extern void lex_token_free_r(struct lex_context* ctx, struct lex_token* token);
+
+/**
+ * 从*pos开始用SIMD引擎识别下一个词法单元，供词法分析器内部使用
+ *
+ * @param src 源缓冲区
+ * @param size 源缓冲区长度
+ * @param pos 扫描位置，返回时指向词法单元之后
+ * @param token 输出的词法单元，只设置type、offset和raw_size；到达输入结尾时为lex_eof
+ */
+extern void lex_simd_scan(const char* src, size_t size, size_t* pos, struct lex_token* token);
+
+/**
+ * 用SIMD引擎识别上下文中的下一个词法单元并存入current_token，供词法分析器内部使用
+ *
+ * @param ctx 以内存缓冲区初始化的词法分析器上下文
+ * @return 总是1，与flex一样到达输入结尾后每次都给出lex_eof
+ */
+extern int lex_simd_next(struct lex_context* ctx);
+
+/**
+ * 用SIMD找出源缓冲区中的所有换行符，供换行索引内部使用
+ *
+ * @param src 源缓冲区
+ * @param size 源缓冲区长度
+ * @param offsets 输出换行符的偏移，须能容纳全部换行符；为NULL时只计数
+ * @return 换行符数
+ */
+extern size_t lex_simd_find_newlines(const char* src, size_t size, size_t* offsets);
+
+/**
+ * 获取上下文中词法单元的文本，参见lex_token_text
+ *
+ * @param ctx 词法分析器上下文
+ * @param token 词法单元
+ * @return 文本起始地址，没有文本时返回NULL
+ */
+extern const char* lex_token_text_r(const struct lex_context* ctx, const struct lex_token* token);
+
+/**
+ * 释放上下文的输入缓冲区和未被取走的词法单元，上下文可以再次初始化
+ *
+ * @param ctx 词法分析器上下文
+ */
+extern void lex_cleanup_r(struct lex_context* ctx);
+
+/* 
+ * 公共接口函数
+ * 以下函数操作一个进程内共享的默认上下文，只能在单个线程中使用
+ */
 /**
  * 使用字符串作为输入初始化词法分析器
  * 
@@ -51,6 +420,31 @@ extern struct lex_token current_token;
  */
 extern int lex_init_with_string(const char* input, size_t length);
 
+/**
+ * 直接使用调用者的缓冲区作为输入初始化词法分析器，参见lex_init_with_buffer_r
+ *
+ * @param buffer 输入缓冲区，末尾须有LEX_BUFFER_PADDING个'\0'
+ * @param length 输入长度，不含填充字节
+ * @return 1表示成功，0表示失败
+ */
+extern int lex_init_with_buffer(char* buffer, size_t length);
+
+/**
+ * 使用文件流作为输入初始化词法分析器
+ *
+ * @param file 已打开的文件，由调用者负责关闭
+ * @return 1表示成功，0表示失败
+ */
+extern int lex_init_with_file(FILE* file);
+
+/**
+ * 使用文件描述符作为输入初始化词法分析器
+ *
+ * @param fd 已打开的文件描述符，由调用者负责关闭
+ * @return 1表示成功，0表示失败
+ */
+extern int lex_init_with_fd(int fd);
+
 /**
  * 获取下一个词法单元
  *
@@ -60,11 +454,350 @@ extern int lex_init_with_string(const char* input, size_t length);
 extern int lex_next(struct lex_token* buf);
 
 /**
- * 清理词法分析器使用的所有动态分配内存
+ * 设置词法标记模式
+ * 视图模式下源缓冲区必须在词法分析期间保持有效
+ *
+ * @param mode lex_mode_owning(默认)或lex_mode_view
+ */
+extern void lex_set_token_mode(enum lex_token_mode mode);
+
+/**
+ * 设置词法分析引擎，参见lex_set_engine_r
+ *
+ * @param engine lex_engine_flex(默认)或lex_engine_simd
+ */
+extern void lex_set_engine(enum lex_engine engine);
+
+/**
+ * 获取词法单元的文本
+ * 拥有模式下返回raw；视图模式下返回指向源缓冲区的指针，不以'\0'结尾，长度为raw_size
+ *
+ * @param token 词法单元
+ * @return 文本起始地址，没有文本时返回NULL
+ */
+extern const char* lex_token_text(const struct lex_token* token);
+
+/**
+ * 批量获取词法单元，参见lex_next_batch_r
+ *
+ * @param tokens 输出数组
+ * @param n 数组容量
+ * @return 获取到的词法单元数
+ */
+extern size_t lex_next_batch(struct lex_token* tokens, size_t n);
+
+/**
+ * 以结构数组形式批量获取词法单元，参见lex_next_batch_soa_r
+ *
+ * @param batch 由lex_batch_init初始化的批次
+ * @return 获取到的词法单元数
+ */
+extern size_t lex_next_batch_soa(struct lex_token_batch* batch);
+
+/**
+ * 清理词法分析器使用的所有动态分配内存，包括默认上下文本身
  * 应该在词法分析完成后调用此函数
  */
 extern void lex_cleanup(void);
 
+/* 词法单元批次接口函数 */
+/**
+ * 为结构数组形式的批次分配空间
+ *
+ * @param batch 批次
+ * @param capacity 容量，通常为LEX_TOKEN_BATCH_SIZE
+ * @return 1表示成功，0表示失败
+ */
+extern int lex_batch_init(struct lex_token_batch* batch, size_t capacity);
+
+/**
+ * 释放批次的空间
+ *
+ * @param batch 批次
+ */
+extern void lex_batch_free(struct lex_token_batch* batch);
+
+/* 原子表接口函数，原子表不是线程安全的，每个线程应使用自己的原子表 */
+/**
+ * 创建原子表
+ * @return 原子表，失败返回NULL
+ */
+extern struct lex_atom_table* lex_atom_table_create(void);
+
+/**
+ * 创建使用指定分配器的原子表，表本身、原子数组、哈希表和文本存储块都从它分配
+ * @param allocator 分配器，NULL表示默认分配器
+ * @return 原子表，失败返回NULL
+ */
+extern struct lex_atom_table* lex_atom_table_create_with_allocator(struct lex_allocator* allocator);
+
+/**
+ * 销毁原子表，之前返回的所有文本指针随之失效
+ * @param table 原子表
+ */
+extern void lex_atom_table_destroy(struct lex_atom_table* table);
+
+/**
+ * 清空原子表，之前返回的所有原子ID和文本指针随之失效，之后可以继续使用
+ * @param table 原子表
+ */
+extern void lex_atom_table_clear(struct lex_atom_table* table);
+
+/**
+ * 查找或加入一个原子，同样的文本总是得到同样的ID
+ * @param table 原子表
+ * @param text 文本，不必以'\0'结尾
+ * @param length 文本长度
+ * @return 原子ID，内存不足时返回LEX_ATOM_NONE
+ */
+extern lex_atom_t lex_atom_intern(struct lex_atom_table* table, const char* text, size_t length);
+
+/**
+ * 获取原子的文本，以'\0'结尾，在原子表销毁前一直有效
+ * @param table 原子表
+ * @param atom 原子ID
+ * @return 文本，ID无效时返回NULL
+ */
+extern const char* lex_atom_text(const struct lex_atom_table* table, lex_atom_t atom);
+
+/* 获取原子文本的长度 */
+extern size_t lex_atom_length(const struct lex_atom_table* table, lex_atom_t atom);
+
+/* 获取原子数，不含LEX_ATOM_NONE */
+extern size_t lex_atom_count(const struct lex_atom_table* table);
+
+/* 获取所有原子文本占用的字节数，不含结尾的'\0' */
+extern size_t lex_atom_bytes(const struct lex_atom_table* table);
+
+/* 换行索引接口函数 */
+/**
+ * 初始化一个空的换行索引
+ *
+ * @param index 换行索引
+ */
+extern void lex_line_index_init(struct lex_line_index* index);
+
+/**
+ * 让索引改为对应新的源缓冲区，不做扫描，已分配的空间留给下一次扫描使用
+ *
+ * @param index 换行索引
+ * @param source 源缓冲区，查询期间必须有效；NULL表示没有可用的源缓冲区
+ * @param size 源缓冲区长度
+ */
+extern void lex_line_index_reset(struct lex_line_index* index, const char* source, size_t size);
+
+/**
+ * 扫描源缓冲区建立索引，已经建立时直接返回
+ *
+ * @param index 换行索引
+ * @return 1表示成功，0表示没有源缓冲区或内存不足
+ */
+extern int lex_line_index_build(struct lex_line_index* index);
+
+/**
+ * 把字节偏移换算为行号和列号，索引尚未建立时先建立
+ *
+ * @param index 换行索引
+ * @param offset 字节偏移，超过源缓冲区长度时按末尾计算
+ * @param position 输出的位置
+ * @return 1表示成功，0表示没有源缓冲区或内存不足
+ */
+extern int lex_line_index_lookup(struct lex_line_index* index, size_t offset, struct lex_position* position);
+
+/**
+ * 释放索引的空间
+ *
+ * @param index 换行索引
+ */
+extern void lex_line_index_free(struct lex_line_index* index);
+
+/* 并行词法分析接口函数 */
+/**
+ * 把完整的源缓冲区在换行符之后切成若干块，各块在自己的线程中推测扫描，
+ * 再按顺序拼接；块首落在跨行的注释或字符串中时从真实位置重新扫描，直到与推测结果重合。
+ * 总是使用快速引擎，结果与任一引擎的串行扫描相同
+ *
+ * @param src 源缓冲区
+ * @param size 源缓冲区长度
+ * @param threads 线程数，每块至少LEX_PARALLEL_MIN_CHUNK字节，输入较小时使用的线程更少
+ * @param result 输出结果，用lex_parallel_free释放
+ * @return 1表示成功，0表示内存不足
+ */
+extern int lex_parallel_scan(const char* src, size_t size, unsigned threads, struct lex_parallel_result* result);
+
+/**
+ * 释放并行词法分析的结果
+ *
+ * @param result 由lex_parallel_scan填写的结果
+ */
+extern void lex_parallel_free(struct lex_parallel_result* result);
+
+/* 词法单元环形缓冲区接口函数 */
+/**
+ * 创建环形缓冲区
+ *
+ * @param capacity 容纳的词法单元数，向上取整为2的幂，0表示LEX_RING_DEFAULT_CAPACITY
+ * @param allocator 缓冲区本身的分配器，NULL表示默认分配器
+ * @return 新的环形缓冲区，失败返回NULL
+ */
+extern struct lex_token_ring* lex_ring_create(size_t capacity, struct lex_allocator* allocator);
+
+/**
+ * 销毁环形缓冲区，正在运行的词法分析线程先被停止
+ *
+ * @param ring 环形缓冲区，可以为NULL
+ */
+extern void lex_ring_destroy(struct lex_token_ring* ring);
+
+/**
+ * 启动词法分析线程，把上下文中的词法单元依次写入环形缓冲区，识别出lex_eof后结束
+ * 只支持视图模式下的完整源缓冲区：词法分析线程不分配内存。
+ * 原子表在运行期间从上下文中摘下，驻留改由读出词法单元的线程按原顺序进行，原子ID与串行分析相同
+ *
+ * @param ring 环形缓冲区，其中的内容被清空
+ * @param ctx 已初始化的词法分析器上下文，在lex_ring_stop之前不能在其它地方使用
+ * @return 1表示已启动，0表示输入不满足条件或无法创建线程，调用者应退回串行分析
+ */
+extern int lex_ring_start(struct lex_token_ring* ring, struct lex_context* ctx);
+
+/**
+ * 停止并等待词法分析线程，把原子表还给上下文；未读出的词法单元被丢弃
+ *
+ * @param ring 环形缓冲区，未启动时什么也不做
+ */
+extern void lex_ring_stop(struct lex_token_ring* ring);
+
+/**
+ * 读出词法单元，缓冲区为空时等待词法分析线程写入
+ *
+ * @param ring 环形缓冲区
+ * @param tokens 输出数组
+ * @param n 数组容量
+ * @return 读出的词法单元数，0表示词法分析线程已经结束且缓冲区已空
+ */
+extern size_t lex_ring_pop(struct lex_token_ring* ring, struct lex_token* tokens, size_t n);
+
+/**
+ * 查看尚未读出的第k个词法单元（从0开始）而不读出，需要时等待词法分析线程写入
+ *
+ * @param ring 环形缓冲区
+ * @param k 向前看的距离，必须小于缓冲区容量
+ * @return 词法单元，在下一次lex_ring_pop之前有效；输入在此之前结束时返回NULL
+ */
+extern const struct lex_token* lex_ring_peek(struct lex_token_ring* ring, size_t k);
+
+/* 内存分配器接口函数，allocator为NULL时都表示默认分配器 */
+/**
+ * 获取默认分配器，直接使用malloc和free
+ * @return 进程内共享的默认分配器
+ */
+extern struct lex_allocator* lex_allocator_default(void);
+
+/**
+ * 从分配器分配内存
+ * @param allocator 分配器
+ * @param size 字节数
+ * @param site 分配位置，通常为LEX_ALLOC_SITE
+ * @return 内存，按malloc的要求对齐，失败返回NULL
+ */
+extern void* lex_alloc(struct lex_allocator* allocator, size_t size, const char* site);
+
+/**
+ * 把内存还给分配器，ptr为NULL时什么也不做
+ * @param allocator 分配这块内存的分配器
+ * @param ptr 内存
+ * @param size 分配时的字节数
+ * @param site 释放位置
+ */
+extern void lex_dealloc(struct lex_allocator* allocator, void* ptr, size_t size, const char* site);
+
+/**
+ * 改变内存的大小，默认分配器直接使用realloc，其它分配器分配新内存后复制并释放旧内存
+ * @return 新的内存，失败返回NULL，原来的内存保持不变
+ */
+extern void* lex_realloc(struct lex_allocator* allocator, void* ptr, size_t old_size, size_t new_size, const char* site);
+
+/**
+ * 复制长度为length的文本，结果以'\0'结尾，占用length + 1字节
+ * @return 复制的文本，失败返回NULL
+ */
+extern char* lex_alloc_strndup(struct lex_allocator* allocator, const char* text, size_t length, const char* site);
+
+/**
+ * 初始化内存区分配器
+ * @param arena 内存区分配器，通过&arena->base使用
+ * @param parent 内存块的来源
+ * @param block_size 每块的大小，0表示LEX_ARENA_BLOCK_SIZE
+ * @param limit 从parent申请的总字节数上限，0表示不限
+ */
+extern void lex_arena_allocator_init(struct lex_arena_allocator* arena, struct lex_allocator* parent,
+                                     size_t block_size, size_t limit);
+
+/**
+ * 一次回收内存区分配出去的全部内存，之后可以继续分配
+ * @param arena 内存区分配器
+ */
+extern void lex_arena_allocator_release(struct lex_arena_allocator* arena);
+
+/**
+ * 获取线程局部的池分配器：不超过LEX_POOL_MAX_SIZE的内存按规格缓存在各线程自己的空闲链表中，
+ * 分配和释放都不加锁；一个线程释放的内存会进入这个线程的链表，线程退出时自动还给系统
+ * @return 进程内共享的池分配器
+ */
+extern struct lex_allocator* lex_allocator_pool(void);
+
+/**
+ * 把当前线程缓存的空闲块还给系统，线程退出时会自动调用，长期运行的线程可以在空闲时调用
+ */
+extern void lex_allocator_pool_trim(void);
+
+/**
+ * 初始化计数分配器
+ * @param counting 计数分配器，通过&counting->base使用
+ * @param parent 实际分配内存的分配器
+ * @param trace 逐次跟踪的输出位置，NULL表示不跟踪
+ */
+extern void lex_counting_allocator_init(struct lex_counting_allocator* counting, struct lex_allocator* parent, FILE* trace);
+
+/**
+ * 输出统计，各分配位置按分配的字节数从多到少排列
+ * @param counting 计数分配器
+ * @param out 输出位置
+ */
+extern void lex_counting_allocator_report(const struct lex_counting_allocator* counting, FILE* out);
+
+/**
+ * 释放计数分配器自身的记录，不影响经它分配的内存
+ * @param counting 计数分配器
+ */
+extern void lex_counting_allocator_destroy(struct lex_counting_allocator* counting);
+
+/* 源文件接口函数 */
+/**
+ * 将文件映射到内存，映射为写时复制的私有映射，末尾附带填充字节
+ *
+ * @param src 输出的源文件缓冲区
+ * @param filename 文件名
+ * @return 1表示成功，0表示失败
+ */
+extern int lex_source_open(struct lex_source_file* src, const char* filename);
+
+/**
+ * 从文件流读取全部内容，用于标准输入等无法映射的输入
+ *
+ * @param src 输出的源文件缓冲区
+ * @param file 已打开的文件
+ * @return 1表示成功，0表示失败
+ */
+extern int lex_source_read(struct lex_source_file* src, FILE* file);
+
+/**
+ * 释放源文件缓冲区
+ *
+ * @param src 源文件缓冲区
+ */
+extern void lex_source_close(struct lex_source_file* src);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,434 @@
+#include "lex.h"
+
+#include <pthread.h>
+
+/*
+ * 可替换的内存分配器
+ * 词法分析器、原子表、语法树内存池和bscp的对象都通过struct lex_allocator分配，
+ * 每个实例可以使用不同的分配器；NULL表示默认分配器，直接使用malloc和free。
+ * 释放时总是给出分配时的大小，池和内存区据此不必在每块内存前保存头部
+ */
+
+/* 内存区和池分配的对齐，与malloc相同 */
+#define LEX_ALLOC_ALIGN _Alignof(max_align_t)
+
+static inline size_t lex_align_up(size_t size) {
+    return (size + LEX_ALLOC_ALIGN - 1) & ~(size_t)(LEX_ALLOC_ALIGN - 1);
+}
+
+static void* lex_default_allocate(struct lex_allocator* self, size_t size, const char* site) {
+    (void)self;
+    (void)site;
+    return malloc(size);
+}
+
+static void lex_default_deallocate(struct lex_allocator* self, void* ptr, size_t size, const char* site) {
+    (void)self;
+    (void)size;
+    (void)site;
+    free(ptr);
+}
+
+static struct lex_allocator lex_default_allocator = { lex_default_allocate, lex_default_deallocate };
+
+struct lex_allocator* lex_allocator_default(void) {
+    return &lex_default_allocator;
+}
+
+void* lex_alloc(struct lex_allocator* allocator, size_t size, const char* site) {
+    if (!allocator) {
+        return malloc(size);
+    }
+    return allocator->allocate(allocator, size, site);
+}
+
+void lex_dealloc(struct lex_allocator* allocator, void* ptr, size_t size, const char* site) {
+    if (!ptr) {
+        return;
+    }
+    if (!allocator) {
+        free(ptr);
+        return;
+    }
+    allocator->deallocate(allocator, ptr, size, site);
+}
+
+void* lex_realloc(struct lex_allocator* allocator, void* ptr, size_t old_size, size_t new_size, const char* site) {
+    if (!allocator || allocator == &lex_default_allocator) {
+        return realloc(ptr, new_size);
+    }
+    void* grown = allocator->allocate(allocator, new_size, site);
+    if (!grown) {
+        return NULL;
+    }
+    if (ptr) {
+        memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+        allocator->deallocate(allocator, ptr, old_size, site);
+    }
+    return grown;
+}
+
+char* lex_alloc_strndup(struct lex_allocator* allocator, const char* text, size_t length, const char* site) {
+    char* copy = (char*)lex_alloc(allocator, length + 1, site);
+    if (!copy) {
+        return NULL;
+    }
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+/* ---- 内存区分配器 ---- */
+
+/* 内存区的块，数据区紧跟在对齐后的块头之后 */
+struct lex_arena_block {
+    struct lex_arena_block* next;
+    size_t size;    /* 数据区大小 */
+    size_t used;    /* 已分配的字节数 */
+};
+
+#define LEX_ARENA_HEADER lex_align_up(sizeof(struct lex_arena_block))
+
+static inline char* lex_arena_data(struct lex_arena_block* block) {
+    return (char*)block + LEX_ARENA_HEADER;
+}
+
+static void* lex_arena_allocate(struct lex_allocator* self, size_t size, const char* site) {
+    (void)site;
+    struct lex_arena_allocator* arena = (struct lex_arena_allocator*)self;
+    size = lex_align_up(size ? size : 1);
+    struct lex_arena_block* block = arena->blocks;
+    if (!block || block->size - block->used < size) {
+        size_t data_size = size > arena->block_size ? size : arena->block_size;
+        /* 按块大小申请会超出上限时，退而只申请这一次需要的大小 */
+        if (arena->limit && arena->reserved + LEX_ARENA_HEADER + data_size > arena->limit) {
+            data_size = size;
+        }
+        if (arena->limit && arena->reserved + LEX_ARENA_HEADER + data_size > arena->limit) {
+            arena->failures++;
+            return NULL;
+        }
+        block = (struct lex_arena_block*)lex_alloc(arena->parent, LEX_ARENA_HEADER + data_size, LEX_ALLOC_SITE);
+        if (!block) {
+            arena->failures++;
+            return NULL;
+        }
+        block->size = data_size;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->reserved += LEX_ARENA_HEADER + data_size;
+    }
+    void* ptr = lex_arena_data(block) + block->used;
+    block->used += size;
+    arena->used += size;
+    return ptr;
+}
+
+/* 单独的释放只回收最近一次分配，其它内存等到lex_arena_allocator_release时一起回收 */
+static void lex_arena_deallocate(struct lex_allocator* self, void* ptr, size_t size, const char* site) {
+    (void)site;
+    struct lex_arena_allocator* arena = (struct lex_arena_allocator*)self;
+    struct lex_arena_block* block = arena->blocks;
+    size = lex_align_up(size ? size : 1);
+    if (block && block->used >= size && (char*)ptr == lex_arena_data(block) + block->used - size) {
+        block->used -= size;
+        arena->used -= size;
+    }
+}
+
+void lex_arena_allocator_init(struct lex_arena_allocator* arena, struct lex_allocator* parent,
+                              size_t block_size, size_t limit) {
+    memset(arena, 0, sizeof(*arena));
+    arena->base.allocate = lex_arena_allocate;
+    arena->base.deallocate = lex_arena_deallocate;
+    arena->parent = parent;
+    arena->block_size = block_size ? block_size : LEX_ARENA_BLOCK_SIZE;
+    arena->limit = limit;
+}
+
+void lex_arena_allocator_release(struct lex_arena_allocator* arena) {
+    struct lex_arena_block* block = arena->blocks;
+    while (block) {
+        struct lex_arena_block* next = block->next;
+        lex_dealloc(arena->parent, block, LEX_ARENA_HEADER + block->size, LEX_ALLOC_SITE);
+        block = next;
+    }
+    arena->blocks = NULL;
+    arena->used = 0;
+    arena->reserved = 0;
+}
+
+/* ---- 线程局部的池分配器 ---- */
+
+#define LEX_POOL_CLASS_COUNT (LEX_POOL_MAX_SIZE / LEX_POOL_GRANULE)
+
+/* 空闲的内存块，链表指针就放在块内 */
+struct lex_pool_free {
+    struct lex_pool_free* next;
+};
+
+/* 每个线程各自的空闲链表，分配和释放都不需要加锁 */
+struct lex_pool_cache {
+    struct lex_pool_free* heads[LEX_POOL_CLASS_COUNT];
+    size_t counts[LEX_POOL_CLASS_COUNT];
+    int registered;     /* 已登记线程退出时的清理 */
+};
+
+static _Thread_local struct lex_pool_cache lex_pool_cache;
+
+/*
+ * 线程退出时自动归还缓存的空闲块
+ * 线程第一次向缓存放入空闲块时在线程特定数据中登记，退出时由析构函数调用lex_allocator_pool_trim；
+ * 析构函数在线程局部变量释放之前运行。主线程调用exit时不运行析构函数，进程退出时内存同样被回收
+ */
+static pthread_key_t lex_pool_key;
+static pthread_once_t lex_pool_key_once = PTHREAD_ONCE_INIT;
+static int lex_pool_key_ok;
+
+static void lex_pool_thread_exit(void* value) {
+    (void)value;
+    lex_allocator_pool_trim();
+}
+
+static void lex_pool_key_create(void) {
+    lex_pool_key_ok = pthread_key_create(&lex_pool_key, lex_pool_thread_exit) == 0;
+}
+
+static void lex_pool_register(struct lex_pool_cache* cache) {
+    pthread_once(&lex_pool_key_once, lex_pool_key_create);
+    /* 值只要不是NULL即可，析构函数只对非NULL的值调用 */
+    cache->registered = lex_pool_key_ok && pthread_setspecific(lex_pool_key, cache) == 0;
+}
+
+/* 大小所属的规格，大于LEX_POOL_MAX_SIZE时返回LEX_POOL_CLASS_COUNT */
+static inline size_t lex_pool_class(size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    return size > LEX_POOL_MAX_SIZE ? LEX_POOL_CLASS_COUNT : (size - 1) / LEX_POOL_GRANULE;
+}
+
+static void* lex_pool_allocate(struct lex_allocator* self, size_t size, const char* site) {
+    (void)self;
+    (void)site;
+    size_t k = lex_pool_class(size);
+    if (k == LEX_POOL_CLASS_COUNT) {
+        return malloc(size);
+    }
+    struct lex_pool_cache* cache = &lex_pool_cache;
+    struct lex_pool_free* block = cache->heads[k];
+    if (block) {
+        cache->heads[k] = block->next;
+        cache->counts[k]--;
+        return block;
+    }
+    return malloc((k + 1) * LEX_POOL_GRANULE);
+}
+
+static void lex_pool_deallocate(struct lex_allocator* self, void* ptr, size_t size, const char* site) {
+    (void)self;
+    (void)site;
+    size_t k = lex_pool_class(size);
+    struct lex_pool_cache* cache = &lex_pool_cache;
+    /* 别的线程分配的内存同样放进当前线程的链表，它们都来自malloc */
+    if (k == LEX_POOL_CLASS_COUNT || cache->counts[k] >= LEX_POOL_MAX_CACHED) {
+        free(ptr);
+        return;
+    }
+    if (!cache->registered) {
+        lex_pool_register(cache);
+    }
+    struct lex_pool_free* block = (struct lex_pool_free*)ptr;
+    block->next = cache->heads[k];
+    cache->heads[k] = block;
+    cache->counts[k]++;
+}
+
+static struct lex_allocator lex_pool_allocator = { lex_pool_allocate, lex_pool_deallocate };
+
+struct lex_allocator* lex_allocator_pool(void) {
+    return &lex_pool_allocator;
+}
+
+void lex_allocator_pool_trim(void) {
+    struct lex_pool_cache* cache = &lex_pool_cache;
+    for (size_t k = 0; k < LEX_POOL_CLASS_COUNT; k++) {
+        struct lex_pool_free* block = cache->heads[k];
+        while (block) {
+            struct lex_pool_free* next = block->next;
+            free(block);
+            block = next;
+        }
+        cache->heads[k] = NULL;
+        cache->counts[k] = 0;
+    }
+}
+
+/* ---- 计数分配器 ---- */
+
+/* 找到分配位置的计数，位置太多时归入最后一项 */
+static uint32_t lex_counting_site(struct lex_counting_allocator* counting, const char* site) {
+    if (!site) {
+        site = "(unknown)";
+    }
+    for (size_t i = 0; i < counting->site_count; i++) {
+        if (counting->sites[i].site == site) {
+            return (uint32_t)i;
+        }
+    }
+    if (counting->site_count == LEX_ALLOC_MAX_SITES) {
+        counting->sites[LEX_ALLOC_MAX_SITES - 1].site = "(other)";
+        return LEX_ALLOC_MAX_SITES - 1;
+    }
+    struct lex_alloc_site* entry = &counting->sites[counting->site_count];
+    memset(entry, 0, sizeof(*entry));
+    entry->site = site;
+    return (uint32_t)counting->site_count++;
+}
+
+static inline size_t lex_live_hash(const void* ptr, size_t mask) {
+    return (size_t)(((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ull) & mask;
+}
+
+/* 记下仍在使用的内存块来自哪个位置，表满一半时翻倍；表本身直接用malloc，不计入统计 */
+static void lex_live_insert(struct lex_counting_allocator* counting, void* ptr, uint32_t site) {
+    if ((counting->live_count + 1) * 2 > counting->live_capacity) {
+        size_t capacity = counting->live_capacity ? counting->live_capacity * 2 : 1024;
+        struct lex_alloc_live* live = (struct lex_alloc_live*)calloc(capacity, sizeof(struct lex_alloc_live));
+        if (!live) {
+            /* 只影响按位置统计的使用量，总数照常统计 */
+            return;
+        }
+        for (size_t i = 0; i < counting->live_capacity; i++) {
+            if (counting->live[i].ptr) {
+                size_t j = lex_live_hash(counting->live[i].ptr, capacity - 1);
+                while (live[j].ptr) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                live[j] = counting->live[i];
+            }
+        }
+        free(counting->live);
+        counting->live = live;
+        counting->live_capacity = capacity;
+    }
+    size_t mask = counting->live_capacity - 1;
+    size_t i = lex_live_hash(ptr, mask);
+    while (counting->live[i].ptr) {
+        i = (i + 1) & mask;
+    }
+    counting->live[i].ptr = ptr;
+    counting->live[i].site = site;
+    counting->live_count++;
+}
+
+/* 取出内存块的分配位置，不在表中时返回LEX_ALLOC_MAX_SITES；删除时把后面的条目前移，不留墓碑 */
+static uint32_t lex_live_remove(struct lex_counting_allocator* counting, void* ptr) {
+    if (counting->live_capacity == 0) {
+        return LEX_ALLOC_MAX_SITES;
+    }
+    size_t mask = counting->live_capacity - 1;
+    size_t i = lex_live_hash(ptr, mask);
+    while (counting->live[i].ptr != ptr) {
+        if (!counting->live[i].ptr) {
+            return LEX_ALLOC_MAX_SITES;
+        }
+        i = (i + 1) & mask;
+    }
+    uint32_t site = counting->live[i].site;
+    size_t hole = i;
+    for (size_t j = (i + 1) & mask; counting->live[j].ptr; j = (j + 1) & mask) {
+        size_t home = lex_live_hash(counting->live[j].ptr, mask);
+        /* home不在(hole, j]之间时，条目可以移到空位上 */
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            counting->live[hole] = counting->live[j];
+            hole = j;
+        }
+    }
+    counting->live[hole].ptr = NULL;
+    counting->live_count--;
+    return site;
+}
+
+static void* lex_counting_allocate(struct lex_allocator* self, size_t size, const char* site) {
+    struct lex_counting_allocator* counting = (struct lex_counting_allocator*)self;
+    void* ptr = lex_alloc(counting->parent, size, site);
+    if (!ptr) {
+        counting->failures++;
+        return NULL;
+    }
+    uint32_t index = lex_counting_site(counting, site);
+    struct lex_alloc_site* entry = &counting->sites[index];
+    entry->allocations++;
+    entry->bytes += size;
+    entry->current += size;
+    lex_live_insert(counting, ptr, index);
+    counting->allocations++;
+    counting->bytes += size;
+    counting->current += size;
+    if (counting->current > counting->peak) {
+        counting->peak = counting->current;
+    }
+    if (counting->trace) {
+        fprintf(counting->trace, "+ %p %zu %s\n", ptr, size, site ? site : "(unknown)");
+    }
+    return ptr;
+}
+
+static void lex_counting_deallocate(struct lex_allocator* self, void* ptr, size_t size, const char* site) {
+    struct lex_counting_allocator* counting = (struct lex_counting_allocator*)self;
+    /* 释放计入分配这块内存的位置，而不是释放的位置 */
+    uint32_t index = lex_live_remove(counting, ptr);
+    if (index < LEX_ALLOC_MAX_SITES) {
+        counting->sites[index].deallocations++;
+        counting->sites[index].current -= size;
+    }
+    counting->deallocations++;
+    counting->current -= size;
+    if (counting->trace) {
+        fprintf(counting->trace, "- %p %zu %s\n", ptr, size, site ? site : "(unknown)");
+    }
+    lex_dealloc(counting->parent, ptr, size, site);
+}
+
+void lex_counting_allocator_init(struct lex_counting_allocator* counting, struct lex_allocator* parent, FILE* trace) {
+    memset(counting, 0, sizeof(*counting));
+    counting->base.allocate = lex_counting_allocate;
+    counting->base.deallocate = lex_counting_deallocate;
+    counting->parent = parent;
+    counting->trace = trace;
+}
+
+void lex_counting_allocator_report(const struct lex_counting_allocator* counting, FILE* out) {
+    fprintf(out, "分配：%zu 次，%zu 字节；释放 %zu 次；失败 %zu 次；仍在使用 %zu 字节；峰值 %zu 字节\n",
+            counting->allocations, counting->bytes, counting->deallocations, counting->failures,
+            counting->current, counting->peak);
+    /* 按分配的字节数从多到少列出各位置，位置数很少，选择排序即可 */
+    size_t order[LEX_ALLOC_MAX_SITES];
+    for (size_t i = 0; i < counting->site_count; i++) {
+        order[i] = i;
+    }
+    for (size_t i = 0; i < counting->site_count; i++) {
+        size_t best = i;
+        for (size_t j = i + 1; j < counting->site_count; j++) {
+            if (counting->sites[order[j]].bytes > counting->sites[order[best]].bytes) {
+                best = j;
+            }
+        }
+        size_t swap = order[i];
+        order[i] = order[best];
+        order[best] = swap;
+
+        const struct lex_alloc_site* entry = &counting->sites[order[i]];
+        fprintf(out, "  %s：分配 %zu 次 %zu 字节，释放 %zu 次，仍在使用 %zu 字节\n",
+                entry->site, entry->allocations, entry->bytes, entry->deallocations, entry->current);
+    }
+}
+
+void lex_counting_allocator_destroy(struct lex_counting_allocator* counting) {
+    free(counting->live);
+    counting->live = NULL;
+    counting->live_count = 0;
+    counting->live_capacity = 0;
+}
@@ -0,0 +1,258 @@
+#include "lex.h"
+
+#include <stdint.h>
+
+/* 字符串存储块的大小，超过此长度的字符串单独分配一块 */
+#define LEX_ATOM_BLOCK_SIZE (64 * 1024)
+/* 哈希表的初始槽位数，必须是2的幂 */
+#define LEX_ATOM_INITIAL_SLOTS 1024
+
+/* 原子的文本和长度，下标即原子ID */
+struct lex_atom_entry {
+    const char* text;
+    uint32_t length;
+    uint32_t hash;
+};
+
+/* 字符串存储块，块一旦分配就不再移动，原子文本的指针始终有效 */
+struct lex_atom_block {
+    struct lex_atom_block* next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct lex_atom_table {
+    struct lex_atom_entry* entries;     // 原子数组，下标0保留给LEX_ATOM_NONE
+    size_t count;                       // 原子数，含保留的0号
+    size_t capacity;                    // entries的容量
+    lex_atom_t* slots;                  // 开放定址的哈希表，存放原子ID，0表示空槽
+    size_t slot_count;                  // 槽位数，2的幂
+    struct lex_atom_block* blocks;      // 字符串存储块，最新的块在链表头部
+    size_t bytes;                       // 已保存的文本字节数
+    struct lex_allocator* allocator;    // 表的所有内存都从这里分配，NULL表示默认分配器
+};
+
+/**
+ * 计算文本的哈希值(FNV-1a)
+ */
+static uint32_t lex_atom_hash(const char* text, size_t length) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ (unsigned char)text[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * 把文本复制到存储块中，结尾附加'\0'
+ * @return 复制后的文本，内存不足时返回NULL
+ */
+static const char* lex_atom_store(struct lex_atom_table* table, const char* text, size_t length) {
+    struct lex_atom_block* block = table->blocks;
+    if (!block || block->size - block->used < length + 1) {
+        size_t size = length + 1 > LEX_ATOM_BLOCK_SIZE ? length + 1 : LEX_ATOM_BLOCK_SIZE;
+        block = (struct lex_atom_block*)lex_alloc(table->allocator, sizeof(struct lex_atom_block) + size, LEX_ALLOC_SITE);
+        if (!block) {
+            return NULL;
+        }
+        block->size = size;
+        block->used = 0;
+        block->next = table->blocks;
+        table->blocks = block;
+    }
+    char* copy = block->data + block->used;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    block->used += length + 1;
+    table->bytes += length;
+    return copy;
+}
+
+/**
+ * 槽位数翻倍并重新放入所有原子
+ * @return 1表示成功，0表示内存不足
+ */
+static int lex_atom_grow_slots(struct lex_atom_table* table) {
+    size_t slot_count = table->slot_count * 2;
+    lex_atom_t* slots = (lex_atom_t*)lex_alloc(table->allocator, slot_count * sizeof(lex_atom_t), LEX_ALLOC_SITE);
+    if (!slots) {
+        return 0;
+    }
+    memset(slots, 0, slot_count * sizeof(lex_atom_t));
+    size_t mask = slot_count - 1;
+    for (size_t atom = 1; atom < table->count; atom++) {
+        size_t i = table->entries[atom].hash & mask;
+        while (slots[i] != LEX_ATOM_NONE) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = (lex_atom_t)atom;
+    }
+    lex_dealloc(table->allocator, table->slots, table->slot_count * sizeof(lex_atom_t), LEX_ALLOC_SITE);
+    table->slots = slots;
+    table->slot_count = slot_count;
+    return 1;
+}
+
+/**
+ * 创建原子表
+ * @return 原子表，失败返回NULL
+ */
+struct lex_atom_table* lex_atom_table_create(void) {
+    return lex_atom_table_create_with_allocator(NULL);
+}
+
+/**
+ * 创建使用指定分配器的原子表
+ * @param allocator 分配器，NULL表示默认分配器
+ * @return 原子表，失败返回NULL
+ */
+struct lex_atom_table* lex_atom_table_create_with_allocator(struct lex_allocator* allocator) {
+    struct lex_atom_table* table =
+        (struct lex_atom_table*)lex_alloc(allocator, sizeof(struct lex_atom_table), LEX_ALLOC_SITE);
+    if (!table) {
+        return NULL;
+    }
+    memset(table, 0, sizeof(*table));
+    table->allocator = allocator;
+    table->capacity = LEX_ATOM_INITIAL_SLOTS / 2;
+    table->entries = (struct lex_atom_entry*)lex_alloc(allocator, table->capacity * sizeof(struct lex_atom_entry),
+                                                       LEX_ALLOC_SITE);
+    table->slot_count = LEX_ATOM_INITIAL_SLOTS;
+    table->slots = (lex_atom_t*)lex_alloc(allocator, table->slot_count * sizeof(lex_atom_t), LEX_ALLOC_SITE);
+    if (!table->entries || !table->slots) {
+        lex_atom_table_destroy(table);
+        return NULL;
+    }
+    memset(table->slots, 0, table->slot_count * sizeof(lex_atom_t));
+    /* 0号原子表示没有原子，文本为空串 */
+    table->entries[0].text = "";
+    table->entries[0].length = 0;
+    table->entries[0].hash = 0;
+    table->count = 1;
+    return table;
+}
+
+/**
+ * 销毁原子表，之前返回的所有文本指针随之失效
+ * @param table 原子表
+ */
+void lex_atom_table_destroy(struct lex_atom_table* table) {
+    if (!table) {
+        return;
+    }
+    struct lex_atom_block* block = table->blocks;
+    while (block) {
+        struct lex_atom_block* next = block->next;
+        lex_dealloc(table->allocator, block, sizeof(struct lex_atom_block) + block->size, LEX_ALLOC_SITE);
+        block = next;
+    }
+    lex_dealloc(table->allocator, table->entries, table->capacity * sizeof(struct lex_atom_entry), LEX_ALLOC_SITE);
+    lex_dealloc(table->allocator, table->slots, table->slot_count * sizeof(lex_atom_t), LEX_ALLOC_SITE);
+    lex_dealloc(table->allocator, table, sizeof(struct lex_atom_table), LEX_ALLOC_SITE);
+}
+
+/**
+ * 清空原子表，之前返回的所有原子ID和文本指针随之失效
+ * 原子数组和哈希表保留已增长的大小，文本存储块全部释放
+ * @param table 原子表
+ */
+void lex_atom_table_clear(struct lex_atom_table* table) {
+    struct lex_atom_block* block = table->blocks;
+    while (block) {
+        struct lex_atom_block* next = block->next;
+        lex_dealloc(table->allocator, block, sizeof(struct lex_atom_block) + block->size, LEX_ALLOC_SITE);
+        block = next;
+    }
+    table->blocks = NULL;
+    table->bytes = 0;
+    table->count = 1;
+    memset(table->slots, 0, table->slot_count * sizeof(lex_atom_t));
+}
+
+/**
+ * 查找或加入一个原子，同样的文本总是得到同样的ID
+ * @param table 原子表
+ * @param text 文本，不必以'\0'结尾
+ * @param length 文本长度
+ * @return 原子ID，内存不足时返回LEX_ATOM_NONE
+ */
+lex_atom_t lex_atom_intern(struct lex_atom_table* table, const char* text, size_t length) {
+    if (length > UINT32_MAX) {
+        return LEX_ATOM_NONE;
+    }
+    /* 装载因子保持在一半以下，探测总能遇到空槽 */
+    if ((table->count + 1) * 2 > table->slot_count && !lex_atom_grow_slots(table)) {
+        return LEX_ATOM_NONE;
+    }
+
+    uint32_t hash = lex_atom_hash(text, length);
+    size_t mask = table->slot_count - 1;
+    size_t i = hash & mask;
+    for (;;) {
+        lex_atom_t atom = table->slots[i];
+        if (atom == LEX_ATOM_NONE) {
+            break;
+        }
+        const struct lex_atom_entry* entry = &table->entries[atom];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->text, text, length) == 0) {
+            return atom;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if (table->count == table->capacity) {
+        size_t capacity = table->capacity * BUFFER_GROWTH_FACTOR;
+        struct lex_atom_entry* entries =
+            (struct lex_atom_entry*)lex_realloc(table->allocator, table->entries,
+                                                table->capacity * sizeof(struct lex_atom_entry),
+                                                capacity * sizeof(struct lex_atom_entry), LEX_ALLOC_SITE);
+        if (!entries) {
+            return LEX_ATOM_NONE;
+        }
+        table->entries = entries;
+        table->capacity = capacity;
+    }
+    const char* copy = lex_atom_store(table, text, length);
+    if (!copy) {
+        return LEX_ATOM_NONE;
+    }
+
+    lex_atom_t atom = (lex_atom_t)table->count++;
+    table->entries[atom].text = copy;
+    table->entries[atom].length = (uint32_t)length;
+    table->entries[atom].hash = hash;
+    table->slots[i] = atom;
+    return atom;
+}
+
+/**
+ * 获取原子的文本，以'\0'结尾，在原子表销毁前一直有效
+ * @param table 原子表
+ * @param atom 原子ID
+ * @return 文本，ID无效时返回NULL
+ */
+const char* lex_atom_text(const struct lex_atom_table* table, lex_atom_t atom) {
+    return atom < table->count ? table->entries[atom].text : NULL;
+}
+
+/**
+ * 获取原子文本的长度
+ */
+size_t lex_atom_length(const struct lex_atom_table* table, lex_atom_t atom) {
+    return atom < table->count ? table->entries[atom].length : 0;
+}
+
+/**
+ * 获取原子数，不含LEX_ATOM_NONE
+ */
+size_t lex_atom_count(const struct lex_atom_table* table) {
+    return table->count - 1;
+}
+
+/**
+ * 获取所有原子文本占用的字节数，不含结尾的'\0'
+ */
+size_t lex_atom_bytes(const struct lex_atom_table* table) {
+    return table->bytes;
+}
@@ -0,0 +1,77 @@
+#include "lex.h"
+
+/*
+ * 换行索引：偏移到行号和列号的换算
+ * 只有诊断信息需要行列号，所以扫描推迟到第一次查询，没有错误的文件不付出任何代价
+ */
+
+void lex_line_index_init(struct lex_line_index* index) {
+    memset(index, 0, sizeof(*index));
+}
+
+void lex_line_index_reset(struct lex_line_index* index, const char* source, size_t size) {
+    index->source = source;
+    index->size = source ? size : 0;
+    index->count = 0;
+    index->built = 0;
+}
+
+int lex_line_index_build(struct lex_line_index* index) {
+    if (index->built) {
+        return 1;
+    }
+    if (!index->source) {
+        return 0;
+    }
+    /* 先计数再填写，数组一次分配到位 */
+    size_t count = lex_simd_find_newlines(index->source, index->size, NULL);
+    if (count > index->capacity) {
+        size_t* newlines = (size_t*)realloc(index->newlines, count * sizeof(size_t));
+        if (!newlines) {
+            return 0;
+        }
+        index->newlines = newlines;
+        index->capacity = count;
+    }
+    index->count = lex_simd_find_newlines(index->source, index->size, index->newlines);
+    index->built = 1;
+    return 1;
+}
+
+int lex_line_index_lookup(struct lex_line_index* index, size_t offset, struct lex_position* position) {
+    if (!lex_line_index_build(index)) {
+        return 0;
+    }
+    if (offset > index->size) {
+        offset = index->size;
+    }
+
+    /* 二分查找偏移之前的换行符数，即从0开始的行号 */
+    size_t low = 0;
+    size_t high = index->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (index->newlines[mid] < offset) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    size_t line_start = low > 0 ? index->newlines[low - 1] + 1 : 0;
+
+    /* 列号按字符计算，UTF-8的后续字节(10xxxxxx)不计入 */
+    size_t column = 1;
+    for (size_t p = line_start; p < offset; p++) {
+        if (((unsigned char)index->source[p] & 0xC0) != 0x80) {
+            column++;
+        }
+    }
+    position->line = low + 1;
+    position->column = column;
+    return 1;
+}
+
+void lex_line_index_free(struct lex_line_index* index) {
+    free(index->newlines);
+    lex_line_index_init(index);
+}
@@ -0,0 +1,277 @@
+#include "lex.h"
+
+#include <pthread.h>
+
+/*
+ * 单个大文件的并行词法分析
+ *
+ * 快速引擎的扫描状态只有扫描位置：从同一个位置开始扫描，得到的词法单元序列总是相同的。
+ * 因此把输入在换行符之后切成若干块，假设每块的开头正好是词法单元的边界，
+ * 各线程从块首开始推测扫描，直到越过下一块的起点。
+ *
+ * 拼接时按顺序检查：前一块扫描结束的位置恰好等于下一块的起点，说明假设成立，
+ * 下一块的结果原样接上；块首落在跨行的块注释或字符串中时结束位置会越过起点，
+ * 这时从真实位置继续串行扫描，直到扫描位置与该块某个词法单元之后的位置重合，
+ * 从那里起推测的结果与串行扫描一致，余下部分仍然直接使用。
+ * 所以结果与串行扫描逐个相同，猜错只让被跨越的那一段重新扫描一遍。
+ */
+
+/* 一个块的推测扫描结果 */
+struct lex_chunk {
+    const char* src;
+    size_t size;                /* 整个源缓冲区的长度 */
+    size_t start;               /* 块的起点，总在换行符之后 */
+    size_t limit;               /* 下一块的起点，扫描位置到达或越过它时停止 */
+    struct lex_token* tokens;
+    size_t count;
+    size_t capacity;
+    size_t end;                 /* 最后一个词法单元之后的扫描位置 */
+    int finished;               /* 1表示扫描到了输入结尾，最后一个词法单元是lex_eof */
+    int failed;                 /* 1表示内存不足 */
+};
+
+/* 追加一个词法单元，空间按倍数增长 */
+static int lex_tokens_push(struct lex_token** tokens, size_t* count, size_t* capacity, const struct lex_token* token) {
+    if (*count == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 256;
+        struct lex_token* grown = (struct lex_token*)realloc(*tokens, new_capacity * sizeof(struct lex_token));
+        if (!grown) {
+            return 0;
+        }
+        *tokens = grown;
+        *capacity = new_capacity;
+    }
+    (*tokens)[(*count)++] = *token;
+    return 1;
+}
+
+/* 扫描一个词法单元，只保留偏移和长度 */
+static inline void lex_parallel_next(const char* src, size_t size, size_t* pos, struct lex_token* token) {
+    lex_simd_scan(src, size, pos, token);
+    token->raw = NULL;
+    token->atom = LEX_ATOM_NONE;
+}
+
+/* 推测扫描一个块 */
+static void* lex_chunk_scan(void* arg) {
+    struct lex_chunk* chunk = (struct lex_chunk*)arg;
+    size_t pos = chunk->start;
+    /* 大致按每8字节一个词法单元预留，减少增长时的复制 */
+    chunk->capacity = (chunk->limit - chunk->start) / 8 + 64;
+    chunk->tokens = (struct lex_token*)malloc(chunk->capacity * sizeof(struct lex_token));
+    if (!chunk->tokens) {
+        chunk->capacity = 0;
+    }
+    for (;;) {
+        struct lex_token token;
+        lex_parallel_next(chunk->src, chunk->size, &pos, &token);
+        if (!lex_tokens_push(&chunk->tokens, &chunk->count, &chunk->capacity, &token)) {
+            chunk->failed = 1;
+            break;
+        }
+        if (token.type == lex_eof) {
+            chunk->finished = 1;
+            break;
+        }
+        if (pos >= chunk->limit) {
+            break;
+        }
+    }
+    chunk->end = pos;
+    return NULL;
+}
+
+/* 词法单元之后的扫描位置 */
+static inline size_t lex_token_end(const struct lex_token* token) {
+    return token->offset + token->raw_size;
+}
+
+/* 把一段词法单元追加到结果中 */
+static int lex_result_append(struct lex_parallel_result* result, size_t* capacity,
+                             const struct lex_token* tokens, size_t count) {
+    if (result->count + count > *capacity) {
+        size_t new_capacity = *capacity ? *capacity : 256;
+        while (new_capacity < result->count + count) {
+            new_capacity *= 2;
+        }
+        struct lex_token* grown = (struct lex_token*)realloc(result->tokens, new_capacity * sizeof(struct lex_token));
+        if (!grown) {
+            return 0;
+        }
+        result->tokens = grown;
+        *capacity = new_capacity;
+    }
+    memcpy(result->tokens + result->count, tokens, count * sizeof(struct lex_token));
+    result->count += count;
+    return 1;
+}
+
+/*
+ * 按顺序拼接各块的结果，修复起点猜错的块
+ * @return 1表示成功，0表示内存不足
+ */
+static int lex_chunks_stitch(struct lex_chunk* chunks, unsigned n, struct lex_parallel_result* result) {
+    /* 第一块从输入开头扫描，总是正确的，直接把它的数组扩大为结果，省去一次复制 */
+    size_t total = 0;
+    for (unsigned k = 0; k < n; k++) {
+        total += chunks[k].count;
+    }
+    result->tokens = chunks[0].tokens;
+    result->count = chunks[0].count;
+    size_t capacity = chunks[0].capacity;
+    chunks[0].tokens = NULL;
+    if (total > capacity) {
+        struct lex_token* grown = (struct lex_token*)realloc(result->tokens, total * sizeof(struct lex_token));
+        if (!grown) {
+            return 0;
+        }
+        result->tokens = grown;
+        capacity = total;
+    }
+    const char* src = chunks[0].src;
+    size_t size = chunks[0].size;
+    size_t pos = chunks[0].end;
+    int finished = chunks[0].finished;
+
+    for (unsigned k = 1; k < n && !finished; k++) {
+        struct lex_chunk* chunk = &chunks[k];
+        if (pos == chunk->start) {
+            if (!lex_result_append(result, &capacity, chunk->tokens, chunk->count)) {
+                return 0;
+            }
+            pos = chunk->end;
+            finished = chunk->finished;
+            continue;
+        }
+
+        /* 串行扫描的位置越过了块首：从pos继续扫描，直到与这一块的某个词法单元之后重合 */
+        result->repaired++;
+        size_t i = 0;
+        for (;;) {
+            while (i < chunk->count && lex_token_end(&chunk->tokens[i]) < pos) {
+                i++;
+            }
+            /* lex_eof之后没有扫描状态，不能作为重合点 */
+            if (i < chunk->count && lex_token_end(&chunk->tokens[i]) == pos && chunk->tokens[i].type != lex_eof) {
+                if (!lex_result_append(result, &capacity, chunk->tokens + i + 1, chunk->count - i - 1)) {
+                    return 0;
+                }
+                pos = chunk->end;
+                finished = chunk->finished;
+                break;
+            }
+            /* 整块都被跨越，交给下一块继续比较 */
+            if (i == chunk->count && !chunk->finished && k + 1 < n) {
+                break;
+            }
+            struct lex_token token;
+            lex_parallel_next(src, size, &pos, &token);
+            if (!lex_result_append(result, &capacity, &token, 1)) {
+                return 0;
+            }
+            if (token.type == lex_eof) {
+                finished = 1;
+                break;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * 用多个线程对完整的源缓冲区做词法分析，结果与快速引擎的串行扫描逐个相同
+ *
+ * @param src 源缓冲区
+ * @param size 源缓冲区长度
+ * @param threads 线程数，实际的块数不超过size / LEX_PARALLEL_MIN_CHUNK
+ * @param result 输出结果，用lex_parallel_free释放
+ * @return 1表示成功，0表示内存不足
+ */
+int lex_parallel_scan(const char* src, size_t size, unsigned threads, struct lex_parallel_result* result) {
+    memset(result, 0, sizeof(*result));
+
+    unsigned n = threads ? threads : 1;
+    if (n > size / LEX_PARALLEL_MIN_CHUNK) {
+        n = (unsigned)(size / LEX_PARALLEL_MIN_CHUNK);
+    }
+    if (n == 0) {
+        n = 1;
+    }
+    struct lex_chunk* chunks = (struct lex_chunk*)calloc(n, sizeof(struct lex_chunk));
+    if (!chunks) {
+        return 0;
+    }
+
+    /* 在大致等分的位置之后找换行符作为块首，之后没有换行符时少分几块 */
+    unsigned count = 0;
+    size_t start = 0;
+    for (unsigned k = 0; k < n; k++) {
+        if (k > 0) {
+            size_t target = (size_t)((unsigned long long)size * k / n);
+            if (target < start) {
+                target = start;
+            }
+            const char* newline = (const char*)memchr(src + target, '\n', size - target);
+            if (!newline || (size_t)(newline - src) + 1 >= size) {
+                break;
+            }
+            size_t next = (size_t)(newline - src) + 1;
+            chunks[count - 1].limit = next;
+            start = next;
+        }
+        chunks[count].src = src;
+        chunks[count].size = size;
+        chunks[count].start = start;
+        chunks[count].limit = size + 1;
+        count++;
+    }
+    result->chunks = count;
+
+    /* 第一块在当前线程中扫描，线程创建失败的块也在这里扫描 */
+    pthread_t* workers = (pthread_t*)calloc(count, sizeof(pthread_t));
+    int* started = (int*)calloc(count, sizeof(int));
+    if (!workers || !started) {
+        free(workers);
+        free(started);
+        workers = NULL;
+        started = NULL;
+    }
+    for (unsigned k = 1; k < count && started; k++) {
+        started[k] = pthread_create(&workers[k], NULL, lex_chunk_scan, &chunks[k]) == 0;
+    }
+    lex_chunk_scan(&chunks[0]);
+    for (unsigned k = 1; k < count; k++) {
+        if (started && started[k]) {
+            pthread_join(workers[k], NULL);
+        } else {
+            lex_chunk_scan(&chunks[k]);
+        }
+    }
+    free(workers);
+    free(started);
+
+    int ok = 1;
+    for (unsigned k = 0; k < count; k++) {
+        ok = ok && !chunks[k].failed;
+    }
+    ok = ok && lex_chunks_stitch(chunks, count, result);
+
+    for (unsigned k = 0; k < count; k++) {
+        free(chunks[k].tokens);
+    }
+    free(chunks);
+    if (!ok) {
+        lex_parallel_free(result);
+    }
+    return ok;
+}
+
+/**
+ * 释放并行词法分析的结果
+ *
+ * @param result 由lex_parallel_scan填写的结果
+ */
+void lex_parallel_free(struct lex_parallel_result* result) {
+    free(result->tokens);
+    memset(result, 0, sizeof(*result));
+}
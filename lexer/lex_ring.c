@@ -0,0 +1,277 @@
+#include "lex.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+/*
+ * 词法分析与语法分析的流水线
+ *
+ * 词法分析线程把词法单元直接写入环形缓冲区的空位，语法分析线程从中读出，
+ * 两端各自只修改一个下标：head由生产者递增，tail由消费者递增，
+ * 生产者以release发布head之前写好的词法单元，消费者以release发布tail之前读完的空位。
+ * 下标只增不减，对容量取模得到槽位；两端各自缓存对方的下标，只在缓存的值不够用时才重新读取。
+ *
+ * 原子表不是线程安全的，运行期间驻留由消费者在读出之前按顺序进行，原子ID与串行分析相同
+ */
+
+#define LEX_RING_LINE 64        /* 两端的下标放在不同的缓存行中 */
+#define LEX_RING_SPINS 128      /* 让出CPU之前自旋的次数 */
+
+struct lex_token_ring {
+    struct lex_token* slots;
+    size_t capacity;                    /* 2的幂 */
+    struct lex_allocator* allocator;
+    struct lex_context* lexer;          /* 运行中的词法分析器上下文 */
+    struct lex_atom_table* atoms;       /* 运行期间从上下文摘下的原子表 */
+    pthread_t thread;
+    int running;
+    char pad0[LEX_RING_LINE];
+
+    /* 生产者一端 */
+    atomic_size_t head;                 /* 下一个写入的位置 */
+    atomic_int closed;                  /* 1表示生产者不再写入 */
+    size_t tail_cache;                  /* 生产者看到的tail */
+    char pad1[LEX_RING_LINE];
+
+    /* 消费者一端 */
+    atomic_size_t tail;                 /* 下一个读出的位置 */
+    atomic_int cancelled;               /* 1表示消费者不再读出，生产者应尽快结束 */
+    size_t head_cache;                  /* 消费者看到的head */
+    size_t interned;                    /* 在此之前的词法单元都已驻留 */
+    char pad2[LEX_RING_LINE];
+};
+
+/* 等待另一端：先自旋，超过LEX_RING_SPINS次后每次让出CPU */
+static inline void lex_ring_wait(unsigned* spins) {
+    if (*spins < LEX_RING_SPINS) {
+        ++*spins;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else {
+        sched_yield();
+    }
+}
+
+/* 词法分析线程：每批最多LEX_TOKEN_BATCH_SIZE个，直接扫描到连续的空位中 */
+static void* lex_ring_produce(void* arg) {
+    struct lex_token_ring* ring = (struct lex_token_ring*)arg;
+    size_t mask = ring->capacity - 1;
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned spins = 0;
+    while (!atomic_load_explicit(&ring->cancelled, memory_order_relaxed)) {
+        size_t space = ring->capacity - (head - ring->tail_cache);
+        if (space == 0) {
+            ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+            space = ring->capacity - (head - ring->tail_cache);
+            if (space == 0) {
+                lex_ring_wait(&spins);
+                continue;
+            }
+        }
+        spins = 0;
+        size_t index = head & mask;
+        size_t n = ring->capacity - index;
+        n = n < space ? n : space;
+        n = n < LEX_TOKEN_BATCH_SIZE ? n : LEX_TOKEN_BATCH_SIZE;
+        size_t count = lex_next_batch_r(ring->lexer, ring->slots + index, n);
+        if (count == 0) {
+            break;
+        }
+        /* 发布之后槽位就归消费者了，先看是否到了结尾 */
+        int eof = ring->slots[index + count - 1].type == lex_eof;
+        head += count;
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+        if (eof) {
+            break;
+        }
+    }
+    atomic_store_explicit(&ring->closed, 1, memory_order_release);
+    return NULL;
+}
+
+/*
+ * 等待至少want个未读出的词法单元
+ * @return 可以读出的数目，生产者已经结束时可能少于want
+ */
+static size_t lex_ring_wait_available(struct lex_token_ring* ring, size_t tail, size_t want) {
+    unsigned spins = 0;
+    for (;;) {
+        if (ring->head_cache - tail >= want) {
+            return ring->head_cache - tail;
+        }
+        /* 先读closed再读head，生产者结束前写入的词法单元都能看到 */
+        int closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+        ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (ring->head_cache - tail >= want || closed) {
+            return ring->head_cache - tail;
+        }
+        lex_ring_wait(&spins);
+    }
+}
+
+/* 驻留end之前还没有驻留的标识符和字符串 */
+static void lex_ring_intern(struct lex_token_ring* ring, size_t end) {
+    size_t mask = ring->capacity - 1;
+    for (size_t i = ring->interned; i < end; i++) {
+        struct lex_token* token = &ring->slots[i & mask];
+        if (ring->atoms && (token->type == lex_word || token->type == lex_string)) {
+            const char* text = lex_token_text_r(ring->lexer, token);
+            if (text) {
+                token->atom = lex_atom_intern(ring->atoms, text, token->raw_size);
+            }
+        }
+    }
+    if (end > ring->interned) {
+        ring->interned = end;
+    }
+}
+
+/* 清空下标，两端都没有运行时调用 */
+static void lex_ring_reset(struct lex_token_ring* ring, int closed) {
+    atomic_store_explicit(&ring->head, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->closed, closed, memory_order_relaxed);
+    atomic_store_explicit(&ring->cancelled, 0, memory_order_relaxed);
+    ring->tail_cache = 0;
+    ring->head_cache = 0;
+    ring->interned = 0;
+}
+
+/**
+ * 创建环形缓冲区
+ *
+ * @param capacity 容纳的词法单元数，向上取整为2的幂，0表示LEX_RING_DEFAULT_CAPACITY
+ * @param allocator 缓冲区本身的分配器，NULL表示默认分配器
+ * @return 新的环形缓冲区，失败返回NULL
+ */
+struct lex_token_ring* lex_ring_create(size_t capacity, struct lex_allocator* allocator) {
+    size_t size = 1;
+    capacity = capacity ? capacity : LEX_RING_DEFAULT_CAPACITY;
+    while (size < capacity) {
+        if (size > SIZE_MAX / 2 / sizeof(struct lex_token)) {
+            return NULL;
+        }
+        size *= 2;
+    }
+    struct lex_token_ring* ring =
+        (struct lex_token_ring*)lex_alloc(allocator, sizeof(struct lex_token_ring), LEX_ALLOC_SITE);
+    if (!ring) {
+        return NULL;
+    }
+    memset(ring, 0, sizeof(*ring));
+    ring->slots = (struct lex_token*)lex_alloc(allocator, size * sizeof(struct lex_token), LEX_ALLOC_SITE);
+    if (!ring->slots) {
+        lex_dealloc(allocator, ring, sizeof(struct lex_token_ring), LEX_ALLOC_SITE);
+        return NULL;
+    }
+    ring->capacity = size;
+    ring->allocator = allocator;
+    /* 没有启动时读出总是立即返回0 */
+    lex_ring_reset(ring, 1);
+    return ring;
+}
+
+/**
+ * 销毁环形缓冲区，正在运行的词法分析线程先被停止
+ *
+ * @param ring 环形缓冲区，可以为NULL
+ */
+void lex_ring_destroy(struct lex_token_ring* ring) {
+    if (!ring) {
+        return;
+    }
+    lex_ring_stop(ring);
+    lex_dealloc(ring->allocator, ring->slots, ring->capacity * sizeof(struct lex_token), LEX_ALLOC_SITE);
+    lex_dealloc(ring->allocator, ring, sizeof(struct lex_token_ring), LEX_ALLOC_SITE);
+}
+
+/**
+ * 启动词法分析线程，把上下文中的词法单元依次写入环形缓冲区
+ *
+ * @param ring 环形缓冲区
+ * @param ctx 视图模式、有完整源缓冲区的词法分析器上下文
+ * @return 1表示已启动，0表示应退回串行分析
+ */
+int lex_ring_start(struct lex_token_ring* ring, struct lex_context* ctx) {
+    if (ring->running || !ctx->source || ctx->mode != lex_mode_view) {
+        return 0;
+    }
+    lex_ring_reset(ring, 0);
+    ring->lexer = ctx;
+    ring->atoms = ctx->atoms;
+    ctx->atoms = NULL;
+    if (pthread_create(&ring->thread, NULL, lex_ring_produce, ring) != 0) {
+        ctx->atoms = ring->atoms;
+        ring->lexer = NULL;
+        ring->atoms = NULL;
+        lex_ring_reset(ring, 1);
+        return 0;
+    }
+    ring->running = 1;
+    return 1;
+}
+
+/**
+ * 停止并等待词法分析线程，把原子表还给上下文
+ *
+ * @param ring 环形缓冲区
+ */
+void lex_ring_stop(struct lex_token_ring* ring) {
+    if (!ring->running) {
+        return;
+    }
+    atomic_store_explicit(&ring->cancelled, 1, memory_order_relaxed);
+    pthread_join(ring->thread, NULL);
+    ring->lexer->atoms = ring->atoms;
+    ring->lexer = NULL;
+    ring->atoms = NULL;
+    ring->running = 0;
+    /* 视图模式的词法单元没有自己的文本，未读出的直接丢弃 */
+    lex_ring_reset(ring, 1);
+}
+
+/**
+ * 读出词法单元，缓冲区为空时等待词法分析线程写入
+ *
+ * @param ring 环形缓冲区
+ * @param tokens 输出数组
+ * @param n 数组容量
+ * @return 读出的词法单元数，0表示已经读完
+ */
+size_t lex_ring_pop(struct lex_token_ring* ring, struct lex_token* tokens, size_t n) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t available = lex_ring_wait_available(ring, tail, 1);
+    size_t count = available < n ? available : n;
+    if (count == 0) {
+        return 0;
+    }
+    lex_ring_intern(ring, tail + count);
+    size_t index = tail & (ring->capacity - 1);
+    size_t first = ring->capacity - index;
+    first = first < count ? first : count;
+    memcpy(tokens, ring->slots + index, first * sizeof(struct lex_token));
+    memcpy(tokens + first, ring->slots, (count - first) * sizeof(struct lex_token));
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+    return count;
+}
+
+/**
+ * 查看尚未读出的第k个词法单元而不读出
+ *
+ * @param ring 环形缓冲区
+ * @param k 向前看的距离，必须小于缓冲区容量
+ * @return 词法单元，在下一次lex_ring_pop之前有效；输入在此之前结束时返回NULL
+ */
+const struct lex_token* lex_ring_peek(struct lex_token_ring* ring, size_t k) {
+    if (k >= ring->capacity) {
+        return NULL;
+    }
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (lex_ring_wait_available(ring, tail, k + 1) <= k) {
+        return NULL;
+    }
+    lex_ring_intern(ring, tail + k + 1);
+    return &ring->slots[(tail + k) & (ring->capacity - 1)];
+}
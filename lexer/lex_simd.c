@@ -0,0 +1,451 @@
+#include "lex.h"
+
+/*
+ * 手写的快速词法分析引擎
+ * 与lex.lex中的规则逐条对应，产生与flex扫描器完全相同的词法单元序列；
+ * 空白、标识符、数字、字符串和注释内容这些长串用SIMD一次分类16/32个字节。
+ * 默认使用x86-64的基线指令集SSE2，编译时加 -mavx2 则使用AVX2，其它平台使用标量实现
+ */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LEX_SIMD_WIDTH 32
+typedef __m256i lex_vec;
+#define lex_vec_load(p)         _mm256_loadu_si256((const __m256i*)(p))
+#define lex_vec_set1(c)         _mm256_set1_epi8((char)(c))
+#define lex_vec_eq(a, b)        _mm256_cmpeq_epi8(a, b)
+#define lex_vec_gt(a, b)        _mm256_cmpgt_epi8(a, b)
+#define lex_vec_and(a, b)       _mm256_and_si256(a, b)
+#define lex_vec_or(a, b)        _mm256_or_si256(a, b)
+#define lex_vec_mask(v)         ((unsigned)_mm256_movemask_epi8(v))
+#define LEX_SIMD_FULL_MASK      0xFFFFFFFFu
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define LEX_SIMD_WIDTH 16
+typedef __m128i lex_vec;
+#define lex_vec_load(p)         _mm_loadu_si128((const __m128i*)(p))
+#define lex_vec_set1(c)         _mm_set1_epi8((char)(c))
+#define lex_vec_eq(a, b)        _mm_cmpeq_epi8(a, b)
+#define lex_vec_gt(a, b)        _mm_cmpgt_epi8(a, b)
+#define lex_vec_and(a, b)       _mm_and_si128(a, b)
+#define lex_vec_or(a, b)        _mm_or_si128(a, b)
+#define lex_vec_mask(v)         ((unsigned)_mm_movemask_epi8(v))
+#define LEX_SIMD_FULL_MASK      0xFFFFu
+#endif
+
+/* 字符分类，与lex.lex中的模式定义一致 */
+static inline int is_whitespace(unsigned char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f';
+}
+static inline int is_digit(unsigned char c) {
+    return c >= '0' && c <= '9';
+}
+static inline int is_letter(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+static inline int is_ident(unsigned char c) {
+    return is_letter(c) || is_digit(c);
+}
+static inline int is_hex(unsigned char c) {
+    return is_digit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+static inline int is_octal(unsigned char c) {
+    return c >= '0' && c <= '7';
+}
+static inline int is_angle_char(unsigned char c) {
+    return is_digit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '/' || c == '.';
+}
+static inline int is_string_plain(unsigned char c) {
+    return c != '"' && c != '\\';
+}
+
+#ifdef LEX_SIMD_WIDTH
+/* 有符号比较即可，0x80以上的字节为负数，不会落入任何ASCII区间 */
+static inline lex_vec vec_in_range(lex_vec v, char lo, char hi) {
+    return lex_vec_and(lex_vec_gt(v, lex_vec_set1(lo - 1)), lex_vec_gt(lex_vec_set1(hi + 1), v));
+}
+static inline lex_vec vec_whitespace(lex_vec v) {
+    return lex_vec_or(lex_vec_or(lex_vec_eq(v, lex_vec_set1(' ')), lex_vec_eq(v, lex_vec_set1('\t'))),
+                      lex_vec_or(lex_vec_eq(v, lex_vec_set1('\r')), lex_vec_eq(v, lex_vec_set1('\f'))));
+}
+static inline lex_vec vec_digit(lex_vec v) {
+    return vec_in_range(v, '0', '9');
+}
+static inline lex_vec vec_ident(lex_vec v) {
+    /* 或上0x20把大写字母折叠为小写，其它ASCII字符不会因此落入a-z */
+    lex_vec lower = lex_vec_or(v, lex_vec_set1(0x20));
+    return lex_vec_or(lex_vec_or(vec_in_range(lower, 'a', 'z'), vec_digit(v)),
+                      lex_vec_eq(v, lex_vec_set1('_')));
+}
+static inline lex_vec vec_string_plain(lex_vec v) {
+    lex_vec stop = lex_vec_or(lex_vec_eq(v, lex_vec_set1('"')), lex_vec_eq(v, lex_vec_set1('\\')));
+    return lex_vec_eq(stop, lex_vec_set1(0));
+}
+#endif
+
+/*
+ * 生成跳过连续同类字符的函数，返回第一个不属于该类的位置
+ * 整块可读时一次分类LEX_SIMD_WIDTH个字节，不足一块的结尾逐字节处理，不会越界读取
+ */
+#ifdef LEX_SIMD_WIDTH
+#define LEX_DEFINE_SPAN(name, vec_match, scalar_match) \
+    static size_t name(const char* s, size_t p, size_t size) { \
+        while (p + LEX_SIMD_WIDTH <= size) { \
+            unsigned mask = ~lex_vec_mask(vec_match(lex_vec_load(s + p))) & LEX_SIMD_FULL_MASK; \
+            if (mask) { \
+                return p + (size_t)__builtin_ctz(mask); \
+            } \
+            p += LEX_SIMD_WIDTH; \
+        } \
+        while (p < size && scalar_match((unsigned char)s[p])) { \
+            p++; \
+        } \
+        return p; \
+    }
+#else
+#define LEX_DEFINE_SPAN(name, vec_match, scalar_match) \
+    static size_t name(const char* s, size_t p, size_t size) { \
+        while (p < size && scalar_match((unsigned char)s[p])) { \
+            p++; \
+        } \
+        return p; \
+    }
+#endif
+
+LEX_DEFINE_SPAN(span_whitespace, vec_whitespace, is_whitespace)
+LEX_DEFINE_SPAN(span_digits, vec_digit, is_digit)
+LEX_DEFINE_SPAN(span_ident, vec_ident, is_ident)
+LEX_DEFINE_SPAN(span_string_plain, vec_string_plain, is_string_plain)
+
+static size_t span_hex(const char* s, size_t p, size_t size) {
+    while (p < size && is_hex((unsigned char)s[p])) {
+        p++;
+    }
+    return p;
+}
+
+/*
+ * FMT_CHAR：从反斜杠处开始的转义序列
+ * \x和八进制转义的长度不唯一：其后剩余的数字在字符串中也是普通字符，只需最短长度；
+ * 字符常量的转义之后必须紧跟单引号，只能取最长长度
+ *
+ * @return 1表示匹配，0表示不是合法的转义
+ */
+static int match_escape(const char* s, size_t p, size_t size, size_t* shortest, size_t* longest) {
+    if (p + 1 >= size || s[p] != '\\') {
+        return 0;
+    }
+    size_t end;
+    switch ((unsigned char)s[p + 1]) {
+    case '\'': case '"': case '?': case '\\':
+    case 'a': case 'b': case 'f': case 'n': case 'r': case 't': case 'v':
+        *shortest = *longest = 2;
+        return 1;
+    case 'x':
+        end = span_hex(s, p + 2, size);
+        if (end == p + 2) {
+            return 0;
+        }
+        *shortest = 3;
+        *longest = end - p;
+        return 1;
+    case 'u':
+        if (span_hex(s, p + 2, size) < p + 6) {
+            return 0;
+        }
+        *shortest = *longest = 6;
+        return 1;
+    case 'U':
+        if (span_hex(s, p + 2, size) < p + 10) {
+            return 0;
+        }
+        *shortest = *longest = 10;
+        return 1;
+    default:
+        end = p + 1;
+        while (end < size && end < p + 4 && is_octal((unsigned char)s[end])) {
+            end++;
+        }
+        if (end == p + 1) {
+            return 0;
+        }
+        *shortest = 2;
+        *longest = end - p;
+        return 1;
+    }
+}
+
+/* 字符串常量 \"([^\\"]|{FMT_CHAR})*\" ，不匹配时返回0 */
+static size_t match_string(const char* s, size_t p, size_t size) {
+    size_t q = p + 1;
+    for (;;) {
+        q = span_string_plain(s, q, size);
+        if (q >= size) {
+            return 0;
+        }
+        if (s[q] == '"') {
+            return q + 1 - p;
+        }
+        /* 未转义的双引号之外，反斜杠必须开始一个合法的转义 */
+        size_t shortest, longest;
+        if (!match_escape(s, q, size, &shortest, &longest)) {
+            return 0;
+        }
+        q += shortest;
+    }
+}
+
+/* 字符常量 \'([^\\"]|{FMT_CHAR})\' ，不匹配时返回0 */
+static size_t match_char(const char* s, size_t p, size_t size) {
+    if (p + 2 >= size) {
+        return 0;
+    }
+    unsigned char c = (unsigned char)s[p + 1];
+    if (c != '\\') {
+        return (c != '"' && s[p + 2] == '\'') ? 3 : 0;
+    }
+    size_t shortest, longest;
+    if (!match_escape(s, p + 1, size, &shortest, &longest)) {
+        return 0;
+    }
+    size_t end = p + 1 + longest;
+    return (end < size && s[end] == '\'') ? end + 1 - p : 0;
+}
+
+/* 尖括号字符串 \<[a-zA-Z0-9/\.]+\> ，不匹配时返回0 */
+static size_t match_angle(const char* s, size_t p, size_t size) {
+    size_t q = p + 1;
+    while (q < size && is_angle_char((unsigned char)s[q])) {
+        q++;
+    }
+    return (q > p + 1 && q < size && s[q] == '>') ? q + 1 - p : 0;
+}
+
+/* [eE][+-]?{DIGIT}+ ，返回指数部分的结束位置，不匹配时返回p */
+static size_t match_exponent(const char* s, size_t p, size_t size) {
+    if (p >= size || (s[p] != 'e' && s[p] != 'E')) {
+        return p;
+    }
+    size_t q = p + 1;
+    if (q < size && (s[q] == '+' || s[q] == '-')) {
+        q++;
+    }
+    size_t end = span_digits(s, q, size);
+    return end > q ? end : p;
+}
+
+/* 数字常量：INTEGER、FLOAT、SCIENTIFIC、HEX、OCTAL、BINARY中最长的匹配 */
+static size_t match_number(const char* s, size_t p, size_t size) {
+    size_t digits = span_digits(s, p, size);
+    size_t best;
+
+    /* INTEGER */
+    size_t integer = s[p] == '0' ? p + 1 : digits;
+    best = integer - p;
+
+    /* FLOAT */
+    if (integer < size && s[integer] == '.') {
+        size_t fraction = span_digits(s, integer + 1, size);
+        if (fraction > integer + 1) {
+            size_t end = match_exponent(s, fraction, size);
+            if (end - p > best) {
+                best = end - p;
+            }
+        }
+    }
+
+    /* SCIENTIFIC */
+    size_t exponent = match_exponent(s, digits, size);
+    if (exponent > digits && exponent - p > best) {
+        best = exponent - p;
+    }
+
+    /* HEX、BINARY、OCTAL */
+    if (s[p] == '0' && p + 1 < size) {
+        unsigned char c = (unsigned char)s[p + 1];
+        size_t end = p + 2;
+        if (c == 'x' || c == 'X') {
+            end = span_hex(s, end, size);
+        } else if (c == 'b' || c == 'B') {
+            while (end < size && (s[end] == '0' || s[end] == '1')) {
+                end++;
+            }
+        } else if (c >= '1' && c <= '7') {
+            while (end < size && is_octal((unsigned char)s[end])) {
+                end++;
+            }
+        }
+        /* 前缀之后至少要有一个数字；八进制的第一个数字就是c */
+        if (end > p + 2 || (c >= '1' && c <= '7')) {
+            if (end - p > best) {
+                best = end - p;
+            }
+        }
+    }
+    return best;
+}
+
+/* 运算符和标点符号，返回最长匹配的长度，不是标点时返回0 */
+static size_t match_punctuation(const char* s, size_t p, size_t size) {
+    static const char* const three[] = { "<<=", ">>=" };
+    static const char* const two[] = {
+        "++", "--", "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=",
+        "==", "!=", ">=", "<=", "&&", "||", "<<", ">>", "->",
+    };
+    if (p + 3 <= size) {
+        for (size_t i = 0; i < sizeof(three) / sizeof(three[0]); i++) {
+            if (memcmp(s + p, three[i], 3) == 0) {
+                return 3;
+            }
+        }
+    }
+    if (p + 2 <= size) {
+        for (size_t i = 0; i < sizeof(two) / sizeof(two[0]); i++) {
+            if (s[p] == two[i][0] && s[p + 1] == two[i][1]) {
+                return 2;
+            }
+        }
+    }
+    return (s[p] != '\0' && strchr("+-*/%=><!&|^~.,;:?()[]{}#", s[p])) ? 1 : 0;
+}
+
+/**
+ * 从*pos开始识别下一个词法单元，跳过的空白和注释与flex扫描器一致
+ *
+ * @param src 源缓冲区
+ * @param size 源缓冲区长度
+ * @param pos 扫描位置，返回时指向词法单元之后
+ * @param token 输出的词法单元，只设置type、offset和raw_size；到达输入结尾时为lex_eof
+ */
+void lex_simd_scan(const char* src, size_t size, size_t* pos, struct lex_token* token) {
+    size_t p = *pos;
+    for (;;) {
+        p = span_whitespace(src, p, size);
+        if (p >= size) {
+            token->type = lex_eof;
+            token->offset = size;
+            token->raw_size = 0;
+            *pos = size;
+            return;
+        }
+
+        unsigned char c = (unsigned char)src[p];
+        size_t length = 0;
+        enum lex_token_type type = lex_punctuation;
+
+        if (c == '/' && p + 1 < size && src[p + 1] == '*') {
+            /*
+             * 块注释：跳到第一个"*\/"之后
+             * 没有结束时注释延续到输入结尾，与flex一样在结尾给出lex_eof：
+             * 不带开始条件的<<EOF>>规则对COMMENT状态同样生效
+             */
+            const char* q = src + p + 2;
+            const char* end = src + size;
+            size_t next = size;
+            for (;;) {
+                q = (const char*)memchr(q, '*', (size_t)(end - q));
+                if (!q || q + 1 >= end) {
+                    break;
+                }
+                if (q[1] == '/') {
+                    next = (size_t)(q + 2 - src);
+                    break;
+                }
+                q++;
+            }
+            p = next;
+            continue;
+        }
+        if (c == '/' && p + 1 < size && src[p + 1] == '/') {
+            /* 单行注释：跳到换行符，换行符本身仍作为EOL */
+            const char* q = (const char*)memchr(src + p, '\n', size - p);
+            p = q ? (size_t)(q - src) : size;
+            continue;
+        }
+
+        if (c == '\n') {
+            type = lex_eol;
+            length = 1;
+        } else if (is_letter(c)) {
+            type = lex_word;
+            length = span_ident(src, p + 1, size) - p;
+        } else if (is_digit(c)) {
+            type = lex_number;
+            length = match_number(src, p, size);
+        } else if (c == '"') {
+            type = lex_string;
+            length = match_string(src, p, size);
+        } else if (c == '\'') {
+            type = lex_number;
+            length = match_char(src, p, size);
+        } else if (c == '<' && (length = match_angle(src, p, size)) > 0) {
+            type = lex_string;
+        } else {
+            type = lex_punctuation;
+            length = match_punctuation(src, p, size);
+        }
+
+        /* 其它规则都不匹配时由 . 规则识别为单个未知字符 */
+        if (length == 0) {
+            type = lex_unknown;
+            length = 1;
+        }
+
+        token->type = type;
+        token->offset = p;
+        token->raw_size = length;
+        *pos = p + length;
+        return;
+    }
+}
+
+/**
+ * 用快速引擎识别上下文中的下一个词法单元，结果存入ctx->current_token
+ *
+ * @param ctx 以内存缓冲区初始化的词法分析器上下文
+ * @return 总是1，与flex一样到达输入结尾后每次都给出lex_eof
+ */
+int lex_simd_next(struct lex_context* ctx) {
+    struct lex_token token;
+    lex_simd_scan(ctx->source, ctx->source_size, &ctx->position, &token);
+    token.raw = (ctx->mode == lex_mode_owning && token.raw_size > 0)
+        ? lex_alloc_strndup(ctx->allocator, ctx->source + token.offset, token.raw_size, LEX_ALLOC_SITE) : NULL;
+    ctx->current_token = token;
+    return 1;
+}
+
+/**
+ * 找出源缓冲区中的所有换行符，整块可读时一次比较LEX_SIMD_WIDTH个字节
+ *
+ * @param src 源缓冲区
+ * @param size 源缓冲区长度
+ * @param offsets 输出换行符的偏移，为NULL时只计数
+ * @return 换行符数
+ */
+size_t lex_simd_find_newlines(const char* src, size_t size, size_t* offsets) {
+    size_t count = 0;
+    size_t p = 0;
+#ifdef LEX_SIMD_WIDTH
+    lex_vec newline = lex_vec_set1('\n');
+    for (; p + LEX_SIMD_WIDTH <= size; p += LEX_SIMD_WIDTH) {
+        unsigned mask = lex_vec_mask(lex_vec_eq(lex_vec_load(src + p), newline));
+        if (!offsets) {
+            count += (size_t)__builtin_popcount(mask);
+            continue;
+        }
+        while (mask) {
+            offsets[count++] = p + (size_t)__builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; p < size; p++) {
+        if (src[p] == '\n') {
+            if (offsets) {
+                offsets[count] = p;
+            }
+            count++;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,136 @@
+#include "lex.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * 将文件映射到内存，映射为写时复制的私有映射，末尾附带填充字节
+ *
+ * 先预留一段足以容纳文件和填充字节的匿名映射，再把文件以MAP_FIXED覆盖到其起始处：
+ * 文件最后一页超出文件长度的部分由内核清零，之后的页来自匿名映射同样为零，
+ * 因此无论文件长度是否恰好是页的整数倍，结尾的填充字节都是'\0'
+ *
+ * @param src 输出的源文件缓冲区
+ * @param filename 文件名
+ * @return 1表示成功，0表示失败
+ */
+int lex_source_open(struct lex_source_file* src, const char* filename) {
+    memset(src, 0, sizeof(*src));
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        /* 管道、设备等无法映射，退回到读取 */
+        FILE* file = fdopen(fd, "rb");
+        if (!file) {
+            close(fd);
+            return 0;
+        }
+        int ok = lex_source_read(src, file);
+        fclose(file);
+        return ok;
+    }
+
+    size_t size = (size_t)st.st_size;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t map_size = (size + LEX_BUFFER_PADDING + page - 1) / page * page;
+
+    /* flex会临时改写缓冲区，所以映射必须可写；MAP_PRIVATE保证不会写回文件 */
+    char* base = (char*)mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+
+    if (size > 0) {
+        void* data = mmap(base, size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_FIXED, fd, 0);
+        if (data == MAP_FAILED) {
+            munmap(base, map_size);
+            close(fd);
+            return 0;
+        }
+        /* 词法分析按顺序扫描整个文件 */
+        madvise(base, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    src->data = base;
+    src->size = size;
+    src->map_size = map_size;
+    src->mapped = 1;
+    return 1;
+}
+
+/**
+ * 从文件流读取全部内容，用于标准输入等无法映射的输入
+ *
+ * @param src 输出的源文件缓冲区
+ * @param file 已打开的文件
+ * @return 1表示成功，0表示失败
+ */
+int lex_source_read(struct lex_source_file* src, FILE* file) {
+    memset(src, 0, sizeof(*src));
+
+    size_t capacity = LEX_TOKEN_STREAM_BUFSIZE;
+    size_t size = 0;
+    char* data = (char*)malloc(capacity);
+    if (!data) {
+        return 0;
+    }
+
+    for (;;) {
+        /* 始终为结尾的填充字节保留空间 */
+        if (capacity - size <= LEX_BUFFER_PADDING) {
+            size_t new_capacity = capacity * BUFFER_GROWTH_FACTOR;
+            char* new_data = (char*)realloc(data, new_capacity);
+            if (!new_data) {
+                free(data);
+                return 0;
+            }
+            data = new_data;
+            capacity = new_capacity;
+        }
+
+        size_t n = fread(data + size, 1, capacity - size - LEX_BUFFER_PADDING, file);
+        size += n;
+        if (n == 0) {
+            break;
+        }
+    }
+
+    if (ferror(file)) {
+        free(data);
+        return 0;
+    }
+
+    memset(data + size, 0, LEX_BUFFER_PADDING);
+    src->data = data;
+    src->size = size;
+    src->map_size = capacity;
+    src->mapped = 0;
+    return 1;
+}
+
+/**
+ * 释放源文件缓冲区
+ *
+ * @param src 源文件缓冲区
+ */
+void lex_source_close(struct lex_source_file* src) {
+    if (src->data) {
+        if (src->mapped) {
+            munmap(src->data, src->map_size);
+        } else {
+            free(src->data);
+        }
+    }
+    memset(src, 0, sizeof(*src));
+}
@@ -1,8 +1,30 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <cerrno>
 #include <cstring>
-#include <fstream>
-#include <sstream>
+#include <ctime>
+#include <dirent.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 // 首先包含C语言词法分析器和语法分析器头文件
 extern "C" {
@@ -13,6 +35,8 @@ extern "C" {
 #include "parser.h"
 #include "lex.h"
 #include "bscp.hpp"
+#include "bscp_vm.h"
+#include "stats_heap.h"
 
 #define LEX_TOKEN_STREAM_BUFSIZE BUFSIZ
 
@@ -47,78 +71,172 @@ class CppLexToken {
 public:
     CppLexTokenType type;
     std::string raw;
+    std::string_view view;  // 视图模式下指向源缓冲区，不持有内存
+    size_t offset;          // 在源缓冲区中的字节偏移
     
-    CppLexToken() : type(CppLexTokenType::Unknown), raw("") {}
+    CppLexToken() : type(CppLexTokenType::Unknown), raw(""), offset(0) {}
     
-    CppLexToken(CppLexTokenType type, const std::string& raw): type(type), raw(raw) {
+    CppLexToken(CppLexTokenType type, const std::string& raw): type(type), raw(raw), offset(0) {
+    }
+    
+    /**
+     * 获取词法标记的文本，两种模式通用
+     */
+    std::string_view text() const noexcept {
+        return raw.empty() ? view : std::string_view(raw);
     }
     
     virtual ~CppLexToken() noexcept {
     }
 };
 
+// 源文件类，封装lex_source_file：普通文件以mmap映射，其它输入读入内存
+class CppSourceFile {
+private:
+    struct lex_source_file src;
+    
+public:
+    CppSourceFile() noexcept {
+        memset(&src, 0, sizeof(src));
+    }
+    
+    CppSourceFile(const CppSourceFile&) = delete;
+    CppSourceFile& operator=(const CppSourceFile&) = delete;
+    
+    /**
+     * 映射文件
+     * @param filename 文件名
+     * @return true表示成功，false表示失败
+     */
+    bool open(const std::string& filename) noexcept {
+        lex_source_close(&src);
+        return lex_source_open(&src, filename.c_str()) != 0;
+    }
+    
+    /**
+     * 读取文件流的全部内容
+     * @param file 已打开的文件流
+     * @return true表示成功，false表示失败
+     */
+    bool read(FILE* file) noexcept {
+        lex_source_close(&src);
+        return lex_source_read(&src, file) != 0;
+    }
+    
+    // 缓冲区末尾带有LEX_BUFFER_PADDING个'\0'，可直接交给词法分析器
+    char* data() const noexcept { return src.data; }
+    size_t size() const noexcept { return src.size; }
+    bool empty() const noexcept { return src.size == 0; }
+    
+    virtual ~CppSourceFile() noexcept {
+        lex_source_close(&src);
+    }
+};
+
 // 词法标记流类
 class CppLexTokenStream {
 private:
     bool initialized = false;
+    enum lex_token_mode mode;
+    struct lex_context* ctx;    // 每个流拥有独立的词法分析器上下文
+    CppSourceFile ownedSource;  // initFromFile映射的文件，视图模式下必须比词法标记活得更久
     
 public:
-    CppLexTokenStream() noexcept {
-        // 构造函数，不需要特殊初始化
+    CppLexTokenStream(enum lex_token_mode mode = lex_mode_owning) noexcept: mode(mode) {
         initialized = false;
+        ctx = lex_create();
+        if (ctx) {
+            lex_set_token_mode_r(ctx, mode);
+        }
+    }
+    
+    CppLexTokenStream(const CppLexTokenStream&) = delete;
+    CppLexTokenStream& operator=(const CppLexTokenStream&) = delete;
+    
+    /**
+     * 选择词法分析引擎，应在初始化输入之前调用
+     * @param engine lex_engine_flex或lex_engine_simd
+     */
+    void setEngine(enum lex_engine engine) noexcept {
+        if (ctx) {
+            lex_set_engine_r(ctx, engine);
+        }
+    }
+    
+    /**
+     * 设置拥有模式下复制词法标记文本的分配器
+     * @param allocator 分配器，nullptr表示默认分配器
+     */
+    void setAllocator(struct lex_allocator* allocator) noexcept {
+        if (ctx) {
+            lex_set_allocator_r(ctx, allocator);
+        }
     }
     
     /**
      * 从字符串初始化词法分析器
+     * 视图模式下input必须在词法分析期间保持有效
      * @param input 输入字符串
      * @return true表示成功，false表示失败
      */
     bool init(const std::string& input) noexcept {
-        // 如果已经初始化，先清理
-        if (initialized) {
-            lex_cleanup();
+        if (!ctx) {
+            return false;
         }
         
-        // 从字符串初始化词法分析器
-        initialized = (lex_init_with_string(input.c_str(), input.length()) != 0);
+        // 从字符串初始化词法分析器，会自动清理之前的输入
+        initialized = (lex_init_with_string_r(ctx, input.c_str(), input.length()) != 0);
         return initialized;
     }
     
     /**
-     * 从文件初始化词法分析器
-     * @param filename 文件名
+     * 从缓冲区原地初始化词法分析器，不复制输入
+     * @param buffer 输入缓冲区，末尾须有LEX_BUFFER_PADDING个'\0'，如CppSourceFile::data()
+     * @param length 输入长度，不含填充字节
      * @return true表示成功，false表示失败
      */
-    bool initFromFile(const std::string& filename) noexcept {
-        // 如果已经初始化，先清理
-        if (initialized) {
-            lex_cleanup();
+    bool init(char* buffer, size_t length) noexcept {
+        if (!ctx) {
+            return false;
         }
         
-        // 读取整个文件内容
-        std::ifstream file(filename, std::ios::binary);
-        if (!file) {
+        initialized = (lex_init_with_buffer_r(ctx, buffer, length) != 0);
+        return initialized;
+    }
+    
+    /**
+     * 从文件描述符流式初始化词法分析器，输入分块读取，内存占用与输入大小无关
+     * 没有完整的源缓冲区，需要文本时应使用拥有模式
+     * @param fd 文件描述符，如STDIN_FILENO
+     * @return true表示成功，false表示失败
+     */
+    bool initFromFd(int fd) noexcept {
+        if (!ctx) {
             return false;
         }
         
-        // 获取文件大小
-        file.seekg(0, std::ios::end);
-        size_t size = file.tellg();
-        file.seekg(0, std::ios::beg);
-        
-        // 读取文件内容到字符串
-        std::string content;
-        content.resize(size);
-        file.read(&content[0], size);
-        file.close();
+        initialized = (lex_init_with_fd_r(ctx, fd) != 0);
+        return initialized;
+    }
+    
+    /**
+     * 从文件初始化词法分析器
+     * @param filename 文件名
+     * @return true表示成功，false表示失败
+     */
+    bool initFromFile(const std::string& filename) noexcept {
+        // 映射整个文件
+        if (!ownedSource.open(filename)) {
+            return false;
+        }
         
-        // 使用字符串初始化
-        return init(content);
+        // 直接在映射的内存上扫描
+        return init(ownedSource.data(), ownedSource.size());
     }
     
     virtual ~CppLexTokenStream() noexcept {
-        // 析构函数，清理词法分析器使用的内存
-        lex_cleanup();
+        // 析构函数，销毁词法分析器上下文
+        lex_destroy(ctx);
     }
 
     /**
@@ -137,22 +255,32 @@ public:
         cToken.type = lex_unknown;   // 明确初始化为枚举类型值
         cToken.raw_size = 0;
         cToken.raw = nullptr;
+        cToken.offset = 0;
+        cToken.atom = LEX_ATOM_NONE;
         
         // 调用C语言接口获取下一个标记
-        int result = lex_next(&cToken);
+        int result = lex_next_r(ctx, &cToken);
         
         if (result) {
             // 转换类型
             buf.type = convertTokenType(cToken.type);
+            buf.offset = cToken.offset;
+            buf.view = std::string_view();
             
             // 复制内容
-            if (cToken.raw) {
+            if (mode == lex_mode_view) {
+                // 视图模式：不分配也不复制，直接引用源缓冲区
+                const char* text = lex_token_text_r(ctx, &cToken);
+                buf.raw.clear();
+                if (text) {
+                    buf.view = std::string_view(text, cToken.raw_size);
+                }
+            } else if (cToken.raw) {
                 // 使用构造函数从C字符串创建std::string
                 buf.raw = std::string(cToken.raw, cToken.raw_size);
                 
                 // 释放C词法分析器分配的内存
-                free(cToken.raw);
-                cToken.raw = nullptr;
+                lex_token_free_r(ctx, &cToken);
             } else {
                 buf.raw.clear();
             }
@@ -162,20 +290,187 @@ public:
         
         return false;
     }
+    
+    /**
+     * 批量获取C风格的词法标记，省去逐个转换的开销
+     * 拥有模式下调用者需要用release释放各词法标记的文本
+     * @param tokens 输出数组
+     * @param n 数组容量
+     * @return 获取到的词法标记数，小于n表示输入已经结束
+     */
+    size_t nextBatch(struct lex_token* tokens, size_t n) noexcept {
+        if (!initialized) {
+            return 0;
+        }
+        return lex_next_batch_r(ctx, tokens, n);
+    }
+    
+    /**
+     * 获取nextBatch得到的词法标记的文本，两种模式通用
+     */
+    std::string_view text(const struct lex_token& token) const noexcept {
+        const char* raw = lex_token_text_r(ctx, &token);
+        return raw ? std::string_view(raw, token.raw_size) : std::string_view();
+    }
+    
+    /**
+     * 释放nextBatch在拥有模式下复制的文本
+     */
+    void release(struct lex_token* tokens, size_t n) noexcept {
+        for (size_t i = 0; i < n; ++i) {
+            lex_token_free_r(ctx, &tokens[i]);
+        }
+    }
 };
 
-// 实用函数：从文件读取内容
-std::string readFileContent(const std::string& filename) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) {
-        std::cerr << "无法打开文件: " << filename << std::endl;
-        return "";
+// 词法标记类型的描述
+static const char* tokenTypeName(enum lex_token_type type) {
+    switch (type) {
+        case lex_word:          return "标识符";
+        case lex_number:        return "数字";
+        case lex_string:        return "字符串";
+        case lex_punctuation:   return "标点符号";
+        case lex_eol:           return "行尾";
+        case lex_eof:           return "文件结束";
+        case lex_assembly:      return "汇编";
+        case lex_unknown:
+        default:                return "未知";
+    }
+}
+
+/**
+ * 差分测试：用flex和SIMD两种引擎扫描同一输入，报告第一个不一致的词法单元
+ * flex扫描自己复制的输入，不会改写SIMD引擎正在读取的缓冲区
+ * @param out 报告输出流
+ * @param err 错误输出流
+ * @return 0表示完全一致，1表示存在差异或初始化失败
+ */
+static int diffLexerEngines(char* data, size_t size, std::ostream& out, std::ostream& err) {
+    struct lex_context* flex = lex_create();
+    struct lex_context* simd = lex_create();
+    int status = 1;
+    
+    if (flex && simd) {
+        lex_set_token_mode_r(flex, lex_mode_view);
+        lex_set_token_mode_r(simd, lex_mode_view);
+        lex_set_engine_r(simd, lex_engine_simd);
+        if (lex_init_with_string_r(flex, data, size) && lex_init_with_buffer_r(simd, data, size)) {
+            status = 0;
+        }
+    }
+    if (status) {
+        err << "初始化词法分析器失败" << std::endl;
+        lex_destroy(flex);
+        lex_destroy(simd);
+        return 1;
+    }
+    
+    size_t count = 0;
+    for (;;) {
+        struct lex_token a = { lex_unknown, 0, nullptr, 0 };
+        struct lex_token b = { lex_unknown, 0, nullptr, 0 };
+        int gotA = lex_next_r(flex, &a);
+        int gotB = lex_next_r(simd, &b);
+        
+        if (gotA != gotB || (gotA && (a.type != b.type || a.offset != b.offset || a.raw_size != b.raw_size))) {
+            out << "词法单元 " << count + 1 << " 不一致:" << std::endl;
+            if (gotA) {
+                out << "  flex: 类型=" << tokenTypeName(a.type) << "\t偏移=" << a.offset
+                          << "\t内容=\"" << std::string_view(data + a.offset, a.raw_size) << "\"" << std::endl;
+            } else {
+                out << "  flex: 输入结束" << std::endl;
+            }
+            if (gotB) {
+                out << "  simd: 类型=" << tokenTypeName(b.type) << "\t偏移=" << b.offset
+                          << "\t内容=\"" << std::string_view(data + b.offset, b.raw_size) << "\"" << std::endl;
+            } else {
+                out << "  simd: 输入结束" << std::endl;
+            }
+            status = 1;
+            break;
+        }
+        if (!gotA) {
+            break;
+        }
+        count++;
+        if (a.type == lex_eof) {
+            break;
+        }
     }
     
-    // 读取整个文件
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    return buffer.str();
+    if (status == 0) {
+        out << "两种引擎的结果一致，共 " << count << " 个词法单元" << std::endl;
+    }
+    lex_destroy(flex);
+    lex_destroy(simd);
+    return status;
+}
+
+/**
+ * 差分测试：比较并行词法分析与flex串行扫描的结果，报告第一个不一致的词法单元
+ * 并行词法分析总是使用SIMD引擎，以flex为基准才能同时发现两种引擎之间的差异；
+ * flex扫描自己复制的输入，不会改写并行扫描读取的缓冲区
+ * @param threads 并行词法分析的线程数
+ * @return 0表示完全一致，1表示存在差异或失败
+ */
+static int diffParallelLexer(char* data, size_t size, unsigned threads, std::ostream& out, std::ostream& err) {
+    struct lex_context* serial = lex_create();
+    struct lex_parallel_result result;
+    if (!serial || !lex_parallel_scan(data, size, threads, &result)) {
+        err << "并行词法分析失败" << std::endl;
+        lex_destroy(serial);
+        return 1;
+    }
+    lex_set_token_mode_r(serial, lex_mode_view);
+    lex_set_engine_r(serial, lex_engine_flex);
+    int status = lex_init_with_string_r(serial, data, size) ? 0 : 1;
+    
+    size_t count = 0;
+    while (status == 0) {
+        struct lex_token token = { lex_unknown, 0, nullptr, 0 };
+        int got = lex_next_r(serial, &token);
+        const struct lex_token* other = count < result.count ? &result.tokens[count] : nullptr;
+        if (!got && !other) {
+            break;
+        }
+        if (!got || !other || token.type != other->type || token.offset != other->offset
+            || token.raw_size != other->raw_size) {
+            out << "词法单元 " << count + 1 << " 不一致:" << std::endl;
+            if (got) {
+                out << "  flex串行: 类型=" << tokenTypeName(token.type) << "\t偏移=" << token.offset
+                    << "\t内容=\"" << std::string_view(data + token.offset, token.raw_size) << "\"" << std::endl;
+            } else {
+                out << "  flex串行: 输入结束" << std::endl;
+            }
+            if (other) {
+                out << "  并行: 类型=" << tokenTypeName(other->type) << "\t偏移=" << other->offset
+                    << "\t内容=\"" << std::string_view(data + other->offset, other->raw_size) << "\"" << std::endl;
+            } else {
+                out << "  并行: 输入结束" << std::endl;
+            }
+            status = 1;
+            break;
+        }
+        count++;
+        if (token.type == lex_eof) {
+            break;
+        }
+    }
+    
+    if (status == 0) {
+        out << "并行与flex串行扫描的结果一致，共 " << count << " 个词法单元（" << result.chunks << " 块，修复 "
+            << result.repaired << " 块）" << std::endl;
+    }
+    lex_parallel_free(&result);
+    lex_destroy(serial);
+    return status;
+}
+
+/* ast_print和ast_file_print的输出回调，写入std::ostream */
+static size_t writeToStream(void* user, const char* data, size_t size) {
+    std::ostream& out = *(std::ostream*)user;
+    out.write(data, (std::streamsize)size);
+    return out ? size : 0;
 }
 
 // 解析模式枚举
@@ -185,116 +480,1334 @@ enum class ParseMode {
     Both        // 词法和语法分析
 };
 
+/*
+ * 统计
+ * --stats给出每个文件各阶段的墙钟时间和CPU时间、按类型统计的词法单元和语法树节点、内存用量。
+ * 编译时定义BASM_NO_STATS（make STATS=0）则计时和计数代码全部去掉，热路径上没有任何开销
+ */
+enum StatsPhase {
+    StatsRead,      // 读取源文件
+    StatsLex,       // 词法分析
+    StatsParse,     // 语法分析
+    StatsEval,      // bscp求值，只在服务器模式的eval请求中出现
+    StatsPhaseCount
+};
+
+enum class StatsFormat {
+    None,   // 不统计
+    Text,   // 便于阅读的文本
+    Json    // 每个文件一行JSON
+};
+
+struct Stats {
+    double wall[StatsPhaseCount] = {};              // 秒
+    double cpu[StatsPhaseCount] = {};               // 当前线程的CPU时间，秒
+    unsigned long tokens[LEX_TOKEN_TYPE_COUNT] = {};
+    std::map<std::string, unsigned long> nodes;     // 节点类型名到节点数，按名称排序输出
+    size_t heapBytes = 0;                           // C++堆分配的字节数
+    size_t heapCount = 0;                           // C++堆分配的次数
+    size_t arenaBytes = 0;                          // 语法树内存池占用的字节数
+    size_t atomBytes = 0;                           // 这个文件加入原子表的文本字节数
+    
+    void add(const Stats& other) {
+        for (int i = 0; i < StatsPhaseCount; ++i) {
+            wall[i] += other.wall[i];
+            cpu[i] += other.cpu[i];
+        }
+        for (int i = 0; i < LEX_TOKEN_TYPE_COUNT; ++i) {
+            tokens[i] += other.tokens[i];
+        }
+        for (const auto& node : other.nodes) {
+            nodes[node.first] += node.second;
+        }
+        heapBytes += other.heapBytes;
+        heapCount += other.heapCount;
+        arenaBytes = std::max(arenaBytes, other.arenaBytes);
+        atomBytes = std::max(atomBytes, other.atomBytes);
+    }
+};
+
+#ifndef BASM_NO_STATS
+static double threadCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+#endif
+
+/* 把一个阶段的耗时累加到统计中，stats为NULL时不计时 */
+class StatsTimer {
+public:
+#ifndef BASM_NO_STATS
+    StatsTimer(Stats* stats, StatsPhase phase) : stats(stats), phase(phase) {
+        if (stats) {
+            wall = std::chrono::steady_clock::now();
+            cpu = threadCpuSeconds();
+        }
+    }
+    ~StatsTimer() {
+        stop();
+    }
+    /* 提前结束计时，之后不再累加 */
+    void stop() {
+        if (stats) {
+            stats->wall[phase] += std::chrono::duration<double>(std::chrono::steady_clock::now() - wall).count();
+            stats->cpu[phase] += threadCpuSeconds() - cpu;
+            stats = nullptr;
+        }
+    }
+private:
+    Stats* stats;
+    StatsPhase phase;
+    std::chrono::steady_clock::time_point wall;
+    double cpu = 0;
+#else
+    StatsTimer(Stats*, StatsPhase) {}
+    void stop() {}
+#endif
+};
+
+/* 统计一段代码中当前线程的C++堆分配 */
+class StatsAllocations {
+public:
+#ifndef BASM_NO_STATS
+    explicit StatsAllocations(Stats* stats)
+        : stats(stats), bytes(threadHeapBytes), count(threadHeapCount) {}
+    ~StatsAllocations() {
+        if (stats) {
+            stats->heapBytes += threadHeapBytes - bytes;
+            stats->heapCount += threadHeapCount - count;
+        }
+    }
+private:
+    Stats* stats;
+    size_t bytes;
+    size_t count;
+#else
+    explicit StatsAllocations(Stats*) {}
+#endif
+};
+
+#ifndef BASM_NO_STATS
+/* 统计语法树中各类型的节点数 */
+static void countAstNodes(const AstNode* root, Stats& stats) {
+    for (const AstNode* node : AstPreorder(root)) {
+        const char* name = parser_get_node_type_name(node->type);
+        stats.nodes[name ? name : "#" + std::to_string(node->type)]++;
+    }
+}
+
+static void countAstFileNodes(const struct ast_file* file, Stats& stats) {
+    for (uint32_t i = 0; i < file->node_count; ++i) {
+        const struct ast_file_node* node = ast_file_get_node(file, i);
+        const char* name = ast_file_get_type_name(file, node);
+        stats.nodes[name ? name : "#" + std::to_string(node->type)]++;
+    }
+}
+#endif
+
+/* JSON字符串，转义引号、反斜杠和控制字符 */
+static std::string jsonString(const std::string& text) {
+    std::string out = "\"";
+    for (unsigned char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        } else {
+            out += (char)c;
+        }
+    }
+    return out + "\"";
+}
+
+/**
+ * 输出统计
+ * @param name 文件名，标准输入为空
+ * @param status 处理结果，0表示成功
+ */
+static void printStats(StatsFormat format, const std::string& name, int status, const Stats& stats, std::ostream& out) {
+    static const char* const phaseNames[StatsPhaseCount] = { "读取", "词法分析", "语法分析", "bscp求值" };
+    static const char* const phaseKeys[StatsPhaseCount] = { "read", "lex", "parse", "eval" };
+    static const char* const tokenKeys[LEX_TOKEN_TYPE_COUNT] = {
+        "word", "number", "string", "punctuation", "eol", "eof", "assembly", "unknown"
+    };
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    
+    char buffer[128];
+    if (format == StatsFormat::Json) {
+        std::ostringstream line;
+        line << "{\"file\":" << jsonString(name) << ",\"status\":" << status << ",\"phases\":{";
+        for (int i = 0; i < StatsPhaseCount; ++i) {
+            snprintf(buffer, sizeof(buffer), "%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}",
+                     i ? "," : "", phaseKeys[i], stats.wall[i] * 1e3, stats.cpu[i] * 1e3);
+            line << buffer;
+        }
+        line << "},\"tokens\":{";
+        for (int i = 0; i < LEX_TOKEN_TYPE_COUNT; ++i) {
+            line << (i ? "," : "") << "\"" << tokenKeys[i] << "\":" << stats.tokens[i];
+        }
+        line << "},\"nodes\":{";
+        bool first = true;
+        for (const auto& node : stats.nodes) {
+            line << (first ? "" : ",") << jsonString(node.first) << ":" << node.second;
+            first = false;
+        }
+        line << "},\"memory\":{\"heap_bytes\":" << stats.heapBytes << ",\"heap_allocations\":" << stats.heapCount
+             << ",\"arena_bytes\":" << stats.arenaBytes << ",\"atom_bytes\":" << stats.atomBytes
+             << ",\"peak_rss_kb\":" << usage.ru_maxrss << "}}\n";
+        out << line.str();
+        return;
+    }
+    
+    std::ostringstream text;
+    text << "===== 统计" << (name.empty() ? std::string() : ": " + name) << " =====\n";
+    for (int i = 0; i < StatsPhaseCount; ++i) {
+        snprintf(buffer, sizeof(buffer), "%s：墙钟 %.3f ms，CPU %.3f ms\n",
+                 phaseNames[i], stats.wall[i] * 1e3, stats.cpu[i] * 1e3);
+        text << buffer;
+    }
+    unsigned long total = 0;
+    text << "词法单元：";
+    for (int i = 0; i < LEX_TOKEN_TYPE_COUNT; ++i) {
+        text << tokenTypeName((enum lex_token_type)i) << " " << stats.tokens[i] << "，";
+        total += stats.tokens[i];
+    }
+    text << "合计 " << total << "\n";
+    total = 0;
+    text << "语法树节点：";
+    for (const auto& node : stats.nodes) {
+        text << node.first << " " << node.second << "，";
+        total += node.second;
+    }
+    text << "合计 " << total << "\n";
+    text << "内存：C++堆分配 " << stats.heapBytes << " 字节（" << stats.heapCount << " 次），语法树内存池 "
+         << stats.arenaBytes << " 字节，原子表 " << stats.atomBytes << " 字节，峰值常驻内存 "
+         << usage.ru_maxrss << " KiB\n";
+    out << text.str();
+}
+
 // 注意：预处理指令处理（如#include、#define、#rule等）
 // 现在由语法分析器负责处理，而不是词法分析器。
 // 词法分析器仅识别预处理指令作为标记并将其传递给语法分析器。
 
-// 主程序
-int main(int argc, char* argv[]) {
-    // 默认模式：仅词法分析
+// 命令行选项
+struct Options {
     ParseMode mode = ParseMode::Both;
-    std::string sourceCode;
-    std::string filename;
+    enum lex_engine engine = lex_engine_flex;
+    bool engineChosen = false;          // 命令行中明确指定了--lexer=flex或simd
+    bool diffEngines = false;
+    std::string emitAstFile;            // 语法分析成功后把语法树写成二进制格式
+    std::string loadAstFile;            // 直接读取二进制语法树，不做词法和语法分析
+    enum ast_print_format astFormat = ast_print_text;   // 输出语法树的格式
+    std::string cacheDir;               // 语法分析缓存目录，为空时不使用缓存
+    std::vector<std::string> files;     // 输入文件，为空时读取标准输入
+    unsigned jobs = 0;                  // 并行处理的线程数，0表示与CPU核数相同
+    unsigned lexThreads = 1;            // 单个文件词法分析的线程数，0表示与CPU核数相同
+    size_t pipeline = 0;                // 语法分析时词法分析线程的环形缓冲区容量，0表示串行分析
+    std::string serverSocket;           // 服务器模式监听的Unix域套接字，为空时不启动服务器
+    std::vector<std::string> watchDirs; // 服务器模式下监视的目录，文件写入后预先分析
+    StatsFormat stats = StatsFormat::None;  // 统计的输出格式
+    std::string statsFile;              // 统计追加到这个文件，为空时输出到标准错误
+    bool allocReport = false;           // 经计数分配器分配，结束时按分配位置报告内存使用
+    bool poolAllocator = false;         // 语法分析器和词法分析器使用线程局部的池分配器
+};
+
+// 每个工作线程独占的分析状态
+struct Worker {
+    struct parse_context* parser = nullptr;
+    struct parse_cache cache;
+    bool useCache = false;
+    Stats* stats = nullptr;             // 不为NULL时收集当前文件的统计
+    struct lex_counting_allocator counting;     // --alloc-report时语法分析器和词法分析器的分配器
+    bool countAllocations = false;
+    struct lex_allocator* base = nullptr;       // --allocator选择的分配器，nullptr表示默认分配器
     
-    // 解析命令行参数
-    for (int i = 1; i < argc; ++i) {
-        std::string arg = argv[i];
-        if (arg == "--lex" || arg == "-l") {
-            mode = ParseMode::LexOnly;
-        } else if (arg == "--parse" || arg == "-p") {
-            mode = ParseMode::ParseOnly;
-        } else if (arg == "--both" || arg == "-b") {
-            mode = ParseMode::Both;
-        } else {
-            // 假定是文件名
-            filename = arg;
+    Worker() noexcept {
+        memset(&cache, 0, sizeof(cache));
+        lex_counting_allocator_init(&counting, nullptr, nullptr);
+    }
+    
+    /* 这个线程的语法分析器和词法分析器使用的分配器，nullptr表示默认分配器 */
+    struct lex_allocator* allocator() noexcept {
+        return countAllocations ? &counting.base : base;
+    }
+    
+    Worker(const Worker&) = delete;
+    Worker& operator=(const Worker&) = delete;
+    
+    /**
+     * 创建语法分析器上下文，按需打开缓存
+     * @return true表示成功，false表示失败
+     */
+    bool init(const Options& options, std::ostream& err) noexcept {
+        countAllocations = options.allocReport;
+        if (options.poolAllocator) {
+            base = lex_allocator_pool();
+            // 计数分配器统计之后再交给池分配器
+            lex_counting_allocator_init(&counting, base, nullptr);
+        }
+        parser = parse_create_with_allocator(allocator());
+        if (!parser) {
+            err << "语法分析器初始化失败" << std::endl;
+            return false;
+        }
+        parse_set_engine_r(parser, options.engine);
+        if (options.pipeline && !parse_set_pipeline_r(parser, options.pipeline)) {
+            err << "流水线初始化失败，改为串行分析" << std::endl;
         }
+        if (!options.cacheDir.empty()) {
+            useCache = parse_cache_open(&cache, options.cacheDir.c_str()) != 0;
+            if (!useCache) {
+                err << "无法打开缓存目录: " << options.cacheDir << std::endl;
+            }
+        }
+        return true;
     }
     
-    // 从文件或标准输入读取源代码
-    if (!filename.empty()) {
-        sourceCode = readFileContent(filename);
-    } else {
-        std::stringstream buffer;
-        buffer << std::cin.rdbuf();
-        sourceCode = buffer.str();
+    ~Worker() noexcept {
+        parse_destroy(parser);
+        if (useCache) {
+            parse_cache_close(&cache);
+        }
+        lex_counting_allocator_destroy(&counting);
+    }
+};
+
+/**
+ * 读取responseFile中的文件名，每行一个，忽略空行
+ * @return true表示成功，false表示无法打开
+ */
+static bool readResponseFile(const std::string& path, std::vector<std::string>& files) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (!line.empty()) {
+            files.push_back(line);
+        }
+    }
+    return true;
+}
+
+/**
+ * 把语法树写成二进制文件
+ * @param data 缓存中已经是文件格式的语法树，root为NULL时原样写出
+ * @param root 刚分析出的语法树，不为NULL时忽略data
+ * @return true表示成功，false表示失败
+ */
+static bool writeAstFile(const std::string& path, const void* data, size_t size, const AstNode* root) {
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out) {
+        return false;
+    }
+    // 写入语法树时不传数据，空数据不能把NULL交给fwrite
+    bool written = root ? ast_file_write(root, out) != 0 : size == 0 || fwrite(data, 1, size, out) == size;
+    if (fclose(out) != 0) {
+        written = false;
+    }
+    return written;
+}
+
+/**
+ * 处理一个输入：词法分析、语法分析或两者都做
+ * @param options 命令行选项
+ * @param filename 文件名，为空时读取标准输入
+ * @param worker 当前线程的分析状态
+ * @param out 输出流
+ * @param err 错误输出流
+ * @return 0表示成功，1表示失败
+ */
+static int processFile(const Options& options, const std::string& filename, Worker& worker,
+                       std::ostream& out, std::ostream& err) {
+    const ParseMode mode = options.mode;
+    Stats* stats = worker.stats;
+    StatsAllocations allocations(stats);
+    CppSourceFile sourceCode;
+    
+    // 标准输入只需扫描一遍时按块流式读取，如 generator | main --lex，内存占用与输入大小无关
+    bool streaming = filename.empty() && mode != ParseMode::Both && !options.diffEngines;
+    
+    // 否则映射源文件或读取标准输入，之后的词法和语法分析都直接在这份内存上进行
+    {
+        StatsTimer timer(stats, StatsRead);
+        if (!filename.empty()) {
+            if (!sourceCode.open(filename)) {
+                err << "无法打开文件: " << filename << std::endl;
+                return 1;
+            }
+        } else if (!streaming && !sourceCode.read(stdin)) {
+            err << "读取标准输入失败" << std::endl;
+            return 1;
+        }
     }
     
-    if (sourceCode.empty()) {
-        std::cerr << "错误：没有源代码输入" << std::endl;
+    if (!streaming && sourceCode.empty()) {
+        err << "错误：没有源代码输入" << std::endl;
         return 1;
     }
     
+    // 差分测试两种词法分析引擎
+    if (options.diffEngines) {
+        int status = diffLexerEngines(sourceCode.data(), sourceCode.size(), out, err);
+        if (options.lexThreads != 1) {
+            unsigned threads = options.lexThreads ? options.lexThreads : std::max(1u, std::thread::hardware_concurrency());
+            status |= diffParallelLexer(sourceCode.data(), sourceCode.size(), threads, out, err);
+        }
+        return status;
+    }
+    
+    // 缓存以完整的源代码为键，流式输入不使用缓存
+    struct parse_cache* cache = worker.useCache && !streaming ? &worker.cache : nullptr;
+    struct parse_cache_token_list cachedTokens;
+    StatsTimer lexTimer(mode != ParseMode::ParseOnly ? stats : nullptr, StatsLex);
+    bool tokensCached = cache && mode != ParseMode::ParseOnly
+        && parse_cache_load_tokens(cache, sourceCode.data(), sourceCode.size(), &cachedTokens);
+    int status = 0;
+    
     // 根据模式执行相应的分析
-    if (mode == ParseMode::LexOnly || mode == ParseMode::Both) {
-        // 执行词法分析
-        CppLexTokenStream stream;
-        if (!stream.init(sourceCode)) {
-            std::cerr << "初始化词法分析器失败" << std::endl;
-            return 1;
+    if ((mode == ParseMode::LexOnly || mode == ParseMode::Both) && tokensCached) {
+        // 缓存命中，词法单元的文本直接取自源代码
+        out << "===== 词法分析开始 =====" << std::endl;
+        size_t count = 0;
+        for (size_t i = 0; i < cachedTokens.count; ++i) {
+            const struct parse_cache_token& token = cachedTokens.tokens[i];
+            if (token.offset > sourceCode.size() || token.size > sourceCode.size() - token.offset) {
+                break;
+            }
+            count++;
+#ifndef BASM_NO_STATS
+            if (stats && token.type < LEX_TOKEN_TYPE_COUNT) {
+                stats->tokens[token.type]++;
+            }
+#endif
+            out << "Token " << count << ":\t类型=" << tokenTypeName((enum lex_token_type)token.type);
+            if (token.type == lex_eof) {
+                out << '\n';
+            } else {
+                out << "\t内容=\"" << std::string_view(sourceCode.data() + token.offset, token.size) << "\"\n";
+            }
         }
-        
-        CppLexToken token;
-        int count = 0;
-        
-        std::cout << "===== 词法分析开始 =====" << std::endl;
-        
-        while (stream.next(token)) {
+        parse_cache_tokens_close(&cachedTokens);
+        out << "总共识别 " << count << " 个词法单元" << std::endl;
+        out << "===== 词法分析结束 =====" << std::endl;
+    } else if (mode == ParseMode::LexOnly || mode == ParseMode::Both) {
+        size_t count = 0;
+        std::vector<struct parse_cache_token> records;  // 写入缓存的词法单元
+        // 逐行输出不刷新缓冲区，避免每个词法单元一次系统调用
+        auto emitToken = [&](const struct lex_token& token, std::string_view text) {
             count++;
-            
-            // 根据词法标记类型输出不同的描述
-            std::string typeStr;
-            switch (token.type) {
-                case CppLexTokenType::Identifier:   typeStr = "标识符"; break;
-                case CppLexTokenType::Number:       typeStr = "数字"; break;
-                case CppLexTokenType::String:       typeStr = "字符串"; break;
-                case CppLexTokenType::Punctuation:  typeStr = "标点符号"; break;
-                case CppLexTokenType::Preprocessor: typeStr = "预处理指令"; break;
-                case CppLexTokenType::Eol:          typeStr = "行尾"; break;
-                case CppLexTokenType::Eof:          typeStr = "文件结束"; break;
-                case CppLexTokenType::Unknown:      typeStr = "未知"; break;
+#ifndef BASM_NO_STATS
+            if (stats) {
+                stats->tokens[token.type]++;
+            }
+#endif
+            if (cache) {
+                records.push_back({ (uint32_t)token.type, (uint32_t)token.raw_size, token.offset });
+            }
+            out << "Token " << count << ":\t类型=" << tokenTypeName(token.type);
+            if (token.type == lex_eof) {
+                out << '\n';
+            } else {
+                out << "\t内容=\"" << text << "\"\n";
+            }
+        };
+        
+        unsigned lexThreads = options.lexThreads ? options.lexThreads : std::max(1u, std::thread::hardware_concurrency());
+        if (lexThreads > 1 && !streaming) {
+            // 整个文件切块后多线程扫描，结果与串行扫描相同
+            struct lex_parallel_result result;
+            if (!lex_parallel_scan(sourceCode.data(), sourceCode.size(), lexThreads, &result)) {
+                err << "并行词法分析失败" << std::endl;
+                return 1;
+            }
+            out << "===== 词法分析开始 =====" << std::endl;
+            for (size_t i = 0; i < result.count; ++i) {
+                const struct lex_token& token = result.tokens[i];
+                emitToken(token, std::string_view(sourceCode.data() + token.offset, token.raw_size));
+            }
+            lex_parallel_free(&result);
+        } else {
+            // 执行词法分析，sourceCode在整个过程中有效，使用零拷贝的视图模式；
+            // 流式输入没有完整的源缓冲区，需要复制词法单元的文本
+            CppLexTokenStream stream(streaming ? lex_mode_owning : lex_mode_view);
+            stream.setEngine(options.engine);
+            stream.setAllocator(worker.allocator());
+            bool ok = streaming
+                ? stream.initFromFd(STDIN_FILENO)
+                : stream.init(sourceCode.data(), sourceCode.size());
+            if (!ok) {
+                err << "初始化词法分析器失败" << std::endl;
+                return 1;
             }
             
-            std::cout << "Token " << count << ":\t类型=" << typeStr;
+            struct lex_token tokens[LEX_TOKEN_BATCH_SIZE];
+            bool eof = false;
             
-            if (token.type == CppLexTokenType::Eof) {
-                std::cout << std::endl;
-                break;
-            } else {
-                std::cout << "\t内容=\"" << token.raw << "\"" << std::endl;
+            out << "===== 词法分析开始 =====" << std::endl;
+            
+            // 按批获取词法单元
+            while (!eof) {
+                size_t n = stream.nextBatch(tokens, LEX_TOKEN_BATCH_SIZE);
+                for (size_t i = 0; i < n; ++i) {
+                    emitToken(tokens[i], stream.text(tokens[i]));
+                    eof = eof || tokens[i].type == lex_eof;
+                }
+                stream.release(tokens, n);
+                if (n < LEX_TOKEN_BATCH_SIZE) {
+                    break;
+                }
             }
         }
         
-        std::cout << "总共识别 " << count << " 个词法单元" << std::endl;
-        std::cout << "===== 词法分析结束 =====" << std::endl;
+        out << "总共识别 " << count << " 个词法单元" << std::endl;
+        out << "===== 词法分析结束 =====" << std::endl;
+        
+        if (cache) {
+            parse_cache_store_tokens(cache, sourceCode.data(), sourceCode.size(), records.data(), records.size());
+        }
     }
+    lexTimer.stop();
     
-    if (mode == ParseMode::ParseOnly || mode == ParseMode::Both) {
+    StatsTimer parseTimer(mode != ParseMode::LexOnly ? stats : nullptr, StatsParse);
+    struct ast_file cachedAst;
+    if ((mode == ParseMode::ParseOnly || mode == ParseMode::Both)
+        && cache && parse_cache_load_ast(cache, sourceCode.data(), sourceCode.size(), &cachedAst)) {
+        // 缓存命中，跳过词法和语法分析
+        out << "===== 语法分析开始 =====" << std::endl;
+        out << "语法分析成功!" << std::endl;
+        out << "语法树：" << std::endl;
+        if (!ast_file_print(&cachedAst, options.astFormat, writeToStream, &out)) {
+            err << "缓存中的语法树已损坏" << std::endl;
+            status = 1;
+        }
+#ifndef BASM_NO_STATS
+        if (stats) {
+            countAstFileNodes(&cachedAst, *stats);
+        }
+#endif
+        if (!options.emitAstFile.empty()) {
+            // 缓存条目在文件头之后就是完整的二进制语法树，原样写出
+            const char* payload = (const char*)cachedAst.map + sizeof(struct parse_cache_header);
+            size_t payloadSize = cachedAst.map_size - sizeof(struct parse_cache_header);
+            if (!writeAstFile(options.emitAstFile, payload, payloadSize, nullptr)) {
+                err << "写入语法树文件失败: " << options.emitAstFile << std::endl;
+                status = 1;
+            }
+        }
+        ast_file_close(&cachedAst);
+        out << "===== 语法分析结束 =====" << std::endl;
+    } else if (mode == ParseMode::ParseOnly || mode == ParseMode::Both) {
         // 执行语法分析
-        std::cout << "===== 语法分析开始 =====" << std::endl;
-        if(parse_init(sourceCode.c_str(), sourceCode.length())){
-            std::cerr<< "语法分析器初始化失败"<<std::endl;
+        struct parse_context* parser = worker.parser;
+        out << "===== 语法分析开始 =====" << std::endl;
+        int failed = streaming
+            ? parse_init_with_fd_r(parser, STDIN_FILENO)
+            : parse_init_with_buffer_r(parser, sourceCode.data(), sourceCode.size());
+        if(failed){
+            err << "语法分析器初始化失败" << std::endl;
             return 1;
         }
-        if (!yyparse()) {
-            std::cout << "语法分析成功!" << std::endl;
+        parse_set_filename_r(parser, filename.empty() ? "<stdin>" : filename.c_str());
+        struct parse_stats parseStats;
+        memset(&parseStats, 0, sizeof(parseStats));
+        parse_set_stats_r(parser, stats ? &parseStats : nullptr);
+#ifndef BASM_NO_STATS
+        // 原子表属于工作线程的上下文，只计这个文件新加入的文本
+        size_t atomBytesBefore = lex_atom_bytes(parse_get_atoms_r(parser));
+#endif
+        if (!parse_r(parser)) {
+            out << "语法分析成功!" << std::endl;
             
             // 打印语法树
-            if (ast_root != NULL) {
-                std::cout << "语法树：" << std::endl;
-                print_ast(ast_root, 0);
+            AstNode* root = parse_get_root_r(parser);
+            if (root != NULL) {
+                out << "语法树：" << std::endl;
+                ast_print(root, options.astFormat, writeToStream, &out);
+#ifndef BASM_NO_STATS
+                if (stats) {
+                    countAstNodes(root, *stats);
+                }
+#endif
+                
+                if (cache) {
+                    parse_cache_store_ast(cache, sourceCode.data(), sourceCode.size(), root);
+                }
+                if (!options.emitAstFile.empty() && !writeAstFile(options.emitAstFile, nullptr, 0, root)) {
+                    err << "写入语法树文件失败: " << options.emitAstFile << std::endl;
+                    status = 1;
+                }
             } else {
-                std::cout << "警告：生成的语法树为空" << std::endl;
+                out << "警告：生成的语法树为空" << std::endl;
             }
         } else {
-            std::cerr << "语法分析失败" << std::endl;
+            err << "语法分析失败" << std::endl;
+            status = 1;
+        }
+        
+#ifndef BASM_NO_STATS
+        if (stats) {
+            // 同时做词法分析时词法单元已经统计过，只统计一遍
+            if (mode == ParseMode::ParseOnly) {
+                for (int i = 0; i < LEX_TOKEN_TYPE_COUNT; ++i) {
+                    stats->tokens[i] += parseStats.tokens[i];
+                }
+            }
+            stats->arenaBytes = parseStats.arena_bytes;
+            stats->atomBytes = lex_atom_bytes(parse_get_atoms_r(parser)) - atomBytesBefore;
         }
+#endif
+        parse_set_stats_r(parser, nullptr);
+        parse_set_filename_r(parser, nullptr);
         
-        // 清理资源
-        parse_cleanup();
+        // 清理资源，上下文留给下一个文件
+        parse_cleanup_r(parser);
         
-        std::cout << "===== 语法分析结束 =====" << std::endl;
+        out << "===== 语法分析结束 =====" << std::endl;
+    }
+    
+    return status;
+}
+
+/**
+ * 处理一个文件，输出和错误都收集到字符串中
+ * 语法错误先收集起来，和这个文件的其它错误一起给出
+ * @return 0表示成功，1表示失败
+ */
+static int processFileCollected(const Options& options, const std::string& filename, Worker& worker,
+                                std::string& out, std::string& err) {
+    std::ostringstream outStream;
+    std::ostringstream errStream;
+    int status = 1;
+    char* diagnostics = nullptr;
+    size_t diagnosticsSize = 0;
+    FILE* diagnosticsFile = open_memstream(&diagnostics, &diagnosticsSize);
+    if (worker.parser) {
+        parse_set_diagnostics_r(worker.parser, diagnosticsFile);
+        status = processFile(options, filename, worker, outStream, errStream);
+        parse_set_diagnostics_r(worker.parser, nullptr);
+    }
+    if (diagnosticsFile) {
+        fclose(diagnosticsFile);
+    }
+    out = outStream.str();
+    err = diagnostics ? std::string(diagnostics, diagnosticsSize) : std::string();
+    err += errStream.str();
+    free(diagnostics);
+    return status;
+}
+
+/**
+ * 按选项输出一个文件的统计，没有指定--stats时什么也不做
+ * 统计文件以追加方式打开，构建系统可以让多次运行写入同一个文件
+ */
+static void emitStats(const Options& options, const std::string& name, int status, const Stats& stats) {
+    if (options.stats == StatsFormat::None) {
+        return;
+    }
+    if (options.statsFile.empty()) {
+        printStats(options.stats, name, status, stats, std::cerr);
+        return;
+    }
+    std::ofstream file(options.statsFile, std::ios::app);
+    printStats(options.stats, name, status, stats, file);
+    if (!file) {
+        std::cerr << "写入统计文件失败: " << options.statsFile << std::endl;
+    }
+}
+
+/*
+ * 工作窃取线程池
+ * 任务预先按连续的区间分给各线程，线程从自己队列的头部取任务，
+ * 自己的队列空了就从其它线程队列的尾部窃取，文件大小不均时也能保持各核忙碌
+ */
+class WorkStealingPool {
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+    std::vector<Queue> queues;
+    
+    bool take(size_t self, size_t& task) {
+        {
+            std::lock_guard<std::mutex> guard(queues[self].lock);
+            if (!queues[self].tasks.empty()) {
+                task = queues[self].tasks.front();
+                queues[self].tasks.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); ++i) {
+            Queue& victim = queues[(self + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
     }
     
+public:
+    explicit WorkStealingPool(size_t threads) : queues(threads) {}
+    
+    /**
+     * 执行count个任务，返回时全部任务已完成
+     * 任务不会再产生新任务，所有队列都空时线程退出
+     * @param count 任务数
+     * @param init 在每个线程开始时调用，参数为线程编号
+     * @param run 执行任务，参数为线程编号和任务编号
+     */
+    template<typename Init, typename Run>
+    void run(size_t count, Init init, Run run) {
+        size_t threads = queues.size();
+        for (size_t i = 0; i < count; ++i) {
+            queues[i * threads / count].tasks.push_back(i);
+        }
+        std::vector<std::thread> pool;
+        for (size_t self = 0; self < threads; ++self) {
+            pool.emplace_back([this, self, &init, &run]() {
+                init(self);
+                size_t task;
+                while (take(self, task)) {
+                    run(self, task);
+                }
+            });
+        }
+        for (std::thread& thread : pool) {
+            thread.join();
+        }
+    }
+};
+
+/**
+ * 并行处理多个文件，输出按文件在命令行中的顺序给出
+ * @return 全部成功返回0，否则返回1
+ */
+static int processFiles(const Options& options) {
+    struct Result {
+        std::string out;
+        std::string err;
+        Stats stats;
+        int status = 0;
+        bool done = false;
+    };
+    const size_t count = options.files.size();
+    size_t threads = options.jobs ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, count);
+    
+    std::vector<Result> results(count);
+    std::vector<std::unique_ptr<Worker>> workers(threads);
+    std::mutex doneLock;
+    std::condition_variable doneSignal;
+    
+    WorkStealingPool pool(threads);
+    std::thread runner([&]() {
+        pool.run(count,
+            [&](size_t self) {
+                std::ostringstream err;
+                workers[self].reset(new Worker());
+                workers[self]->init(options, err);
+                if (!err.str().empty()) {
+                    std::lock_guard<std::mutex> guard(doneLock);
+                    std::cerr << err.str();
+                }
+            },
+            [&](size_t self, size_t task) {
+                std::string out;
+                std::string err;
+                Stats stats;
+                workers[self]->stats = options.stats != StatsFormat::None ? &stats : nullptr;
+                int status = processFileCollected(options, options.files[task], *workers[self], out, err);
+                workers[self]->stats = nullptr;
+                std::lock_guard<std::mutex> guard(doneLock);
+                results[task].out = std::move(out);
+                results[task].err = std::move(err);
+                results[task].stats = std::move(stats);
+                results[task].status = status;
+                results[task].done = true;
+                doneSignal.notify_one();
+            });
+    });
+    
+    // 按顺序输出已完成的文件，不必等全部文件处理完
+    int status = 0;
+    for (size_t i = 0; i < count; ++i) {
+        Result result;
+        {
+            std::unique_lock<std::mutex> guard(doneLock);
+            doneSignal.wait(guard, [&]() { return results[i].done; });
+            result = std::move(results[i]);
+        }
+        std::cout << "===== " << options.files[i] << " =====" << std::endl;
+        std::cout << result.out;
+        std::cout.flush();
+        if (!result.err.empty()) {
+            std::cerr << options.files[i] << ":" << std::endl << result.err;
+        }
+        emitStats(options, options.files[i], result.status, result.stats);
+        status |= result.status;
+    }
+    runner.join();
+    
+    unsigned long hits = 0, misses = 0, stores = 0, errors = 0;
+    for (const std::unique_ptr<Worker>& worker : workers) {
+        if (worker && worker->useCache) {
+            hits += worker->cache.hits;
+            misses += worker->cache.misses;
+            stores += worker->cache.stores;
+            errors += worker->cache.errors;
+        }
+    }
+    if (!options.cacheDir.empty()) {
+        std::cerr << "缓存：命中 " << hits << "，未命中 " << misses
+                  << "，写入 " << stores << "，错误 " << errors << std::endl;
+    }
+    if (options.allocReport) {
+        for (size_t i = 0; i < workers.size(); ++i) {
+            if (workers[i]) {
+                std::cerr << "===== 内存分配：线程 " << i << " =====" << std::endl;
+                lex_counting_allocator_report(&workers[i]->counting, stderr);
+            }
+        }
+    }
+    return status;
+}
+
+/*
+ * 服务器模式
+ * 在Unix域套接字上常驻，语法分析器上下文、缓存和bscp解释器状态在请求之间保留，
+ * 每个请求不再承担进程启动和初始化的开销。
+ *
+ * 请求每行一个：
+ *   lex <文件>      词法分析
+ *   parse <文件>    语法分析
+ *   both <文件>     词法和语法分析
+ *   eval <代码>     在常驻的bscp解释器中执行一行代码，之前定义的变量仍然可见
+ *   stats           输出缓存和请求计数
+ *   shutdown        关闭服务器
+ * 响应先是一行"<状态> <输出字节数> <错误字节数>"，之后紧跟输出和错误的内容。
+ * 文件路径相对于服务器的工作目录。
+ */
+#define SERVER_MAX_REQUEST (1 << 20)    // 单个请求的最大字节数，超过时断开连接
+#define SERVER_MAX_CLIENTS 64           // 同时连接的客户端数上限
+#define SERVER_RECV_SIZE 65536          // 每次从客户端读取的字节数
+
+// 服务器的常驻状态
+struct Server {
+    const Options& options;
+    Worker worker;
+    bscp_context script;
+    Stats stats;                        // --stats时累计所有请求的统计
+    unsigned long requests = 0;
+    unsigned long reparsed = 0;
+    bool running = true;
+    
+    explicit Server(const Options& options) : options(options) {}
+};
+
+/*
+ * 一个客户端连接
+ * 套接字是非阻塞的：响应先放入output，套接字写满时等POLLOUT再继续写，
+ * 不读取响应的客户端不会挡住其它客户端
+ */
+struct ServerClient {
+    int fd;
+    std::string input;                  // 已收到、还没有处理的请求
+    std::string output;                 // 还没有写出的响应
+    size_t sent = 0;                    // output中已经写出的字节数
+    
+    bool pending() const { return sent < output.size(); }
+};
+
+/**
+ * 把缓冲的响应尽量写入套接字，写满时留到下次POLLOUT
+ * @return true表示正常，false表示对方已断开
+ */
+static bool flushClient(ServerClient& client) {
+    while (client.pending()) {
+        ssize_t n = send(client.fd, client.output.data() + client.sent, client.output.size() - client.sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return true;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        client.sent += (size_t)n;
+    }
+    client.output.clear();
+    client.sent = 0;
+    return true;
+}
+
+/**
+ * 在常驻的bscp解释器中执行一行代码，回显和错误收集到字符串中
+ * @return 0表示成功，1表示失败
+ */
+static int serverEval(Server& server, const std::string& code, std::string& out, std::string& err) {
+    char* outData = nullptr;
+    size_t outSize = 0;
+    char* errData = nullptr;
+    size_t errSize = 0;
+    FILE* outFile = open_memstream(&outData, &outSize);
+    FILE* errFile = open_memstream(&errData, &errSize);
+    int status = 1;
+    if (outFile && errFile) {
+        server.script.out = outFile;
+        server.script.diagnostics = errFile;
+        // 语句以换行结束，同样的代码命中程序缓存
+        std::string line = code + '\n';
+        StatsTimer timer(server.worker.stats, StatsEval);
+        StatsAllocations allocations(server.worker.stats);
+        status = bscp_eval(&server.script, line.data(), line.size());
+        server.script.out = stdout;
+        server.script.diagnostics = stderr;
+    }
+    if (outFile) {
+        fclose(outFile);
+    }
+    if (errFile) {
+        fclose(errFile);
+    }
+    out = outData ? std::string(outData, outSize) : std::string();
+    err = errData ? std::string(errData, errSize) : std::string();
+    free(outData);
+    free(errData);
+    return status;
+}
+
+/**
+ * 处理一个请求，响应追加到response
+ */
+static void serveRequest(Server& server, const std::string& request, std::string& response) {
+    std::string command = request.substr(0, request.find(' '));
+    std::string argument = command.size() < request.size() ? request.substr(command.size() + 1) : std::string();
+    std::string out;
+    std::string err;
+    int status = 0;
+    
+    server.requests++;
+    if (command == "lex" || command == "parse" || command == "both") {
+        Options options = server.options;
+        options.mode = command == "lex" ? ParseMode::LexOnly
+                     : command == "parse" ? ParseMode::ParseOnly : ParseMode::Both;
+        if (argument.empty()) {
+            // 空文件名表示标准输入，服务器不能读取
+            err = "缺少文件名\n";
+            status = 1;
+        } else {
+            status = processFileCollected(options, argument, server.worker, out, err);
+        }
+    } else if (command == "eval") {
+        status = serverEval(server, argument, out, err);
+    } else if (command == "stats") {
+        const struct parse_cache& cache = server.worker.cache;
+        std::ostringstream stats;
+        stats << "请求 " << server.requests << "\n"
+              << "预先分析 " << server.reparsed << "\n"
+              << "缓存：命中 " << cache.hits << "，未命中 " << cache.misses
+              << "，写入 " << cache.stores << "，错误 " << cache.errors << "\n"
+              << "bscp程序缓存：命中 " << server.script.programs->hits
+              << "，未命中 " << server.script.programs->misses << "\n"
+              << "bscp堆：" << server.script.heap.count << " 个值，上次回收后存活 " << server.script.heap.live_bytes
+              << " 字节，标记-清除 " << server.script.heap.collections << " 次，累计释放 "
+              << server.script.heap.freed << " 个值\n";
+        if (server.options.stats != StatsFormat::None) {
+            printStats(server.options.stats, std::string(), 0, server.stats, stats);
+        }
+        out = stats.str();
+    } else if (command == "shutdown") {
+        server.running = false;
+    } else {
+        err = "未知的请求: " + command + "\n";
+        status = 1;
+    }
+    
+    response += std::to_string(status) + " " + std::to_string(out.size()) + " " + std::to_string(err.size()) + "\n";
+    response += out;
+    response += err;
+}
+
+#ifdef __linux__
+/**
+ * 监视目录及其子目录中文件的写入
+ * @param watches 监视描述符到目录的映射
+ */
+static void watchDirectory(int inotifyFd, const std::string& dir, std::unordered_map<int, std::string>& watches) {
+    int wd = inotify_add_watch(inotifyFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+    if (wd < 0) {
+        std::cerr << "无法监视目录: " << dir << std::endl;
+        return;
+    }
+    watches[wd] = dir;
+    DIR* handle = opendir(dir.c_str());
+    if (!handle) {
+        return;
+    }
+    while (struct dirent* entry = readdir(handle)) {
+        if (entry->d_type == DT_DIR && entry->d_name[0] != '.') {
+            watchDirectory(inotifyFd, dir + "/" + entry->d_name, watches);
+        }
+    }
+    closedir(handle);
+}
+
+/**
+ * 处理目录监视事件，重新分析写入完成的文件，下次请求时直接命中缓存
+ * 隐藏文件和以'~'结尾的文件通常是编辑器的临时文件，忽略
+ */
+static void handleWatchEvents(Server& server, int inotifyFd, std::unordered_map<int, std::string>& watches) {
+    alignas(struct inotify_event) char buffer[4096];
+    ssize_t size;
+    while ((size = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+        for (char* p = buffer; p < buffer + size; ) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + event->len;
+            auto dir = watches.find(event->wd);
+            if (dir == watches.end() || event->len == 0 || event->name[0] == '.') {
+                continue;
+            }
+            std::string path = dir->second + "/" + event->name;
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & IN_CREATE) {
+                    watchDirectory(inotifyFd, path, watches);
+                }
+                continue;
+            }
+            if (!(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) || path.back() == '~') {
+                continue;
+            }
+            std::string out;
+            std::string err;
+            processFileCollected(server.options, path, server.worker, out, err);
+            server.reparsed++;
+        }
+    }
+}
+#endif
+
+/**
+ * 运行服务器，直到收到shutdown请求
+ * 单线程事件循环，请求按到达顺序依次处理，所有请求共用同一份常驻状态；
+ * 一个客户端的响应还没有写完时暂停读取它的请求，其它客户端照常处理
+ * @return 0表示正常退出，1表示启动失败
+ */
+static int runServer(const Options& options) {
+    Server server(options);
+    if (!server.worker.init(options, std::cerr)) {
+        return 1;
+    }
+    if (!server.script.lexer || !server.script.atoms) {
+        std::cerr << "bscp解释器初始化失败" << std::endl;
+        return 1;
+    }
+    server.script.echo = true;
+    if (options.stats != StatsFormat::None) {
+        server.worker.stats = &server.stats;
+    }
+    
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (options.serverSocket.size() >= sizeof(address.sun_path)) {
+        std::cerr << "套接字路径过长: " << options.serverSocket << std::endl;
+        return 1;
+    }
+    memcpy(address.sun_path, options.serverSocket.c_str(), options.serverSocket.size());
+    
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) {
+        std::cerr << "无法创建套接字" << std::endl;
+        return 1;
+    }
+    // 上次异常退出可能留下套接字文件
+    unlink(options.serverSocket.c_str());
+    if (bind(listenFd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, SOMAXCONN) != 0) {
+        std::cerr << "无法监听套接字: " << options.serverSocket << std::endl;
+        close(listenFd);
+        return 1;
+    }
+    
+    int inotifyFd = -1;
+    std::unordered_map<int, std::string> watches;
+#ifdef __linux__
+    if (!options.watchDirs.empty()) {
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd < 0) {
+            std::cerr << "无法监视目录" << std::endl;
+        }
+        for (size_t i = 0; inotifyFd >= 0 && i < options.watchDirs.size(); ++i) {
+            watchDirectory(inotifyFd, options.watchDirs[i], watches);
+        }
+    }
+#endif
+    
+    std::vector<ServerClient> clients;
+    std::vector<struct pollfd> fds;
+    
+    std::cerr << "服务器已启动: " << options.serverSocket << std::endl;
+    while (server.running) {
+        fds.clear();
+        fds.push_back({ listenFd, POLLIN, 0 });
+        fds.push_back({ inotifyFd, POLLIN, 0 });    // 负数的描述符被poll忽略
+        for (const ServerClient& client : clients) {
+            fds.push_back({ client.fd, (short)(client.pending() ? POLLOUT : POLLIN), 0 });
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        
+#ifdef __linux__
+        // 先处理文件变化，之后的请求能用上刚写入的缓存
+        if (fds[1].revents & POLLIN) {
+            handleWatchEvents(server, inotifyFd, watches);
+        }
+#endif
+        
+        // 处理请求，fds中客户端的顺序与clients一致
+        size_t kept = 0;
+        for (size_t i = 0; i < clients.size(); ++i) {
+            ServerClient& client = clients[i];
+            short revents = fds[i + 2].revents;
+            bool alive = true;
+            if (revents & POLLOUT) {
+                alive = flushClient(client);
+            } else if (revents & (POLLIN | POLLHUP | POLLERR)) {
+                char buffer[SERVER_RECV_SIZE];
+                ssize_t n = recv(client.fd, buffer, sizeof(buffer), 0);
+                if (n > 0) {
+                    client.input.append(buffer, (size_t)n);
+                } else if (n == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    alive = false;
+                }
+            }
+            // 响应写完之后才处理下一个请求，响应按请求的顺序写出
+            size_t start = 0;
+            size_t end;
+            while (alive && server.running && !client.pending()
+                   && (end = client.input.find('\n', start)) != std::string::npos) {
+                std::string request = client.input.substr(start, end - start);
+                if (!request.empty() && request.back() == '\r') {
+                    request.pop_back();
+                }
+                start = end + 1;
+                if (!request.empty()) {
+                    serveRequest(server, request, client.output);
+                    alive = flushClient(client);
+                }
+            }
+            client.input.erase(0, start);
+            // 只限制还没有收到换行的请求，暂停期间排队的完整请求不算
+            if (client.input.size() > SERVER_MAX_REQUEST && client.input.find('\n') == std::string::npos) {
+                alive = false;
+            }
+            if (alive) {
+                // 自身移动赋值会清空input，还没收到换行的请求就丢了
+                if (kept != i) {
+                    clients[kept] = std::move(client);
+                }
+                kept++;
+            } else {
+                close(client.fd);
+            }
+        }
+        clients.resize(kept);
+        
+        if ((fds[0].revents & POLLIN) && server.running) {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (fd >= 0 && clients.size() < SERVER_MAX_CLIENTS) {
+                clients.push_back({ fd, std::string(), std::string() });
+            } else if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+    
+    // shutdown的响应尽量写出，不等待不读取的客户端
+    for (ServerClient& client : clients) {
+        flushClient(client);
+        close(client.fd);
+    }
+    if (inotifyFd >= 0) {
+        close(inotifyFd);
+    }
+    close(listenFd);
+    unlink(options.serverSocket.c_str());
     return 0;
 }
+
+// 主程序
+int main(int argc, char* argv[]) {
+    Options options;
+    
+    // 解析命令行参数
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--lexer=", 0) == 0) {
+            std::string name = arg.substr(8);
+            if (name == "flex") {
+                options.engine = lex_engine_flex;
+                options.engineChosen = true;
+            } else if (name == "simd") {
+                options.engine = lex_engine_simd;
+                options.engineChosen = true;
+            } else if (name == "diff") {
+                options.diffEngines = true;
+            } else {
+                std::cerr << "未知的词法分析引擎: " << name << std::endl;
+                return 1;
+            }
+        } else if (arg.rfind("--emit-ast=", 0) == 0) {
+            options.emitAstFile = arg.substr(11);
+        } else if (arg.rfind("--load-ast=", 0) == 0) {
+            options.loadAstFile = arg.substr(11);
+        } else if (arg.rfind("--ast-format=", 0) == 0) {
+            std::string format = arg.substr(13);
+            if (format == "text") {
+                options.astFormat = ast_print_text;
+            } else if (format == "json") {
+                options.astFormat = ast_print_json;
+            } else {
+                std::cerr << "未知的语法树格式: " << format << std::endl;
+                return 1;
+            }
+        } else if (arg.rfind("--cache-dir=", 0) == 0) {
+            options.cacheDir = arg.substr(12);
+        } else if (arg == "--stats" || arg.rfind("--stats=", 0) == 0) {
+#ifdef BASM_NO_STATS
+            std::cerr << "编译时关闭了统计功能（BASM_NO_STATS）" << std::endl;
+            return 1;
+#endif
+            std::string format = arg.size() > 8 ? arg.substr(8) : "text";
+            if (format == "text") {
+                options.stats = StatsFormat::Text;
+            } else if (format == "json") {
+                options.stats = StatsFormat::Json;
+            } else {
+                std::cerr << "未知的统计格式: " << format << std::endl;
+                return 1;
+            }
+        } else if (arg == "--alloc-report") {
+            options.allocReport = true;
+        } else if (arg.rfind("--allocator=", 0) == 0) {
+            std::string allocator = arg.substr(12);
+            if (allocator == "default") {
+                options.poolAllocator = false;
+            } else if (allocator == "pool") {
+                options.poolAllocator = true;
+            } else {
+                std::cerr << "未知的分配器: " << allocator << std::endl;
+                return 1;
+            }
+        } else if (arg.rfind("--stats-file=", 0) == 0) {
+            options.statsFile = arg.substr(13);
+        } else if (arg.rfind("--server=", 0) == 0) {
+            options.serverSocket = arg.substr(9);
+        } else if (arg.rfind("--watch=", 0) == 0) {
+            options.watchDirs.push_back(arg.substr(8));
+        } else if (arg.rfind("--jobs=", 0) == 0) {
+            options.jobs = (unsigned)strtoul(arg.c_str() + 7, nullptr, 10);
+        } else if (arg.rfind("--lex-threads=", 0) == 0) {
+            options.lexThreads = (unsigned)strtoul(arg.c_str() + 14, nullptr, 10);
+        } else if (arg == "--pipeline" || arg.rfind("--pipeline=", 0) == 0) {
+            options.pipeline = arg.size() > 11 ? (size_t)strtoull(arg.c_str() + 11, nullptr, 10) : LEX_RING_DEFAULT_CAPACITY;
+        } else if (arg == "--lex" || arg == "-l") {
+            options.mode = ParseMode::LexOnly;
+        } else if (arg == "--parse" || arg == "-p") {
+            options.mode = ParseMode::ParseOnly;
+        } else if (arg == "--both" || arg == "-b") {
+            options.mode = ParseMode::Both;
+        } else if (arg.size() > 1 && arg[0] == '@') {
+            // 从响应文件读取文件列表
+            if (!readResponseFile(arg.substr(1), options.files)) {
+                std::cerr << "无法打开响应文件: " << arg.substr(1) << std::endl;
+                return 1;
+            }
+        } else {
+            // 假定是文件名
+            options.files.push_back(arg);
+        }
+    }
+    
+    // 并行词法分析只有SIMD引擎的实现，不能静默地替换明确要求的flex
+    if (options.lexThreads != 1 && options.engineChosen && options.engine == lex_engine_flex) {
+        std::cerr << "--lex-threads总是使用simd引擎，不能与--lexer=flex同用" << std::endl;
+        return 1;
+    }
+    
+#ifndef BASM_NO_STATS
+    // 没有--stats时C++堆分配不计数，之后才会启动工作线程
+    statsHeapEnabled = options.stats != StatsFormat::None;
+#endif
+    
+    // 读取之前保存的语法树，映射后直接使用
+    if (!options.loadAstFile.empty()) {
+        struct ast_file file;
+        if (!ast_file_open(&file, options.loadAstFile.c_str())) {
+            std::cerr << "无法读取语法树文件: " << options.loadAstFile << std::endl;
+            return 1;
+        }
+        std::cout << "语法树：" << file.node_count << " 个节点" << std::endl;
+        int ok = ast_file_print(&file, options.astFormat, writeToStream, &std::cout);
+        ast_file_close(&file);
+        if (!ok) {
+            std::cerr << "语法树文件已损坏: " << options.loadAstFile << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    
+    if (!options.serverSocket.empty()) {
+        // 预先分析的结果只能通过缓存交给之后的请求
+        if (!options.watchDirs.empty() && options.cacheDir.empty()) {
+            std::cerr << "--watch需要同时指定--cache-dir" << std::endl;
+            return 1;
+        }
+        return runServer(options);
+    }
+    
+    if (options.files.size() > 1) {
+        if (!options.emitAstFile.empty()) {
+            std::cerr << "--emit-ast只能用于单个输入文件" << std::endl;
+            return 1;
+        }
+        return processFiles(options);
+    }
+    
+    // 单个文件或标准输入，直接在主线程处理
+    Worker worker;
+    if (!worker.init(options, std::cerr)) {
+        return 1;
+    }
+    Stats stats;
+    worker.stats = options.stats != StatsFormat::None ? &stats : nullptr;
+    const std::string filename = options.files.empty() ? std::string() : options.files[0];
+    int status = processFile(options, filename, worker, std::cout, std::cerr);
+    emitStats(options, filename, status, stats);
+    if (worker.useCache) {
+        std::cerr << "缓存：命中 " << worker.cache.hits << "，未命中 " << worker.cache.misses
+                  << "，写入 " << worker.cache.stores << "，错误 " << worker.cache.errors << std::endl;
+    }
+    if (options.allocReport) {
+        std::cerr << "===== 内存分配 =====" << std::endl;
+        lex_counting_allocator_report(&worker.counting, stderr);
+    }
+    return status;
+}
@@ -0,0 +1,262 @@
+#include "parser.h"
+
+#include <string.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* 各段的对齐要求 */
+#define AST_FILE_ALIGN 8
+
+/* 顺序写入的输出，记录已写的字节数以便计算各段的偏移 */
+class AstFileWriter {
+    public:
+        AstFileWriter(FILE* out): out(out), written(0), failed(false) {}
+
+        void write(const void* data, size_t size){
+            if(size == 0 || failed) return;
+            if(fwrite(data, 1, size, out) != size){
+                failed = true;
+            }
+            written += size;
+        }
+        /* 用'\0'填充到对齐位置 */
+        void align(){
+            static const char zero[AST_FILE_ALIGN] = {};
+            size_t padding = (AST_FILE_ALIGN - written % AST_FILE_ALIGN) % AST_FILE_ALIGN;
+            write(zero, padding);
+        }
+        uint64_t offset() const { return written; }
+        bool ok() const { return !failed; }
+    private:
+        FILE* out;
+        uint64_t written;
+        bool failed;
+};
+
+/* 字符串去重表，字符串视图指向语法树内存池，在写入期间有效 */
+class AstFileStrings {
+    public:
+        /* 下标、偏移和长度超出32位时返回AST_FILE_NONE并记下overflow */
+        uint32_t intern(std::string_view str){
+            auto it = index.find(str);
+            if(it != index.end()){
+                return it->second;
+            }
+            if(entries.size() >= AST_FILE_NONE || data.size() > UINT32_MAX || str.size() > UINT32_MAX){
+                overflow = true;
+                return AST_FILE_NONE;
+            }
+            uint32_t id = (uint32_t)entries.size();
+            entries.push_back({(uint32_t)data.size(), (uint32_t)str.size()});
+            data.append(str);
+            data.push_back('\0');
+            index.emplace(str, id);
+            return id;
+        }
+
+        std::vector<struct ast_file_string> entries;
+        std::string data;
+        bool overflow = false;
+    private:
+        std::unordered_map<std::string_view, uint32_t> index;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int ast_file_write(const AstNode* root, FILE* out){
+    if(root == nullptr || out == nullptr){
+        return 0;
+    }
+
+    AstFileWriter writer(out);
+    AstFileStrings strings;
+    struct ast_file_footer footer;
+    memset(&footer, 0, sizeof(footer));
+
+    struct ast_file_header header;
+    memcpy(header.magic, AST_FILE_MAGIC, sizeof(header.magic));
+    header.version = AST_FILE_VERSION;
+    writer.write(&header, sizeof(header));
+
+    // 广度优先遍历，队列本身就是节点的输出顺序：
+    // 处理到一个节点时，它的子节点恰好被追加到队尾连续的位置
+    writer.align();
+    footer.nodes_offset = writer.offset();
+    std::vector<std::pair<const AstNode*, uint32_t>> queue;
+    queue.emplace_back(root, AST_FILE_NONE);
+    for(size_t i = 0; i < queue.size(); i++){
+        const AstNode* node = queue[i].first;
+        // 节点下标和数目都是32位，AST_FILE_NONE保留给没有父节点的根，超出时写出的偏移读取方无法识别
+        if(node->child.size() > AST_FILE_NONE - queue.size()){
+            return 0;
+        }
+        struct ast_file_node record;
+        record.type = (uint32_t)node->type;
+        record.value = node->value ? strings.intern(node->value) : AST_FILE_NONE;
+        if(strings.overflow){
+            return 0;
+        }
+        record.parent = queue[i].second;
+        record.first_child = (uint32_t)queue.size();
+        record.child_count = (uint32_t)node->child.size();
+        for(AstNode* child : node->child){
+            queue.emplace_back(child, (uint32_t)i);
+        }
+        writer.write(&record, sizeof(record));
+    }
+    footer.node_count = (uint32_t)queue.size();
+
+    // 类型表：类型ID到类型名的映射，读取方据此换算成自己的类型ID
+    writer.align();
+    footer.types_offset = writer.offset();
+    footer.type_count = (uint32_t)parser_get_node_type_count();
+    for(uint32_t type = 0; type < footer.type_count; type++){
+        // 其它线程刚分配、尚未发布的类型暂时没有名称
+        const char* type_name = parser_get_node_type_name(type);
+        uint32_t name = strings.intern(type_name ? type_name : "");
+        if(strings.overflow){
+            return 0;
+        }
+        writer.write(&name, sizeof(name));
+    }
+
+    writer.align();
+    footer.strings_offset = writer.offset();
+    footer.string_count = (uint32_t)strings.entries.size();
+    writer.write(strings.entries.data(), strings.entries.size() * sizeof(struct ast_file_string));
+
+    writer.align();
+    footer.string_data_offset = writer.offset();
+    footer.string_data_size = strings.data.size();
+    writer.write(strings.data.data(), strings.data.size());
+
+    writer.align();
+    footer.root = 0;
+    memcpy(footer.magic, AST_FILE_MAGIC, sizeof(footer.magic));
+    footer.version = AST_FILE_VERSION;
+    writer.write(&footer, sizeof(footer));
+
+    return writer.ok() && fflush(out) == 0;
+}
+
+/* 检查一段数据是否完整地落在文件之内 */
+static bool ast_file_section_ok(size_t size, uint64_t offset, uint64_t count, size_t item_size){
+    return offset <= size && offset % AST_FILE_ALIGN == 0 && count <= (size - offset) / item_size;
+}
+
+int ast_file_load(struct ast_file* file, const void* data, size_t size){
+    memset(file, 0, sizeof(*file));
+
+    // 只检查文件头、文件尾和各段的边界，节点内容在访问时检查
+    if(size < sizeof(struct ast_file_header) + sizeof(struct ast_file_footer)){
+        return 0;
+    }
+    const char* base = (const char*)data;
+    const struct ast_file_header* header = (const struct ast_file_header*)base;
+    const struct ast_file_footer* footer =
+        (const struct ast_file_footer*)(base + size - sizeof(struct ast_file_footer));
+    if(memcmp(header->magic, AST_FILE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != AST_FILE_VERSION
+        || memcmp(footer->magic, AST_FILE_MAGIC, sizeof(footer->magic)) != 0
+        || footer->version != AST_FILE_VERSION){
+        return 0;
+    }
+    size_t body = size - sizeof(struct ast_file_footer);
+    if(!ast_file_section_ok(body, footer->nodes_offset, footer->node_count, sizeof(struct ast_file_node))
+        || !ast_file_section_ok(body, footer->types_offset, footer->type_count, sizeof(uint32_t))
+        || !ast_file_section_ok(body, footer->strings_offset, footer->string_count, sizeof(struct ast_file_string))
+        || !ast_file_section_ok(body, footer->string_data_offset, footer->string_data_size, 1)
+        || footer->node_count == 0){
+        return 0;
+    }
+
+    file->nodes = (const struct ast_file_node*)(base + footer->nodes_offset);
+    file->node_count = footer->node_count;
+    file->types = (const uint32_t*)(base + footer->types_offset);
+    file->type_count = footer->type_count;
+    file->strings = (const struct ast_file_string*)(base + footer->strings_offset);
+    file->string_count = footer->string_count;
+    file->string_data = base + footer->string_data_offset;
+    file->string_data_size = footer->string_data_size;
+    return 1;
+}
+
+int ast_file_open(struct ast_file* file, const char* filename){
+    memset(file, 0, sizeof(*file));
+
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0){
+        return 0;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0){
+        close(fd);
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED){
+        return 0;
+    }
+    if(!ast_file_load(file, map, size)){
+        munmap(map, size);
+        return 0;
+    }
+    file->map = map;
+    file->map_size = size;
+    return 1;
+}
+
+void ast_file_close(struct ast_file* file){
+    if(file->map){
+        munmap(file->map, file->map_size);
+    }
+    memset(file, 0, sizeof(*file));
+}
+
+const struct ast_file_node* ast_file_get_node(const struct ast_file* file, uint32_t index){
+    return index < file->node_count ? &file->nodes[index] : NULL;
+}
+
+const struct ast_file_node* ast_file_get_child(const struct ast_file* file, const struct ast_file_node* node, uint32_t i){
+    if(i >= node->child_count){
+        return NULL;
+    }
+    return ast_file_get_node(file, node->first_child + i);
+}
+
+/* 获取字符串表中的字符串，越界或缺少结尾的'\0'时返回NULL */
+static const char* ast_file_get_string(const struct ast_file* file, uint32_t index){
+    if(index >= file->string_count){
+        return NULL;
+    }
+    const struct ast_file_string* str = &file->strings[index];
+    if((uint64_t)str->offset + str->length >= file->string_data_size
+        || file->string_data[str->offset + str->length] != '\0'){
+        return NULL;
+    }
+    return file->string_data + str->offset;
+}
+
+const char* ast_file_get_value(const struct ast_file* file, const struct ast_file_node* node){
+    return node->value == AST_FILE_NONE ? NULL : ast_file_get_string(file, node->value);
+}
+
+const char* ast_file_get_type_name(const struct ast_file* file, const struct ast_file_node* node){
+    return node->type < file->type_count ? ast_file_get_string(file, file->types[node->type]) : NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
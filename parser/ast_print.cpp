@@ -0,0 +1,258 @@
+#include "parser.h"
+
+#include <string.h>
+
+/*
+ * 语法树的文本和JSON输出
+ * 内存中的语法树和二进制语法树文件共用同一套输出格式，
+ * 缓存命中时输出的文本与重新分析时完全相同
+ */
+
+/* 带缓冲的输出，缓冲区满或结束时才调用写回调 */
+class AstPrintSink {
+    public:
+        AstPrintSink(ast_print_write_fn write, void* user): write(write), user(user), used(0), failed(false) {}
+
+        void put(char c){
+            if(used == sizeof(buffer)){
+                flush();
+            }
+            buffer[used++] = c;
+        }
+        void append(const char* data, size_t size){
+            if(size > sizeof(buffer) - used){
+                flush();
+                if(size > sizeof(buffer)){
+                    // 超过缓冲区的长文本直接写出
+                    emit(data, size);
+                    return;
+                }
+            }
+            memcpy(buffer + used, data, size);
+            used += size;
+        }
+        void append(const char* text){
+            append(text, strlen(text));
+        }
+        void indent(size_t level){
+            for(size_t i = 0; i < level * 2; i++){
+                put(' ');
+            }
+        }
+        void number(uint64_t value){
+            char digits[24];
+            size_t n = 0;
+            do{
+                digits[n++] = (char)('0' + value % 10);
+                value /= 10;
+            }while(value != 0);
+            while(n > 0){
+                put(digits[--n]);
+            }
+        }
+        /* 加引号并转义的JSON字符串，0x80以上的字节原样输出 */
+        void json_string(const char* text){
+            static const char hex[] = "0123456789abcdef";
+            put('"');
+            for(const unsigned char* p = (const unsigned char*)text; *p; p++){
+                unsigned char c = *p;
+                if(c == '"' || c == '\\'){
+                    put('\\');
+                    put((char)c);
+                }else if(c == '\n'){
+                    append("\\n", 2);
+                }else if(c == '\t'){
+                    append("\\t", 2);
+                }else if(c == '\r'){
+                    append("\\r", 2);
+                }else if(c < 0x20){
+                    append("\\u00", 4);
+                    put(hex[c >> 4]);
+                    put(hex[c & 0xF]);
+                }else{
+                    put((char)c);
+                }
+            }
+            put('"');
+        }
+        /* 写出缓冲区中的全部内容，返回false表示回调出错 */
+        bool finish(){
+            flush();
+            return !failed;
+        }
+    private:
+        ast_print_write_fn write;
+        void* user;
+        size_t used;
+        bool failed;
+        char buffer[AST_PRINT_BUFFER_SIZE];
+
+        void emit(const char* data, size_t size){
+            if(!failed && size > 0 && write(user, data, size) != size){
+                failed = true;
+            }
+        }
+        void flush(){
+            emit(buffer, used);
+            used = 0;
+        }
+};
+
+/*
+ * 输出进入一个节点时的内容
+ * @param type 类型名，未知类型为NULL
+ * @param first 是否为父节点的第一个子节点（根节点也算），JSON据此决定是否加逗号
+ */
+static void ast_print_enter(AstPrintSink& sink, enum ast_print_format format, size_t depth,
+                            const char* type, uint64_t type_id, const char* value, bool has_children, bool first){
+    if(format == ast_print_text){
+        sink.indent(depth);
+        if(type){
+            sink.append(type);
+        }else{
+            sink.put('#');
+            sink.number(type_id);
+        }
+        if(value){
+            sink.put('\t');
+            sink.append(value);
+        }
+        sink.put('\n');
+        return;
+    }
+    if(!first){
+        sink.put(',');
+    }
+    sink.append("{\"type\":", 8);
+    if(type){
+        sink.json_string(type);
+    }else{
+        sink.append("\"#", 2);
+        sink.number(type_id);
+        sink.put('"');
+    }
+    if(value){
+        sink.append(",\"value\":", 9);
+        sink.json_string(value);
+    }
+    if(has_children){
+        sink.append(",\"children\":[", 13);
+    }else{
+        sink.put('}');
+    }
+}
+
+/* 输出离开一个节点时的内容，只有JSON格式中带子节点的节点需要闭合 */
+static void ast_print_leave(AstPrintSink& sink, enum ast_print_format format, bool has_children){
+    if(format == ast_print_json && has_children){
+        sink.append("]}", 2);
+    }
+}
+
+/* 输出内存中的语法树，base_level为根节点的缩进层级 */
+static int ast_print_tree(const AstNode* root, enum ast_print_format format, size_t base_level,
+                          ast_print_write_fn write, void* user){
+    // 缓冲区放在堆上，工作线程的栈不必为它留出空间
+    AstPrintSink* sink = new AstPrintSink(write, user);
+    for(AstWalker walker(root); !walker.done(); walker.next()){
+        const AstNode* node = walker.current();
+        bool has_children = !node->child.empty();
+        if(walker.is_enter()){
+            ast_print_enter(*sink, format, base_level + walker.depth(), parser_get_node_type_name(node->type),
+                            node->type, node->value, has_children, node == root || node->index == 0);
+        }else{
+            ast_print_leave(*sink, format, has_children);
+        }
+    }
+    if(format == ast_print_json && root != nullptr){
+        sink->put('\n');
+    }
+    bool ok = sink->finish();
+    delete sink;
+    return ok ? 1 : 0;
+}
+
+static size_t ast_print_write_file(void* user, const char* data, size_t size){
+    return fwrite(data, 1, size, (FILE*)user);
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int ast_print(const AstNode* root, enum ast_print_format format, ast_print_write_fn write, void* user){
+    return ast_print_tree(root, format, 0, write, user);
+}
+
+int ast_print_file(const AstNode* root, enum ast_print_format format, FILE* out){
+    return ast_print_tree(root, format, 0, ast_print_write_file, out);
+}
+
+void print_ast(AstNode* node, int level){
+    ast_print_tree(node, ast_print_text, level > 0 ? (size_t)level : 0, ast_print_write_file, stdout);
+}
+
+int ast_file_print(const struct ast_file* file, enum ast_print_format format, ast_print_write_fn write, void* user){
+    // 与AstWalker相同的遍历：子节点在节点数组中是连续的一段，
+    // 节点相对父节点first_child的位置就是它在兄弟中的下标，不需要栈
+    AstPrintSink* sink = new AstPrintSink(write, user);
+    const struct ast_file_node* nodes = file->nodes;
+    uint32_t i = 0;
+    size_t depth = 0;
+    bool entering = true;
+    bool ok = file->node_count > 0;
+    // 正确的树恰好有两倍于节点数的事件，超出说明文件中的父子关系有环
+    uint64_t budget = (uint64_t)file->node_count * 2;
+    while(ok){
+        if(budget-- == 0){
+            ok = false;
+            break;
+        }
+        const struct ast_file_node* node = &nodes[i];
+        bool has_children = node->child_count > 0;
+        if(entering){
+            // 广度优先的布局中子节点总在父节点之后
+            if(has_children && (node->first_child <= i || node->first_child > file->node_count
+                                || node->child_count > file->node_count - node->first_child)){
+                ok = false;
+                break;
+            }
+            bool first = i == 0 || (node->parent < i && nodes[node->parent].first_child == i);
+            ast_print_enter(*sink, format, depth, ast_file_get_type_name(file, node), node->type,
+                            ast_file_get_value(file, node), has_children, first);
+            if(has_children){
+                i = node->first_child;
+                depth++;
+            }else{
+                entering = false;
+            }
+            continue;
+        }
+        ast_print_leave(*sink, format, has_children);
+        if(i == 0){
+            break;
+        }
+        uint32_t parent = node->parent;
+        if(parent >= i || i < nodes[parent].first_child || i - nodes[parent].first_child >= nodes[parent].child_count){
+            ok = false;
+            break;
+        }
+        if(i + 1 - nodes[parent].first_child < nodes[parent].child_count){
+            i++;
+            entering = true;
+        }else{
+            i = parent;
+            depth--;
+        }
+    }
+    if(ok && format == ast_print_json){
+        sink->put('\n');
+    }
+    ok = sink->finish() && ok;
+    delete sink;
+    return ok ? 1 : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
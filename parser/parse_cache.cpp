@@ -0,0 +1,324 @@
+#include "parser.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "lex.h"
+
+/* 哈希使用的常量，取自xxHash64 */
+#define HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME3 0x165667B19E3779F9ULL
+#define HASH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME5 0x27D4EB2F165667C5ULL
+
+/* 校验哈希使用的种子，与文件名哈希相互独立 */
+#define PARSE_CACHE_CHECK_SEED 0x5A17C0DEULL
+
+static inline uint64_t hash_rotl(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t hash_read64(const unsigned char* p){
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash_read32(const unsigned char* p){
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t input){
+    acc += input * HASH_PRIME2;
+    acc = hash_rotl(acc, 31);
+    return acc * HASH_PRIME1;
+}
+
+static inline uint64_t hash_merge(uint64_t acc, uint64_t lane){
+    acc ^= hash_round(0, lane);
+    return acc * HASH_PRIME1 + HASH_PRIME4;
+}
+
+/* 构造缓存条目的路径 */
+static std::string parse_cache_path(const struct parse_cache* cache, uint64_t hash, enum parse_cache_kind kind){
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.%s", (unsigned long long)hash,
+             kind == parse_cache_ast ? "ast" : "tok");
+    return std::string(cache->dir) + name;
+}
+
+/* 写入成功后改名，读取方看不到写了一半的条目 */
+class ParseCacheWriter {
+    public:
+        ParseCacheWriter(struct parse_cache* cache, const char* source, size_t size, enum parse_cache_kind kind)
+            :cache(cache), out(nullptr)
+        {
+            path = parse_cache_path(cache, parse_cache_hash(source, size, cache->seed), kind);
+            // 多个工作线程属于同一进程，临时文件名由mkstemp保证唯一，同一条目可以同时写入
+            std::string name = path + ".tmp.XXXXXX";
+            int fd = mkstemp(&name[0]);
+            if(fd < 0){
+                return;
+            }
+            temp = name;
+            // mkstemp只给所有者读写权限，条目与fopen在常见umask下创建的一样可供他人读取
+            fchmod(fd, 0644);
+            out = fdopen(fd, "wb");
+            if(out == nullptr){
+                close(fd);
+                unlink(temp.c_str());
+                return;
+            }
+            struct parse_cache_header header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, PARSE_CACHE_MAGIC, sizeof(header.magic));
+            header.version = PARSE_CACHE_VERSION;
+            header.kind = kind;
+            header.source_size = size;
+            header.source_check = parse_cache_hash(source, size, PARSE_CACHE_CHECK_SEED);
+            if(fwrite(&header, sizeof(header), 1, out) != 1){
+                fclose(out);
+                unlink(temp.c_str());
+                out = nullptr;
+            }
+        }
+        ~ParseCacheWriter(){
+            if(out != nullptr){
+                fclose(out);
+                unlink(temp.c_str());
+            }
+        }
+
+        FILE* file() const { return out; }
+
+        /* 提交条目，written表示内容是否已经完整写入 */
+        int commit(bool written){
+            if(out == nullptr){
+                cache->errors++;
+                return 0;
+            }
+            bool ok = written && fclose(out) == 0;
+            out = nullptr;
+            if(!ok || rename(temp.c_str(), path.c_str()) != 0){
+                unlink(temp.c_str());
+                cache->errors++;
+                return 0;
+            }
+            cache->stores++;
+            return 1;
+        }
+    private:
+        struct parse_cache* cache;
+        FILE* out;
+        std::string path;
+        std::string temp;
+};
+
+/**
+ * 映射缓存条目并检查文件头
+ * @param payload 输出文件头之后的数据
+ * @param payload_size 输出数据长度
+ * @return 映射的地址，未命中时返回NULL
+ */
+static void* parse_cache_map(struct parse_cache* cache, const char* source, size_t size, enum parse_cache_kind kind,
+                             size_t* map_size, const char** payload, size_t* payload_size){
+    std::string path = parse_cache_path(cache, parse_cache_hash(source, size, cache->seed), kind);
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        cache->misses++;
+        return NULL;
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct parse_cache_header)){
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if(map == MAP_FAILED){
+        cache->errors++;
+        cache->misses++;
+        return NULL;
+    }
+
+    const struct parse_cache_header* header = (const struct parse_cache_header*)map;
+    if(memcmp(header->magic, PARSE_CACHE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != PARSE_CACHE_VERSION
+        || header->kind != (uint32_t)kind
+        || header->source_size != size
+        || header->source_check != parse_cache_hash(source, size, PARSE_CACHE_CHECK_SEED)){
+        munmap(map, (size_t)st.st_size);
+        cache->misses++;
+        return NULL;
+    }
+
+    *map_size = (size_t)st.st_size;
+    *payload = (const char*)map + sizeof(struct parse_cache_header);
+    *payload_size = *map_size - sizeof(struct parse_cache_header);
+    return map;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint64_t parse_cache_hash(const void* data, size_t size, uint64_t seed){
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + size;
+    uint64_t hash;
+
+    if(size >= 32){
+        uint64_t v1 = seed + HASH_PRIME1 + HASH_PRIME2;
+        uint64_t v2 = seed + HASH_PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - HASH_PRIME1;
+        const unsigned char* limit = end - 32;
+        do{
+            v1 = hash_round(v1, hash_read64(p));
+            v2 = hash_round(v2, hash_read64(p + 8));
+            v3 = hash_round(v3, hash_read64(p + 16));
+            v4 = hash_round(v4, hash_read64(p + 24));
+            p += 32;
+        }while(p <= limit);
+        hash = hash_rotl(v1, 1) + hash_rotl(v2, 7) + hash_rotl(v3, 12) + hash_rotl(v4, 18);
+        hash = hash_merge(hash, v1);
+        hash = hash_merge(hash, v2);
+        hash = hash_merge(hash, v3);
+        hash = hash_merge(hash, v4);
+    }else{
+        hash = seed + HASH_PRIME5;
+    }
+    hash += (uint64_t)size;
+
+    for(; p + 8 <= end; p += 8){
+        hash ^= hash_round(0, hash_read64(p));
+        hash = hash_rotl(hash, 27) * HASH_PRIME1 + HASH_PRIME4;
+    }
+    if(p + 4 <= end){
+        hash ^= (uint64_t)hash_read32(p) * HASH_PRIME1;
+        hash = hash_rotl(hash, 23) * HASH_PRIME2 + HASH_PRIME3;
+        p += 4;
+    }
+    for(; p < end; p++){
+        hash ^= (*p) * HASH_PRIME5;
+        hash = hash_rotl(hash, 11) * HASH_PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+int parse_cache_open(struct parse_cache* cache, const char* dir){
+    memset(cache, 0, sizeof(*cache));
+
+    if(mkdir(dir, 0777) != 0 && errno != EEXIST){
+        return 0;
+    }
+    struct stat st;
+    if(stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)){
+        return 0;
+    }
+    cache->dir = strdup(dir);
+    if(cache->dir == NULL){
+        return 0;
+    }
+
+    // 版本号、二进制格式版本和节点类型表决定种子，任何一个变化都会使旧条目失效
+    std::string key = PARSER_VERSION;
+    key += '\0';
+    key += std::to_string(AST_FILE_VERSION);
+    size_t type_count = parser_get_node_type_count();
+    for(size_t type = 0; type < type_count; type++){
+        const char* name = parser_get_node_type_name(type);
+        key += '\0';
+        key += name ? name : "";
+    }
+    cache->seed = parse_cache_hash(key.data(), key.size(), 0);
+    return 1;
+}
+
+void parse_cache_close(struct parse_cache* cache){
+    free(cache->dir);
+    cache->dir = NULL;
+}
+
+int parse_cache_load_ast(struct parse_cache* cache, const char* source, size_t size, struct ast_file* file){
+    size_t map_size;
+    const char* payload;
+    size_t payload_size;
+    void* map = parse_cache_map(cache, source, size, parse_cache_ast, &map_size, &payload, &payload_size);
+    if(map == NULL){
+        memset(file, 0, sizeof(*file));
+        return 0;
+    }
+    if(!ast_file_load(file, payload, payload_size)){
+        munmap(map, map_size);
+        cache->errors++;
+        cache->misses++;
+        return 0;
+    }
+    // 由ast_file_close解除整个条目的映射
+    file->map = map;
+    file->map_size = map_size;
+    cache->hits++;
+    return 1;
+}
+
+int parse_cache_store_ast(struct parse_cache* cache, const char* source, size_t size, const AstNode* root){
+    ParseCacheWriter writer(cache, source, size, parse_cache_ast);
+    return writer.commit(writer.file() && ast_file_write(root, writer.file()));
+}
+
+int parse_cache_load_tokens(struct parse_cache* cache, const char* source, size_t size, struct parse_cache_token_list* list){
+    memset(list, 0, sizeof(*list));
+
+    size_t map_size;
+    const char* payload;
+    size_t payload_size;
+    void* map = parse_cache_map(cache, source, size, parse_cache_tokens, &map_size, &payload, &payload_size);
+    if(map == NULL){
+        return 0;
+    }
+    if(payload_size % sizeof(struct parse_cache_token) != 0){
+        munmap(map, map_size);
+        cache->errors++;
+        cache->misses++;
+        return 0;
+    }
+    list->map = map;
+    list->map_size = map_size;
+    list->tokens = (const struct parse_cache_token*)payload;
+    list->count = payload_size / sizeof(struct parse_cache_token);
+    cache->hits++;
+    return 1;
+}
+
+int parse_cache_store_tokens(struct parse_cache* cache, const char* source, size_t size,
+                             const struct parse_cache_token* tokens, size_t count){
+    ParseCacheWriter writer(cache, source, size, parse_cache_tokens);
+    return writer.commit(writer.file() && fwrite(tokens, sizeof(*tokens), count, writer.file()) == count);
+}
+
+void parse_cache_tokens_close(struct parse_cache_token_list* list){
+    if(list->map){
+        munmap(list->map, list->map_size);
+    }
+    memset(list, 0, sizeof(*list));
+}
+
+#ifdef __cplusplus
+}
+#endif
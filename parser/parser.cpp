@@ -2,154 +2,580 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <map>
-#include <string>
-#include <vector>
-#include <stdexcept>
+#include <atomic>
+#include <new>
+#include <thread>
+#include <string.h>
 
 #include "lex.h"
 #include "bscp.hpp"
 
-AstNode::~AstNode(){
-    for (AstNode* node : child) {
-        delete node;
+AstArena::AstArena(size_t block_size, struct lex_allocator* allocator)
+    :first(nullptr), current(nullptr), block_size(block_size), allocator(allocator)
+{
+}
+
+AstArena::~AstArena(){
+    free_blocks();
+}
+
+void AstArena::free_blocks(){
+    Block* block = first;
+    while(block != nullptr){
+        Block* next = block->next;
+        lex_dealloc(allocator, block, sizeof(Block) + block->size, LEX_ALLOC_SITE);
+        block = next;
+    }
+    first = current = nullptr;
+}
+
+void AstArena::set_allocator(struct lex_allocator* allocator){
+    free_blocks();
+    this->allocator = allocator;
+}
+
+/* 取得下一个能容纳size字节的内存块，优先复用release之后留下的块 */
+AstArena::Block* AstArena::next_block(size_t size, size_t align){
+    size_t need = size + align;
+    Block** link = current ? &current->next : &first;
+    while(*link != nullptr){
+        if((*link)->size >= need){
+            (*link)->used = 0;
+            return *link;
+        }
+        // 放不下的旧块直接丢弃
+        Block* unused = *link;
+        *link = unused->next;
+        lex_dealloc(allocator, unused, sizeof(Block) + unused->size, LEX_ALLOC_SITE);
+    }
+    size_t data_size = need > block_size ? need : block_size;
+    Block* block = (Block*)lex_alloc(allocator, sizeof(Block) + data_size, LEX_ALLOC_SITE);
+    if(block == nullptr){
+        throw std::bad_alloc();
+    }
+    block->next = nullptr;
+    block->size = data_size;
+    block->used = 0;
+    *link = block;
+    return block;
+}
+
+void* AstArena::allocate(size_t size, size_t align){
+    if(current != nullptr){
+        uintptr_t base = (uintptr_t)current->data();
+        uintptr_t ptr = (base + current->used + align - 1) & ~(uintptr_t)(align - 1);
+        if(ptr + size <= base + current->size){
+            current->used = ptr + size - base;
+            return (void*)ptr;
+        }
     }
+    current = next_block(size, align);
+    uintptr_t base = (uintptr_t)current->data();
+    uintptr_t ptr = (base + align - 1) & ~(uintptr_t)(align - 1);
+    current->used = ptr + size - base;
+    return (void*)ptr;
 }
 
-struct registered_syntax {
-    parser_node_t id;
-    std::string name;
-    std::string match_expression;
+char* AstArena::strndup(const char* str, size_t n){
+    char* copy = (char*)allocate(n + 1, 1);
+    if(n > 0){
+        memcpy(copy, str, n);
+    }
+    copy[n] = '\0';
+    return copy;
+}
+
+size_t AstArena::reserved() const{
+    size_t bytes = 0;
+    for(const Block* block = first; block != nullptr; block = block->next){
+        bytes += sizeof(Block) + block->size;
+    }
+    return bytes;
+}
+
+void AstArena::release(){
+    // 内存块保留在链表中，下次分配时从第一块重新开始
+    current = nullptr;
+}
+
+/* 
+ * 节点类型注册表
+ *
+ * 类型名到ID的映射是一张开放定址的哈希表，类型名一经注册不会删除，
+ * 因此槽位只会从空变为占用：注册时用CAS抢占空槽，查找不需要加锁。
+ * 抢到槽位的线程再分配ID并发布，其它线程看到槽位已被同名类型占用时等待ID发布。
+ * 内置类型在注册表创建时按parser_builtin_node_type的顺序注册，ID与枚举值一致。
+ */
+class NodeTypeRegistry {
+    public:
+        NodeTypeRegistry(): count(0) {
+            for(size_t i = 0; i < NODE_TYPE_TABLE_SIZE; i++){
+                slots[i].name.store(nullptr, std::memory_order_relaxed);
+                slots[i].id.store(PARSER_NODE_TYPE_NONE, std::memory_order_relaxed);
+            }
+            for(size_t i = 0; i < PARSER_MAX_NODE_TYPES; i++){
+                names[i].store(nullptr, std::memory_order_relaxed);
+            }
+            static const char* const builtin[PARSER_BUILTIN_NODE_TYPE_COUNT] = {
+                CODE_BLOCK_TYPE_NAME,
+                FUNCTION_DEF_TYPE_NAME,
+                EXPR_TYPE_NAME,
+                IDENTIFIER_TYPE_NAME,
+                CONST_NUM_TYPE_NAME,
+                CONST_STR_TYPE_NAME,
+            };
+            for(const char* name : builtin){
+                insert(name);
+            }
+        }
+
+        parser_node_t insert(const char* name){
+            return probe(name, true);
+        }
+        parser_node_t find(const char* name){
+            return probe(name, false);
+        }
+        size_t size() const {
+            size_t n = count.load(std::memory_order_acquire);
+            return n < PARSER_MAX_NODE_TYPES ? n : PARSER_MAX_NODE_TYPES;
+        }
+        const char* name(parser_node_t type) const {
+            return type < PARSER_MAX_NODE_TYPES ? names[type].load(std::memory_order_acquire) : nullptr;
+        }
+    private:
+        /* 槽位数是类型数上限的两倍，装载因子不超过一半 */
+        static const size_t NODE_TYPE_TABLE_SIZE = PARSER_MAX_NODE_TYPES * 2;
+
+        struct Slot {
+            std::atomic<const char*> name;
+            std::atomic<parser_node_t> id;
+        };
+        Slot slots[NODE_TYPE_TABLE_SIZE];
+        std::atomic<const char*> names[PARSER_MAX_NODE_TYPES];
+        std::atomic<size_t> count;
+
+        static size_t hash(const char* name){
+            // FNV-1a，只在注册和按名查找时计算，创建节点时不需要
+            uint64_t h = 0xcbf29ce484222325ULL;
+            for(const unsigned char* p = (const unsigned char*)name; *p; p++){
+                h = (h ^ *p) * 0x100000001b3ULL;
+            }
+            return (size_t)h;
+        }
 
-    registered_syntax(parser_node_t id, std::string name): id(id), name(name){}
-    virtual ~registered_syntax(){};
+        /* 等待抢到槽位的线程发布ID */
+        static parser_node_t wait_id(const Slot& slot){
+            parser_node_t id;
+            while((id = slot.id.load(std::memory_order_acquire)) == PARSER_NODE_TYPE_NONE){
+                std::this_thread::yield();
+            }
+            return id;
+        }
+
+        parser_node_t probe(const char* name, bool create){
+            char* copy = nullptr;
+            size_t mask = NODE_TYPE_TABLE_SIZE - 1;
+            for(size_t i = hash(name) & mask, n = 0; n < NODE_TYPE_TABLE_SIZE; i = (i + 1) & mask, n++){
+                Slot& slot = slots[i];
+                const char* current = slot.name.load(std::memory_order_acquire);
+                if(current == nullptr){
+                    if(!create){
+                        return PARSER_NODE_TYPE_NONE;
+                    }
+                    if(copy == nullptr){
+                        copy = strdup(name);
+                        if(copy == nullptr){
+                            return PARSER_NODE_TYPE_NONE;
+                        }
+                    }
+                    if(slot.name.compare_exchange_strong(current, copy, std::memory_order_acq_rel)){
+                        size_t id = count.fetch_add(1, std::memory_order_acq_rel);
+                        if(id >= PARSER_MAX_NODE_TYPES){
+                            // 类型数超出上限，槽位保留为永远无效的条目
+                            slot.id.store(PARSER_NODE_TYPE_INVALID, std::memory_order_release);
+                            return PARSER_NODE_TYPE_NONE;
+                        }
+                        names[id].store(copy, std::memory_order_release);
+                        slot.id.store(id, std::memory_order_release);
+                        return id;
+                    }
+                    // 其它线程抢先占用了这个槽位，current已更新为它的类型名
+                }
+                if(strcmp(current, name) == 0){
+                    free(copy);
+                    parser_node_t id = wait_id(slot);
+                    return id == PARSER_NODE_TYPE_INVALID ? PARSER_NODE_TYPE_NONE : id;
+                }
+            }
+            free(copy);
+            return PARSER_NODE_TYPE_NONE;
+        }
 };
 
-static std::vector<registered_syntax> registered_node_types;
-static std::map<std::string, parser_node_t> type_name_table;
+static NodeTypeRegistry& node_type_registry(void){
+    static NodeTypeRegistry registry;
+    return registry;
+}
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 parser_node_t parser_register_node_type(const char* name){
-    try{
-        return type_name_table[std::string(name)];
-    }catch(std::out_of_range const&){
-        registered_syntax &type = registered_node_types
-            .emplace_back(registered_node_types.size(), std::string(name));
-        type_name_table[type.name] = type.id;
-        return type.id;
-    }
+    return node_type_registry().insert(name);
 }
 
 parser_node_t parser_get_node_type(const char* name){
-    try{
-        return type_name_table[std::string(name)];
-    }catch(std::out_of_range const&){
-        return -1;
-    }
+    return node_type_registry().find(name);
+}
+
+size_t parser_get_node_type_count(void){
+    return node_type_registry().size();
 }
+
 const char* parser_get_node_type_name(parser_node_t type){
-    if(registered_node_types.size() <= type){// type not found
+    return node_type_registry().name(type);
+}
+
+
+/* 语法分析器上下文，各线程使用各自的上下文即可并行分析 */
+struct parse_context {
+    struct lex_context* lexer;
+    struct lex_atom_table* atoms;                   /* 标识符和字符串的原子表，由词法分析器填充 */
+    AstArena arena;                                 /* 一次语法分析的所有节点都从这里分配 */
+    lex_token token_buffer[LEX_TOKEN_BATCH_SIZE];   /* 按批从词法分析器获取的词法单元 */
+    size_t token_count;
+    size_t token_index;
+    AstNode* root;
+    FILE* diagnostics;                              /* 语法错误的输出位置 */
+    struct parse_stats* stats;                      /* 统计的输出位置，NULL表示不统计 */
+    const char* filename;                           /* 诊断信息中的文件名 */
+    struct lex_line_index lines;                    /* 当前输入的换行索引，出错时才建立 */
+    struct lex_allocator* allocator;                /* 上下文本身和各部分内存的分配器 */
+    struct lex_token_ring* ring;                    /* 流水线模式的环形缓冲区，NULL表示串行分析 */
+    bool pipelined;                                 /* 本次语法分析的词法单元来自ring */
+};
+
+/* 全局接口使用的默认上下文 */
+static struct parse_context* default_context = nullptr;
+
+static struct parse_context* parse_default(void){
+    if(default_context == nullptr){
+        default_context = parse_create();
+    }
+    return default_context;
+}
+
+/* 取一批词法单元：流水线模式下从环形缓冲区读出，否则直接调用词法分析器 */
+static size_t parser_fetch_tokens(struct parse_context* ctx, lex_token* tokens, size_t n){
+    size_t count = ctx->pipelined
+        ? lex_ring_pop(ctx->ring, tokens, n)
+        : lex_next_batch_r(ctx->lexer, tokens, n);
+#ifndef BASM_NO_STATS
+    if(ctx->stats){
+        for(size_t i = 0; i < count; i++){
+            ctx->stats->tokens[tokens[i].type]++;
+        }
+    }
+#endif
+    return count;
+}
+
+static int parser_next_token(struct parse_context* ctx, lex_token* token){
+    // 节点值已经复制到内存池中，拥有模式下上一个词法单元的文本可以释放了
+    lex_token_free_r(ctx->lexer, token);
+    if(ctx->token_index == ctx->token_count){
+        ctx->token_count = parser_fetch_tokens(ctx, ctx->token_buffer, LEX_TOKEN_BATCH_SIZE);
+        ctx->token_index = 0;
+        if(ctx->token_count == 0) return 0;
+    }
+    *token = ctx->token_buffer[ctx->token_index++];
+    return 1;
+}
+
+/*
+ * 向前看：当前词法单元之后的第k个（从0开始），不取走
+ * 流水线模式下缓冲中不够时直接查看环形缓冲区，k可以到它的容量；
+ * 串行模式下把剩余的词法单元移到缓冲开头再补齐，k必须小于LEX_TOKEN_BATCH_SIZE
+ * @return 词法单元，在下一次parser_next_token之前有效；输入在此之前结束时返回NULL
+ */
+static inline const lex_token* parser_peek_token(struct parse_context* ctx, size_t k){
+    size_t buffered = ctx->token_count - ctx->token_index;
+    if(k < buffered){
+        return &ctx->token_buffer[ctx->token_index + k];
+    }
+    if(ctx->pipelined){
+        return lex_ring_peek(ctx->ring, k - buffered);
+    }
+    if(k >= LEX_TOKEN_BATCH_SIZE){
+        return nullptr;
+    }
+    memmove(ctx->token_buffer, ctx->token_buffer + ctx->token_index, buffered * sizeof(lex_token));
+    ctx->token_index = 0;
+    ctx->token_count = buffered;
+    while(ctx->token_count <= k){
+        size_t count = parser_fetch_tokens(ctx, ctx->token_buffer + ctx->token_count,
+                                           LEX_TOKEN_BATCH_SIZE - ctx->token_count);
+        if(count == 0){
+            return nullptr;
+        }
+        ctx->token_count += count;
+    }
+    return &ctx->token_buffer[k];
+}
+
+/* 丢弃尚未取走的词法单元 */
+static void parser_reset_tokens(struct parse_context* ctx){
+    for(size_t i = ctx->token_index; i < ctx->token_count; i++){
+        lex_token_free_r(ctx->lexer, &ctx->token_buffer[i]);
+    }
+    ctx->token_count = ctx->token_index = 0;
+}
+
+struct parse_context* parse_create(void){
+    return parse_create_with_allocator(nullptr);
+}
+
+struct parse_context* parse_create_with_allocator(struct lex_allocator* allocator){
+    void* memory = lex_alloc(allocator, sizeof(parse_context), LEX_ALLOC_SITE);
+    if(memory == nullptr){
+        return nullptr;
+    }
+    struct parse_context* ctx = new (memory) parse_context();
+    ctx->allocator = allocator;
+    ctx->arena.set_allocator(allocator);
+    ctx->lexer = lex_create();
+    ctx->atoms = lex_atom_table_create_with_allocator(allocator);
+    if(ctx->lexer == nullptr || ctx->atoms == nullptr){
+        lex_destroy(ctx->lexer);
+        lex_atom_table_destroy(ctx->atoms);
+        ctx->~parse_context();
+        lex_dealloc(allocator, memory, sizeof(parse_context), LEX_ALLOC_SITE);
         return nullptr;
     }
-    return registered_node_types[type].name.c_str();
+    lex_set_allocator_r(ctx->lexer, allocator);
+    lex_set_atom_table_r(ctx->lexer, ctx->atoms);
+    ctx->token_count = ctx->token_index = 0;
+    ctx->root = nullptr;
+    ctx->diagnostics = stderr;
+    ctx->stats = nullptr;
+    ctx->filename = nullptr;
+    ctx->ring = nullptr;
+    ctx->pipelined = false;
+    lex_line_index_init(&ctx->lines);
+    return ctx;
 }
 
+void parse_destroy(struct parse_context* ctx){
+    if(ctx == nullptr){
+        return;
+    }
+    parser_reset_tokens(ctx);
+    lex_ring_destroy(ctx->ring);
+    lex_destroy(ctx->lexer);
+    lex_atom_table_destroy(ctx->atoms);
+    lex_line_index_free(&ctx->lines);
+    struct lex_allocator* allocator = ctx->allocator;
+    ctx->~parse_context();
+    lex_dealloc(allocator, ctx, sizeof(parse_context), LEX_ALLOC_SITE);
+}
 
-// AstNode* create_node(parser_node_t type, const char* value){
-//     return new AstNode(type, value);
-// }
-// void free_ast(AstNode* node){
-//     delete node;
-// }
+int parse_init_r(struct parse_context* ctx, const char* input, size_t length){
+    // 输入在语法分析期间一直有效，词法单元只引用输入，节点值由内存池复制
+    parser_reset_tokens(ctx);
+    lex_set_token_mode_r(ctx->lexer, lex_mode_view);
+    int ok = lex_init_with_string_r(ctx->lexer, input, length);
+    lex_line_index_reset(&ctx->lines, ctx->lexer->source, ctx->lexer->source_size);
+    return !ok;
+}
+int parse_init_with_buffer_r(struct parse_context* ctx, char* buffer, size_t length){
+    parser_reset_tokens(ctx);
+    lex_set_token_mode_r(ctx->lexer, lex_mode_view);
+    int ok = lex_init_with_buffer_r(ctx->lexer, buffer, length);
+    lex_line_index_reset(&ctx->lines, ctx->lexer->source, ctx->lexer->source_size);
+    return !ok;
+}
+int parse_init_with_fd_r(struct parse_context* ctx, int fd){
+    // 流式输入的缓冲区会被覆盖，词法单元需要自己的文本，也无法换算行列号
+    parser_reset_tokens(ctx);
+    lex_set_token_mode_r(ctx->lexer, lex_mode_owning);
+    lex_line_index_reset(&ctx->lines, nullptr, 0);
+    return !lex_init_with_fd_r(ctx->lexer, fd);
+}
+void parse_set_engine_r(struct parse_context* ctx, enum lex_engine engine){
+    lex_set_engine_r(ctx->lexer, engine);
+}
+void parse_set_diagnostics_r(struct parse_context* ctx, FILE* diagnostics){
+    ctx->diagnostics = diagnostics ? diagnostics : stderr;
+}
+int parse_set_pipeline_r(struct parse_context* ctx, size_t capacity){
+    lex_ring_destroy(ctx->ring);
+    ctx->ring = nullptr;
+    if(capacity == 0){
+        return 1;
+    }
+    ctx->ring = lex_ring_create(capacity, ctx->allocator);
+    return ctx->ring != nullptr;
+}
+void parse_set_stats_r(struct parse_context* ctx, struct parse_stats* stats){
+    ctx->stats = stats;
+}
+void parse_set_filename_r(struct parse_context* ctx, const char* name){
+    ctx->filename = name;
+}
+int parse_get_position_r(struct parse_context* ctx, size_t offset, struct lex_position* position){
+    return lex_line_index_lookup(&ctx->lines, offset, position);
+}
+AstNode* parse_get_root_r(const struct parse_context* ctx){
+    return ctx->root;
+}
+struct lex_atom_table* parse_get_atoms_r(const struct parse_context* ctx){
+    return ctx->atoms;
+}
+void parse_cleanup_r(struct parse_context* ctx){
+    parser_reset_tokens(ctx);
+    lex_cleanup_r(ctx->lexer);
+    lex_line_index_reset(&ctx->lines, nullptr, 0);
+    // 整棵语法树随内存池一起释放
+    ctx->arena.release();
+    ctx->root = nullptr;
+    // 节点引用的原子文本已经不再使用；服务器等长期复用的上下文中原子表不能随文件不断增长
+    lex_atom_table_clear(ctx->atoms);
+}
 
 int parse_init(const char* input, size_t length){
-    return !lex_init_with_string(input, length);
+    struct parse_context* ctx = parse_default();
+    return ctx ? parse_init_r(ctx, input, length) : 1;
+}
+int parse_init_with_buffer(char* buffer, size_t length){
+    struct parse_context* ctx = parse_default();
+    return ctx ? parse_init_with_buffer_r(ctx, buffer, length) : 1;
+}
+int parse_init_with_fd(int fd){
+    struct parse_context* ctx = parse_default();
+    return ctx ? parse_init_with_fd_r(ctx, fd) : 1;
+}
+void parse_set_engine(enum lex_engine engine){
+    struct parse_context* ctx = parse_default();
+    if(ctx){
+        parse_set_engine_r(ctx, engine);
+    }
 }
 void parse_cleanup(void){
-    lex_cleanup();
+    if(default_context){
+        parse_cleanup_r(default_context);
+    }
+    ast_root = nullptr;
 }
 
 AstNode* ast_root;
 
-void print_ast(AstNode* node, int level){}
+/* 词法单元的文本，视图模式下不以'\0'结尾，只能配合raw_size使用 */
+static inline const char* token_text(const struct parse_context* ctx, const lex_token& token){
+    const char* text = lex_token_text_r(ctx->lexer, &token);
+    return text ? text : "";
+}
+
+/* 以printf的"%.*s"格式输出词法单元文本 */
+#define TOKEN_FMT(token) (int)(token).raw_size, token_text(ctx, token)
+
+static inline bool token_is(const struct parse_context* ctx, const lex_token& token, const char* punctuation){
+    size_t length = strlen(punctuation);
+    return token.type == lex_punctuation && token.raw_size == length
+        && memcmp(token_text(ctx, token), punctuation, length) == 0;
+}
+
+static inline AstNode* create_node(struct parse_context* ctx, parser_node_t type, AstNode* parent, const lex_token* token = nullptr){
+    if(token == nullptr){
+        return ctx->arena.create<AstNode>(type, parent);
+    }
+    // 标识符和字符串已经由词法分析器驻留，直接引用原子表中唯一的一份文本
+    if(token->atom != LEX_ATOM_NONE){
+        return ctx->arena.create<AstNode>(type, parent, lex_atom_text(ctx->atoms, token->atom), token->atom);
+    }
+    const char* value = ctx->arena.strndup(token_text(ctx, *token), token->raw_size);
+    return ctx->arena.create<AstNode>(type, parent, value);
+}
 
 void yyerror(const char* s){
     perror(s);
 }
 
+/*
+ * 输出诊断信息开头的"文件名:行:列: "，无法换算行列号时给出字节偏移
+ * 流水线模式下先停下词法分析线程：flex在原地扫描时会临时把'\0'写入源缓冲区，
+ * 它运行时建立换行索引既是数据竞争，也可能漏掉换行符。出错后语法分析随即结束，
+ * 不再需要后面的词法单元；停下之后'\0'只可能留在已扫描的最后一个词法单元之后，不影响当前位置之前的换行符
+ */
+static void parser_report_position(struct parse_context* ctx, const lex_token& token){
+    if(ctx->pipelined){
+        lex_ring_stop(ctx->ring);
+        ctx->pipelined = false;
+    }
+    const char* name = ctx->filename ? ctx->filename : "<input>";
+    struct lex_position position;
+    if(parse_get_position_r(ctx, token.offset, &position)){
+        fprintf(ctx->diagnostics, "%s:%zu:%zu: ", name, position.line, position.column);
+    }else{
+        fprintf(ctx->diagnostics, "%s: offset %zu: ", name, token.offset);
+    }
+}
+
+/* 条件不成立时报告当前词法单元处的语法错误 */
 #define require_true(expr, ...) \
     do{ \
         if(!(expr)){ \
-            fprintf(stderr, __VA_ARGS__); \
+            parser_report_position(ctx, token); \
+            fprintf(ctx->diagnostics, __VA_ARGS__); \
             return nullptr; \
         } \
     }while(false)
-#define next_token require_true(lex_next(&token), "unexpected token: %s\n", token.raw)
-
-
-#define CONST_NUM_TYPE_NAME "__const_num"
-#define CONST_NUM_TYPE_ID parser_register_node_type(CONST_NUM_TYPE_NAME)
+#define next_token require_true(parser_next_token(ctx, &token), "unexpected end of input\n")
 
-inline AstNode* s_const_num(AstNode* parent, lex_token& token){
-    require_true(token.type == lex_number, "expecting a numeric constant: %s\n", token.raw);
-    return new AstNode(CONST_NUM_TYPE_ID, parent, token.raw);
+inline AstNode* s_const_num(struct parse_context* ctx, AstNode* parent, lex_token& token){
+    require_true(token.type == lex_number, "expecting a numeric constant: %.*s\n", TOKEN_FMT(token));
+    return create_node(ctx, CONST_NUM_TYPE_ID, parent, &token);
 }
 
-#define CONST_STR_TYPE_NAME "__const_str"
-#define CONST_STR_TYPE_ID parser_register_node_type(CONST_STR_TYPE_NAME)
-
-
-inline AstNode* s_const_str(AstNode* parent, lex_token& token){
-    require_true(token.type == lex_string, "expecting a string constant: %s\n", token.raw);
-    return new AstNode(CONST_STR_TYPE_ID, parent, token.raw);
+inline AstNode* s_const_str(struct parse_context* ctx, AstNode* parent, lex_token& token){
+    require_true(token.type == lex_string, "expecting a string constant: %.*s\n", TOKEN_FMT(token));
+    return create_node(ctx, CONST_STR_TYPE_ID, parent, &token);
 }
 
-#define EXPR_TYPE_NAME "__expr"
-#define EXPR_TYPE_ID parser_register_node_type(EXPR_TYPE_NAME)
-
-AstNode* s_expr(AstNode* parent, lex_token& token){
+AstNode* s_expr(struct parse_context* ctx, AstNode* parent, lex_token& token){
     switch(token.type)
     {
     case lex_number:
-        return s_const_num(parent, token);
+        return s_const_num(ctx, parent, token);
     case lex_string:
-        return s_const_str(parent, token);
+        return s_const_str(ctx, parent, token);
     default:
-        require_true(false, "expecting a constant numeral or a constant string");
+        require_true(false, "expecting a constant numeral or a constant string: %.*s\n", TOKEN_FMT(token));
     }
 }
 
-#define IDENTIFIER_TYPE_NAME "__id"
-#define IDENTIFIER_TYPE_ID parser_register_node_type(IDENTIFIER_TYPE_NAME)
-
-inline AstNode* s_id(AstNode* parent, lex_token& token){
-    require_true(token.type == lex_word, "expecting an identifier: %s\n", token.raw);
-    return new AstNode(IDENTIFIER_TYPE_ID, parent, token.raw);
+inline AstNode* s_id(struct parse_context* ctx, AstNode* parent, lex_token& token){
+    require_true(token.type == lex_word, "expecting an identifier: %.*s\n", TOKEN_FMT(token));
+    return create_node(ctx, IDENTIFIER_TYPE_ID, parent, &token);
 }
 
-#define FUNCTION_DEF_TYPE_NAME "__func_def"
-#define FUNCTION_DEF_TYPE_ID parser_register_node_type(FUNCTION_DEF_TYPE_NAME)
-
-AstNode* s_func_def(AstNode* parent, lex_token& token)
+AstNode* s_func_def(struct parse_context* ctx, AstNode* parent, lex_token& token)
 {
-    AstNode* node = new AstNode(FUNCTION_DEF_TYPE_ID, parent);
+    require_true(token.type == lex_word, "expecting a word: %.*s\n", TOKEN_FMT(token));
 
-    require_true(token.type == lex_word, "expecting a word: %s\n", token.raw);
+    AstNode* node = create_node(ctx, FUNCTION_DEF_TYPE_ID, parent);
 
     next_token;
-    require_true(token.type == lex_punctuation && strcmp("{", token.raw) == 0, "expecting a '{': %s\n", token.raw);
+    require_true(token_is(ctx, token, "{"), "expecting a '{': %.*s\n", TOKEN_FMT(token));
 
     next_token;
-    while(token.type != lex_punctuation || strcmp("}", token.raw) != 0){
-        require_true(token.type != lex_eol, "expecting a '}': %s\n", token.raw);
+    while(!token_is(ctx, token, "}")){
+        require_true(token.type != lex_eol, "expecting a '}' before end of line\n");
 
-        AstNode* expr = s_expr(node, token);
+        AstNode* expr = s_expr(ctx, node, token);
         if(expr == nullptr) return nullptr;
 
-        node->child.push_back(expr);
+        node->child.push_back(ctx->arena, expr);
         next_token;
     }
 
@@ -157,29 +583,29 @@ AstNode* s_func_def(AstNode* parent, lex_token& token)
     return node;
 }
 
-#define CODE_BLOCK_TYPE_NAME "__code_block"
-#define CODE_BLOCK_TYPE_ID parser_register_node_type(FUNCTION_DEF_TYPE_NAME)
-
-AstNode* s_code_block(AstNode* parent, lex_token& token)
+AstNode* s_code_block(struct parse_context* ctx, AstNode* parent, lex_token& token)
 {
-    AstNode* node = new AstNode(CODE_BLOCK_TYPE_ID, parent);
+    AstNode* node = create_node(ctx, CODE_BLOCK_TYPE_ID, parent);
 
     next_token;
     while(token.type != lex_eof){
         switch(token.type)
         {
         case lex_punctuation:
-            // preprocess();
-            puts("todo: preprocess"); //todo: preprocess
+            // todo: preprocess();
+            // 预处理尚未实现，暂时跳过；不能直接写标准输出，多文件和服务器模式的输出由调用者按文件收集
             break;
         case lex_word:
-            s_func_def(node, token);
+        {
+            AstNode* func = s_func_def(ctx, node, token);
+            if(func == nullptr) return nullptr;
+            node->child.push_back(ctx->arena, func);
             break;
+        }
         case lex_eol:
             break;
         default:
-            require_true(false, "unexpected token: %s\n", token.raw);
-            return nullptr;
+            require_true(false, "unexpected token: %.*s\n", TOKEN_FMT(token));
         }
         next_token;
     }
@@ -187,10 +613,35 @@ AstNode* s_code_block(AstNode* parent, lex_token& token)
 }
 
 
+int parse_r(struct parse_context* ctx){
+    lex_token token = {};
+    // 上一次语法分析的节点可能还没有被parse_cleanup释放
+    ctx->arena.release();
+    // 流水线模式下词法分析在另一个线程中提前进行，输入不满足条件时照常串行分析
+    ctx->pipelined = ctx->ring != nullptr && lex_ring_start(ctx->ring, ctx->lexer);
+    ctx->root = s_code_block(ctx, nullptr, token);
+    // 出错时停下的词法单元在拥有模式下还持有复制的文本
+    lex_token_free_r(ctx->lexer, &token);
+    if(ctx->pipelined){
+        lex_ring_stop(ctx->ring);
+        ctx->pipelined = false;
+    }
+#ifndef BASM_NO_STATS
+    if(ctx->stats){
+        ctx->stats->arena_bytes = ctx->arena.reserved();
+    }
+#endif
+    return ctx->root == nullptr ? 1 : 0;
+}
+
 int yyparse(void){
-    lex_token token;
-    ast_root = s_code_block(nullptr, token);
-    return ast_root == nullptr ? 1 : 0;
+    struct parse_context* ctx = parse_default();
+    if(ctx == nullptr){
+        return 1;
+    }
+    int result = parse_r(ctx);
+    ast_root = ctx->root;
+    return result;
 }
 
 #ifdef __cplusplus
@@ -3,7 +3,79 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <list>
+#include <stdint.h>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+#include "lex.h"
+
+/* 语法树内存池每块的大小 */
+#define AST_ARENA_BLOCK_SIZE (64 * 1024)
+
+/* 
+ * 语法树内存池
+ * 一次语法分析的所有节点、子节点数组和节点值都从这里顺序分配，
+ * 节点不需要单独释放，release只重置分配位置，内存块留给下一次语法分析复用；
+ * 内存块从lex_allocator申请，NULL表示默认分配器
+ */
+class AstArena {
+    public:
+        AstArena(size_t block_size = AST_ARENA_BLOCK_SIZE, struct lex_allocator* allocator = nullptr);
+        ~AstArena();
+        AstArena(const AstArena&) = delete;
+        AstArena& operator=(const AstArena&) = delete;
+
+        void* allocate(size_t size, size_t align = alignof(std::max_align_t));
+        /* 复制长度为n的字符串，结果以'\0'结尾 */
+        char* strndup(const char* str, size_t n);
+        /* 一次性回收所有分配，复杂度与节点数无关 */
+        void release();
+        /* 已从系统申请的字节数，包括release之后留待复用的内存块 */
+        size_t reserved() const;
+        /* 改用另一个分配器，已申请的内存块先还给原来的分配器，之前分配的节点全部失效 */
+        void set_allocator(struct lex_allocator* allocator);
+
+        template<typename T, typename... Args>
+        T* create(Args&&... args){
+            return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+    private:
+        /* 数据区紧跟在块头之后 */
+        struct alignas(std::max_align_t) Block {
+            Block* next;
+            size_t size;    /* 数据区大小 */
+            size_t used;    /* 已分配的字节数 */
+            char* data() { return (char*)(this + 1); }
+        };
+        Block* first;
+        Block* current;
+        size_t block_size;
+        struct lex_allocator* allocator;
+
+        Block* next_block(size_t size, size_t align);
+        void free_blocks();
+};
+
+class AstNode;
+
+/* 连续存放的子节点数组，空间从AstArena分配，按倍数增长 */
+class AstChildren {
+    public:
+        AstChildren(): items(nullptr), count(0), capacity(0) {}
+
+        /* 追加子节点，同时记下它在数组中的下标 */
+        void push_back(AstArena& arena, AstNode* node);
+        AstNode** begin() const { return items; }
+        AstNode** end() const { return items + count; }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        AstNode* operator[](size_t i) const { return items[i]; }
+    private:
+        AstNode** items;
+        uint32_t count;
+        uint32_t capacity;
+};
 
 #ifdef __cplusplus
 extern "C" {
@@ -12,33 +84,57 @@ extern "C" {
 
 typedef size_t parser_node_t;
 
-/* 语法树节点结构 */
+/* 表示类型不存在 */
+#define PARSER_NODE_TYPE_NONE ((parser_node_t)-1)
+/* 注册表内部使用，表示因超出上限而注册失败的类型 */
+#define PARSER_NODE_TYPE_INVALID ((parser_node_t)-2)
+/* 可注册的节点类型数上限，必须是2的幂 */
+#define PARSER_MAX_NODE_TYPES 4096
+
+/* 内置节点类型的名称 */
+#define CODE_BLOCK_TYPE_NAME "__code_block"
+#define FUNCTION_DEF_TYPE_NAME "__func_def"
+#define EXPR_TYPE_NAME "__expr"
+#define IDENTIFIER_TYPE_NAME "__id"
+#define CONST_NUM_TYPE_NAME "__const_num"
+#define CONST_STR_TYPE_NAME "__const_str"
+
+/* 内置节点类型，ID在编译期确定，注册表创建时按此顺序注册 */
+enum parser_builtin_node_type {
+    CODE_BLOCK_TYPE_ID = 0,
+    FUNCTION_DEF_TYPE_ID,
+    EXPR_TYPE_ID,
+    IDENTIFIER_TYPE_ID,
+    CONST_NUM_TYPE_ID,
+    CONST_STR_TYPE_ID,
+    PARSER_BUILTIN_NODE_TYPE_COUNT
+};
+
+/* 语法树节点结构，从AstArena分配，没有虚函数表，随内存池整体释放 */
 typedef class AstNode {
     public:
         const parser_node_t type;   /* 节点类型 */
-        char const * const value;   /* 节点值（如标识符名、常量值等） */
-        std::list<AstNode*> child;  /* 子节点数组 */
+        char const * const value;   /* 节点值（如标识符名、常量值等），标识符和字符串指向原子表，其它存放在内存池中 */
+        const lex_atom_t atom;      /* 标识符和字符串的原子ID，比较名称时直接比较ID；其它节点为LEX_ATOM_NONE */
+        uint32_t index;             /* 在父节点子节点数组中的下标，占用atom之后的对齐空隙，遍历时据此找到下一个兄弟节点 */
+        AstChildren child;          /* 子节点数组 */
         struct AstNode* parent;     /* 父节点 */
 
-        AstNode(const parser_node_t type, AstNode* parent=nullptr, const char* value=nullptr)
-            :type(type), value(value), parent(parent)
+        AstNode(const parser_node_t type, AstNode* parent=nullptr, const char* value=nullptr, lex_atom_t atom=LEX_ATOM_NONE)
+            :type(type), value(value), atom(atom), index(0), parent(parent)
         {
-            if(value == nullptr){
-                this->child = std::list<AstNode*>();
-            }
         }
-        virtual ~AstNode();
 } AstNode;
 
-/* 注册一个新的语法树节点类型
+/* 注册一个新的语法树节点类型，可以在多个线程中同时调用
  * @param name 节点类型的名称字符串
- * @return 返回分配的节点类型ID
+ * @return 返回分配的节点类型ID，已注册时返回原有的ID，超出上限时返回PARSER_NODE_TYPE_NONE
  */
 extern parser_node_t parser_register_node_type(const char* name);
 
-/* 根据节点类型名称获取节点类型ID
+/* 根据节点类型名称获取节点类型ID，不加锁
  * @param name 节点类型的名称字符串
- * @return 返回对应的节点类型ID，如果不存在返回0
+ * @return 返回对应的节点类型ID，如果不存在返回PARSER_NODE_TYPE_NONE
  */
 extern parser_node_t parser_get_node_type(const char* name);
 
@@ -56,21 +152,424 @@ extern void yyerror(const char* s);
 // AstNode* create_node(parser_node_t type, const char* value);
 // void free_ast(AstNode* node);
 
-/* 语法分析器入口 */
+/* 
+ * 可重入的语法分析器接口
+ * 每个上下文有自己的词法分析器、词法单元缓冲和语法树内存池，
+ * 不同线程使用不同的上下文即可同时分析不同的文件
+ */
+struct parse_context;
+
+/* 创建语法分析器上下文，失败返回NULL */
+struct parse_context* parse_create(void);
+/* 创建使用指定分配器的语法分析器上下文：上下文本身、原子表、语法树内存池和词法单元文本都从它分配，
+ * 分配器要比上下文活得更久；NULL表示默认分配器 */
+struct parse_context* parse_create_with_allocator(struct lex_allocator* allocator);
+void parse_destroy(struct parse_context* ctx);
+
+int parse_init_r(struct parse_context* ctx, const char* input, size_t length);
+int parse_init_with_buffer_r(struct parse_context* ctx, char* buffer, size_t length);
+int parse_init_with_fd_r(struct parse_context* ctx, int fd);
+/* 选择词法分析引擎，参见lex_set_engine */
+void parse_set_engine_r(struct parse_context* ctx, enum lex_engine engine);
+/* 设置语法错误的输出位置，默认为stderr，NULL表示恢复默认 */
+void parse_set_diagnostics_r(struct parse_context* ctx, FILE* diagnostics);
+/*
+ * 设置诊断信息中的文件名，语法错误以"文件名:行:列: "开头；NULL表示使用"<input>"
+ * 上下文只保存指针，name在语法分析期间必须有效
+ */
+void parse_set_filename_r(struct parse_context* ctx, const char* name);
+/*
+ * 把当前输入中的字节偏移换算为行号和列号，供诊断信息和调试信息使用
+ * 第一次调用时才建立换行索引；流式输入没有完整的源缓冲区，无法换算
+ * @return 1表示成功，0表示无法换算
+ */
+int parse_get_position_r(struct parse_context* ctx, size_t offset, struct lex_position* position);
+/*
+ * 语法分析统计
+ * 设置后按批累加语法分析器取走的词法单元，parse_r结束时记录内存池的大小；
+ * 编译时定义BASM_NO_STATS则不做任何统计
+ */
+struct parse_stats {
+    unsigned long tokens[LEX_TOKEN_TYPE_COUNT];     /* 按类型统计的词法单元数 */
+    size_t arena_bytes;                             /* 语法树内存池占用的字节数 */
+};
+/*
+ * 设置流水线模式：parse_r期间词法分析在单独的线程中进行，词法单元经容量为capacity的
+ * 无锁环形缓冲区交给语法分析器，两者在多核机器上同时运行。
+ * 只对parse_init_r和parse_init_with_buffer_r的完整输入生效，流式输入仍然串行分析；
+ * 语法树、原子ID和诊断信息都与串行分析相同
+ * @param capacity 环形缓冲区容纳的词法单元数，0表示关闭流水线
+ * @return 1表示成功，0表示内存不足，此时流水线被关闭
+ */
+int parse_set_pipeline_r(struct parse_context* ctx, size_t capacity);
+/* 设置统计的输出位置，NULL表示不统计 */
+void parse_set_stats_r(struct parse_context* ctx, struct parse_stats* stats);
+/* 执行语法分析，返回0表示成功 */
+int parse_r(struct parse_context* ctx);
+/* 语法树根节点，在parse_cleanup_r之前有效 */
+AstNode* parse_get_root_r(const struct parse_context* ctx);
+/* 上下文的原子表，节点的atom字段在其中查找；与语法树一样在parse_cleanup_r之前有效 */
+struct lex_atom_table* parse_get_atoms_r(const struct parse_context* ctx);
+/* 释放输入和语法树并清空原子表，上下文可以继续用于下一个文件 */
+void parse_cleanup_r(struct parse_context* ctx);
+
+/* 语法分析器入口，使用默认上下文 */
 int parse_init(const char* input, size_t length);
+/* 不复制输入，buffer末尾须有LEX_BUFFER_PADDING个'\0'，参见lex_init_with_buffer */
+int parse_init_with_buffer(char* buffer, size_t length);
+/* 从文件描述符流式读取输入 */
+int parse_init_with_fd(int fd);
+void parse_set_engine(enum lex_engine engine);
 void parse_cleanup(void);
 
 /* 预处理功能 */
 /* 注意：预处理功能现在由语法分析器处理，而不是词法分析器 */
 
-/* 语法树根节点，供外部访问 */
+/* 语法树根节点，供外部访问，在parse_cleanup之前有效 */
 extern AstNode* ast_root;
 
-/* 打印语法树 */
+/* 
+ * 语法树的文本输出
+ * 输出先写入AST_PRINT_BUFFER_SIZE字节的缓冲区，满了才交给回调，逐节点输出不会逐次调用写函数；
+ * 遍历不使用递归，任意深度的语法树都可以输出
+ */
+#define AST_PRINT_BUFFER_SIZE (64 * 1024)
+
+enum ast_print_format {
+    ast_print_text,     /* 每行一个节点，每层缩进两个空格，类型名和节点值以制表符分隔 */
+    ast_print_json,     /* 嵌套的{"type","value","children"}对象，整棵树输出为一行 */
+};
+
+/* 输出回调，返回写入的字节数，少于size表示出错 */
+typedef size_t (*ast_print_write_fn)(void* user, const char* data, size_t size);
+
+/**
+ * 输出语法树
+ * @param root 语法树根节点，可以是任意子树
+ * @param format 输出格式
+ * @param write 输出回调
+ * @param user 传给回调的参数
+ * @return 1表示成功，0表示回调出错
+ */
+int ast_print(const AstNode* root, enum ast_print_format format, ast_print_write_fn write, void* user);
+
+/* 输出语法树到文件，参见ast_print */
+int ast_print_file(const AstNode* root, enum ast_print_format format, FILE* out);
+
+/* 以文本格式打印语法树到标准输出，level为根节点的缩进层级 */
 void print_ast(AstNode* node, int level);
 
+/* 获取已注册的节点类型数量，类型ID从0开始连续分配 */
+extern size_t parser_get_node_type_count(void);
+
+/*
+ * 二进制语法树文件
+ *
+ * 文件布局：ast_file_header、节点数组、类型表、字符串索引、字符串数据、ast_file_footer，
+ * 各段按8字节对齐，全部为本机字节序。节点按广度优先顺序排列，
+ * 因此每个节点的子节点在节点数组中是连续的一段[first_child, first_child + child_count)。
+ * 节点值和类型名都存放在去重后的字符串表中，字符串以'\0'结尾，可以直接当作C字符串使用。
+ * 段的位置和数量记录在文件末尾的ast_file_footer中，写入时只需顺序遍历一次语法树，
+ * 读取时映射整个文件即可使用，不需要解析也不需要分配内存。
+ */
+#define AST_FILE_MAGIC "BAST"
+#define AST_FILE_VERSION 1
+/* 表示没有父节点或没有节点值 */
+#define AST_FILE_NONE 0xffffffffu
+
+struct ast_file_header {
+    char magic[4];          /* AST_FILE_MAGIC */
+    uint32_t version;       /* AST_FILE_VERSION */
+};
+
+struct ast_file_node {
+    uint32_t type;          /* 节点类型ID，对应类型表中的下标 */
+    uint32_t value;         /* 节点值在字符串表中的下标，没有值时为AST_FILE_NONE */
+    uint32_t parent;        /* 父节点下标，根节点为AST_FILE_NONE */
+    uint32_t first_child;   /* 第一个子节点的下标 */
+    uint32_t child_count;   /* 子节点数量 */
+};
+
+struct ast_file_string {
+    uint32_t offset;        /* 在字符串数据中的偏移 */
+    uint32_t length;        /* 长度，不含结尾的'\0' */
+};
+
+struct ast_file_footer {
+    uint32_t node_count;
+    uint32_t type_count;    /* 类型表的项数，每项是类型名在字符串表中的下标 */
+    uint32_t string_count;
+    uint32_t root;          /* 根节点下标，始终为0 */
+    uint64_t nodes_offset;
+    uint64_t types_offset;
+    uint64_t strings_offset;
+    uint64_t string_data_offset;
+    uint64_t string_data_size;
+    char magic[4];          /* AST_FILE_MAGIC，用于确认文件完整 */
+    uint32_t version;
+};
+
+/* 已打开的二进制语法树文件，各指针都指向映射的内存 */
+struct ast_file {
+    void* map;                              /* 映射的地址，由ast_file_load载入时为NULL */
+    size_t map_size;
+    const struct ast_file_node* nodes;
+    uint32_t node_count;
+    const uint32_t* types;
+    uint32_t type_count;
+    const struct ast_file_string* strings;
+    uint32_t string_count;
+    const char* string_data;
+    size_t string_data_size;
+};
+
+/**
+ * 将语法树写成二进制格式
+ * @param root 语法树根节点
+ * @param out 输出文件，只做顺序写入，可以是管道
+ * @return 1表示成功，0表示失败；节点数、字符串数或字符串数据超出格式的32位下标和偏移时也失败
+ */
+int ast_file_write(const AstNode* root, FILE* out);
+
+/**
+ * 映射二进制语法树文件
+ * @param file 输出的文件结构
+ * @param filename 文件名
+ * @return 1表示成功，0表示文件无法打开或格式不正确
+ */
+int ast_file_open(struct ast_file* file, const char* filename);
+
+/**
+ * 从内存中载入二进制语法树，不复制数据，data在使用期间必须有效且按8字节对齐
+ * @return 1表示成功，0表示格式不正确
+ */
+int ast_file_load(struct ast_file* file, const void* data, size_t size);
+
+/* 解除映射 */
+void ast_file_close(struct ast_file* file);
+
+/* 获取节点，下标越界时返回NULL */
+const struct ast_file_node* ast_file_get_node(const struct ast_file* file, uint32_t index);
+
+/* 获取节点的第i个子节点，越界时返回NULL */
+const struct ast_file_node* ast_file_get_child(const struct ast_file* file, const struct ast_file_node* node, uint32_t i);
+
+/* 获取节点值，没有值时返回NULL */
+const char* ast_file_get_value(const struct ast_file* file, const struct ast_file_node* node);
+
+/* 获取节点类型名，需要映射到当前进程的类型ID时配合parser_get_node_type使用 */
+const char* ast_file_get_type_name(const struct ast_file* file, const struct ast_file_node* node);
+
+/**
+ * 按与ast_print相同的格式输出二进制语法树文件
+ * @return 1表示成功，0表示回调出错或文件中的树结构不正确
+ */
+int ast_file_print(const struct ast_file* file, enum ast_print_format format, ast_print_write_fn write, void* user);
+
+/*
+ * 语法分析缓存
+ *
+ * 缓存目录中每个条目对应一份源代码的分析结果，文件名由源代码内容的哈希决定，
+ * 哈希的种子来自PARSER_VERSION和当前的节点类型表，版本或语法变化后旧条目自然失效。
+ * 条目以parse_cache_header开头，之后是词法单元数组或二进制语法树，读取时直接映射。
+ * 写入先写临时文件再改名，多个进程共用一个缓存目录也不会读到不完整的条目。
+ */
+#define PARSER_VERSION "basm-parser 1"
+#define PARSE_CACHE_MAGIC "BPCH"
+#define PARSE_CACHE_VERSION 1
+
+enum parse_cache_kind {
+    parse_cache_tokens = 1,     /* 词法单元数组 */
+    parse_cache_ast = 2,        /* 二进制语法树 */
+};
+
+struct parse_cache_header {
+    char magic[4];              /* PARSE_CACHE_MAGIC */
+    uint32_t version;           /* PARSE_CACHE_VERSION */
+    uint32_t kind;              /* enum parse_cache_kind */
+    uint32_t reserved;
+    uint64_t source_size;       /* 源代码长度 */
+    uint64_t source_check;      /* 用另一个种子计算的源代码哈希，排除文件名哈希的碰撞 */
+};
+
+/* 缓存中的词法单元，文本从源代码中按偏移取得 */
+struct parse_cache_token {
+    uint32_t type;              /* enum lex_token_type */
+    uint32_t size;
+    uint64_t offset;
+};
+
+struct parse_cache {
+    char* dir;                  /* 缓存目录 */
+    uint64_t seed;              /* 由版本和节点类型表得到的哈希种子 */
+    unsigned long hits;         /* 命中次数 */
+    unsigned long misses;       /* 未命中次数 */
+    unsigned long stores;       /* 写入的条目数 */
+    unsigned long errors;       /* 写入失败或条目损坏的次数 */
+};
+
+/* 映射的词法单元缓存条目 */
+struct parse_cache_token_list {
+    void* map;
+    size_t map_size;
+    const struct parse_cache_token* tokens;
+    size_t count;
+};
+
+/**
+ * 计算数据的64位哈希，每次处理32字节
+ * @param data 数据
+ * @param size 数据长度
+ * @param seed 种子
+ * @return 哈希值
+ */
+uint64_t parse_cache_hash(const void* data, size_t size, uint64_t seed);
+
+/**
+ * 打开缓存目录，目录不存在时创建
+ * 节点类型表参与计算哈希种子，应在节点类型都注册之后调用
+ * @return 1表示成功，0表示失败
+ */
+int parse_cache_open(struct parse_cache* cache, const char* dir);
+void parse_cache_close(struct parse_cache* cache);
+
+/**
+ * 查找源代码对应的语法树，命中时file映射缓存条目，用ast_file_close释放
+ * @return 1表示命中，0表示未命中
+ */
+int parse_cache_load_ast(struct parse_cache* cache, const char* source, size_t size, struct ast_file* file);
+
+/**
+ * 保存源代码对应的语法树
+ * @return 1表示成功，0表示失败
+ */
+int parse_cache_store_ast(struct parse_cache* cache, const char* source, size_t size, const AstNode* root);
+
+/**
+ * 查找源代码对应的词法单元，命中时用parse_cache_tokens_close释放
+ * @return 1表示命中，0表示未命中
+ */
+int parse_cache_load_tokens(struct parse_cache* cache, const char* source, size_t size, struct parse_cache_token_list* list);
+
+/**
+ * 保存源代码对应的词法单元
+ * @return 1表示成功，0表示失败
+ */
+int parse_cache_store_tokens(struct parse_cache* cache, const char* source, size_t size,
+                             const struct parse_cache_token* tokens, size_t count);
+void parse_cache_tokens_close(struct parse_cache_token_list* list);
+
 #ifdef __cplusplus
 }
 #endif
 
+inline void AstChildren::push_back(AstArena& arena, AstNode* node){
+    if(count == capacity){
+        uint32_t new_capacity = capacity ? capacity * 2 : 4;
+        AstNode** new_items = (AstNode**)arena.allocate(new_capacity * sizeof(AstNode*), alignof(AstNode*));
+        for(uint32_t i = 0; i < count; i++){
+            new_items[i] = items[i];
+        }
+        items = new_items;
+        capacity = new_capacity;
+    }
+    node->index = count;
+    items[count++] = node;
+}
+
+/* 
+ * 语法树的深度优先遍历
+ * 沿父节点指针和节点在父节点中的下标移动，不使用递归，也不需要栈，遍历过程中不做任何分配。
+ * 依次给出进入和离开每个节点的事件，进入的顺序是先序，离开的顺序是后序；遍历期间不能修改语法树
+ */
+class AstWalker {
+    public:
+        explicit AstWalker(const AstNode* root): root(root), node(root), entering(true), level(0) {}
+
+        /* 所有事件都已给出 */
+        bool done() const { return node == nullptr; }
+        const AstNode* current() const { return node; }
+        /* true表示进入当前节点，false表示离开 */
+        bool is_enter() const { return entering; }
+        /* 当前节点相对根节点的深度 */
+        size_t depth() const { return level; }
+
+        /* 移动到下一个事件 */
+        void next(){
+            if(entering){
+                if(!node->child.empty()){
+                    node = node->child[0];
+                    level++;
+                }else{
+                    entering = false;
+                }
+                return;
+            }
+            if(node == root){
+                node = nullptr;
+                return;
+            }
+            const AstNode* parent = node->parent;
+            if(node->index + 1 < parent->child.size()){
+                node = parent->child[node->index + 1];
+                entering = true;
+            }else{
+                node = parent;
+                level--;
+            }
+        }
+
+        /* 在进入事件上调用，跳过当前节点的子树，下一个事件是离开当前节点 */
+        void skip_children(){
+            entering = false;
+        }
+    private:
+        const AstNode* root;
+        const AstNode* node;
+        bool entering;
+        size_t level;
+};
+
+/* 先序（Post为false）或后序（Post为true）的节点迭代器 */
+template<bool Post>
+class AstOrderIterator {
+    public:
+        explicit AstOrderIterator(const AstNode* root): walker(root) { settle(); }
+
+        const AstNode* operator*() const { return walker.current(); }
+        AstOrderIterator& operator++(){
+            walker.next();
+            settle();
+            return *this;
+        }
+        bool operator==(const AstOrderIterator& other) const { return walker.current() == other.walker.current(); }
+        bool operator!=(const AstOrderIterator& other) const { return !(*this == other); }
+        size_t depth() const { return walker.depth(); }
+    private:
+        AstWalker walker;
+
+        /* 跳过另一种顺序的事件 */
+        void settle(){
+            while(!walker.done() && walker.is_enter() == Post){
+                walker.next();
+            }
+        }
+};
+
+/* 
+ * 可用于范围for的遍历，例如 for(const AstNode* node : AstPreorder(root))
+ * 后序遍历中子节点总在父节点之前，适合自底向上计算
+ */
+template<bool Post>
+class AstOrder {
+    public:
+        explicit AstOrder(const AstNode* root): root(root) {}
+        AstOrderIterator<Post> begin() const { return AstOrderIterator<Post>(root); }
+        AstOrderIterator<Post> end() const { return AstOrderIterator<Post>(nullptr); }
+    private:
+        const AstNode* root;
+};
+typedef AstOrder<false> AstPreorder;
+typedef AstOrder<true> AstPostorder;
+
 #endif /* __PARSER_H__ */ 
\ No newline at end of file
@@ -0,0 +1,34 @@
+#include "stats_heap.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifndef BASM_NO_STATS
+bool statsHeapEnabled = false;
+thread_local size_t threadHeapBytes = 0;
+thread_local size_t threadHeapCount = 0;
+
+/*
+ * 替换放在单独的翻译单元中：与使用new的代码放在一起时，-O2下编译器内联后把operator new的结果
+ * 与这里的free配对检查（-Wmismatched-new-delete）
+ */
+void* operator new(size_t size) {
+    if (statsHeapEnabled) {
+        threadHeapBytes += size;
+        threadHeapCount++;
+    }
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+#endif
@@ -0,0 +1,19 @@
+#ifndef STATS_HEAP_H
+#define STATS_HEAP_H
+
+#include <cstddef>
+
+/*
+ * --stats的C++堆分配计数
+ * 全局operator new在stats_heap.cpp中替换，只有statsHeapEnabled为true时才计数，
+ * 没有--stats时每次分配只多一次读取；编译时定义BASM_NO_STATS则不替换
+ */
+#ifndef BASM_NO_STATS
+/* 是否计数，在启动工作线程之前设置 */
+extern bool statsHeapEnabled;
+/* 当前线程的累计分配字节数和次数，按文件统计时取前后的差 */
+extern thread_local size_t threadHeapBytes;
+extern thread_local size_t threadHeapCount;
+#endif
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * 服务器模式的检查
+ * 启动 main --server，通过Unix域套接字发送请求并检查响应：
+ *   - 一个请求分两次写入（命令和换行分开）仍然完整
+ *   - 超过一次recv大小（64 KiB）的请求仍然完整
+ *   - 一个客户端发出请求后不读取响应，其它客户端的请求照常得到响应
+ *   - 以未闭合的注释结束的请求不影响之后的请求
+ *
+ * 用法: server_test <main程序>
+ */
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+
+#define SERVER_TEST_TIMEOUT_MS 10000    // 等待每个响应的最长时间
+
+static int failures = 0;
+
+static void check(bool ok, const char* what) {
+    printf("%s: %s\n", ok ? "通过" : "失败", what);
+    if (!ok) {
+        failures++;
+    }
+}
+
+/* 连接服务器，服务器刚启动时套接字可能还没有建立，重试一段时间 */
+static int connectServer(const std::string& path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size());
+    for (int attempt = 0; attempt < 200; ++attempt) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr*)&address, sizeof(address)) == 0) {
+            return fd;
+        }
+        close(fd);
+        usleep(50 * 1000);
+    }
+    return -1;
+}
+
+static bool writeAll(int fd, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += (size_t)n;
+    }
+    return true;
+}
+
+/* 读取恰好size字节，超时或对方断开时返回false */
+static bool readExact(int fd, std::string& data, size_t size) {
+    data.clear();
+    while (data.size() < size) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, SERVER_TEST_TIMEOUT_MS) <= 0) {
+            return false;
+        }
+        char buffer[4096];
+        size_t want = size - data.size() < sizeof(buffer) ? size - data.size() : sizeof(buffer);
+        ssize_t n = recv(fd, buffer, want, 0);
+        if (n <= 0) {
+            return false;
+        }
+        data.append(buffer, (size_t)n);
+    }
+    return true;
+}
+
+/* 读取一个响应："<状态> <输出字节数> <错误字节数>\n"之后是输出和错误 */
+static bool readResponse(int fd, int& status, std::string& out, std::string& err) {
+    std::string header;
+    std::string c;
+    while (header.empty() || header.back() != '\n') {
+        if (!readExact(fd, c, 1)) {
+            return false;
+        }
+        header += c;
+    }
+    size_t outSize = 0;
+    size_t errSize = 0;
+    if (sscanf(header.c_str(), "%d %zu %zu", &status, &outSize, &errSize) != 3) {
+        return false;
+    }
+    return readExact(fd, out, outSize) && readExact(fd, err, errSize);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "用法: %s <main程序>\n", argv[0]);
+        return 2;
+    }
+    std::string socketPath = "/tmp/basm-server-test-" + std::to_string(getpid()) + ".sock";
+    pid_t server = fork();
+    if (server == 0) {
+        execl(argv[1], argv[1], ("--server=" + socketPath).c_str(), (char*)nullptr);
+        _exit(127);
+    }
+    if (server < 0) {
+        perror("fork");
+        return 2;
+    }
+
+    int fd = connectServer(socketPath);
+    check(fd >= 0, "连接服务器");
+    if (fd >= 0) {
+        int status = -1;
+        std::string out;
+        std::string err;
+
+        // 命令和换行分两次写入，中间留出时间让服务器先收到前半部分
+        writeAll(fd, "eval 1 + 2");
+        usleep(200 * 1000);
+        writeAll(fd, "\n");
+        check(readResponse(fd, status, out, err) && status == 0 && out == "3\n", "请求分两次写入");
+
+        // 超过64 KiB的请求需要多次recv才能收完
+        std::string expression = "eval 0";
+        size_t terms = 0;
+        while (expression.size() < 100 * 1024) {
+            expression += " + 1";
+            terms++;
+        }
+        writeAll(fd, expression + "\n");
+        check(readResponse(fd, status, out, err) && status == 0 && out == std::to_string(terms) + "\n",
+              "超过64 KiB的请求");
+
+        // 响应远大于套接字缓冲区的请求，发出后不读取
+        std::string sourcePath = "/tmp/basm-server-test-" + std::to_string(getpid()) + ".basm";
+        FILE* source = fopen(sourcePath.c_str(), "w");
+        for (int i = 0; source && i < 100000; ++i) {
+            fputs("main { 1 \"abc\" 0x10 }\n", source);
+        }
+        if (source) {
+            fclose(source);
+        }
+        int stalled = connectServer(socketPath);
+        writeAll(stalled, "lex " + sourcePath + "\nlex " + sourcePath + "\n");
+        usleep(200 * 1000);
+        writeAll(fd, "eval 4 * 5\n");
+        check(readResponse(fd, status, out, err) && status == 0 && out == "20\n", "不读取响应的客户端不影响其它客户端");
+        close(stalled);
+        unlink(sourcePath.c_str());
+
+        // 词法分析器在请求之间复用，未闭合的注释不能让之后的输入都成为注释
+        writeAll(fd, "eval /*\n");
+        readResponse(fd, status, out, err);
+        writeAll(fd, "eval 6 * 7\n");
+        check(readResponse(fd, status, out, err) && status == 0 && out == "42\n", "未闭合注释之后的eval");
+
+        std::string openPath = "/tmp/basm-server-test-" + std::to_string(getpid()) + "-open.basm";
+        std::string nextPath = "/tmp/basm-server-test-" + std::to_string(getpid()) + "-next.basm";
+        FILE* open = fopen(openPath.c_str(), "w");
+        FILE* next = fopen(nextPath.c_str(), "w");
+        if (open) {
+            fputs("main { 1 }\n/* never closed\n", open);
+            fclose(open);
+        }
+        if (next) {
+            fputs("main { 2 }\nfoo { 3 }\n", next);
+            fclose(next);
+        }
+        writeAll(fd, "parse " + openPath + "\n");
+        readResponse(fd, status, out, err);
+        writeAll(fd, "parse " + nextPath + "\n");
+        check(readResponse(fd, status, out, err) && status == 0 && out.find("__const_num\t3") != std::string::npos,
+              "未闭合注释之后的parse");
+        unlink(openPath.c_str());
+        unlink(nextPath.c_str());
+
+        writeAll(fd, "shutdown\n");
+        readResponse(fd, status, out, err);
+        close(fd);
+    }
+
+    // 正常情况下服务器已经因shutdown退出
+    int waitStatus = 0;
+    for (int i = 0; i < 100 && waitpid(server, &waitStatus, WNOHANG) == 0; ++i) {
+        usleep(50 * 1000);
+    }
+    if (waitpid(server, &waitStatus, WNOHANG) == 0) {
+        kill(server, SIGKILL);
+        waitpid(server, &waitStatus, 0);
+        check(false, "服务器收到shutdown后退出");
+    }
+    unlink(socketPath.c_str());
+    return failures ? 1 : 0;
+}